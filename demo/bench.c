@@ -0,0 +1,215 @@
+//===--------------------------------------------------------------------------------------------===
+// bench - Draws the same compass rose with the Cairo and GL vector backends, and times both
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2021 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include <ccore/log.h>
+#include <libavionics/canvas.h>
+#include <libavionics/display.h>
+#include <libavionics/renderer.h>
+#include "app.h"
+#include <cairo/cairo-ft.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifndef M_PI
+#define M_PI (3.14159265358979323846)
+#endif
+#define SIZE (512)
+#define FONT_PATH "Q4XP_Displays.ttf"
+#define FONT_SIZE (16)
+#define REPORT_FRAMES (120)
+
+typedef struct {
+    av_display_t *cairo;
+    av_display_t *vector;
+    av_target_t *target;
+
+    FT_Library ft_library;
+    FT_Face ft_font;
+    cairo_font_face_t *cairo_font;
+    av_font_t *font;
+
+    double heading;
+    double cairo_time;
+    double vector_time;
+    unsigned frames;
+} bench_t;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void draw_cairo(bench_t *bench) {
+    av_display_clear(bench->cairo);
+    cairo_t *cr = av_display_get_cairo(bench->cairo);
+    cairo_save(cr);
+    cairo_translate(cr, SIZE / 2, SIZE / 2);
+    cairo_set_source_rgb(cr, 1, 1, 1);
+    cairo_set_line_width(cr, 2);
+    cairo_arc(cr, 0, 0, 200, 0, 2 * M_PI);
+    cairo_stroke(cr);
+
+    cairo_rotate(cr, -bench->heading * M_PI / 180.0);
+    cairo_set_font_face(cr, bench->cairo_font);
+    cairo_set_font_size(cr, FONT_SIZE);
+    for(int i = 0; i < 72; ++i) {
+        double length = (i % 2) ? 10 : 20;
+        cairo_move_to(cr, 0, -200);
+        cairo_line_to(cr, 0, -200 + length);
+        cairo_stroke(cr);
+        if(i % 6 == 0) {
+            char label[4];
+            snprintf(label, sizeof(label), "%d", i / 2);
+            cairo_move_to(cr, -6, -160);
+            cairo_show_text(cr, label);
+        }
+        cairo_rotate(cr, M_PI / 36.0);
+    }
+
+    cairo_set_source_rgba(cr, 1, 0.4, 1, 0.8);
+    cairo_move_to(cr, 0, -120);
+    cairo_curve_to(cr, 60, -60, -60, 60, 0, 120);
+    cairo_stroke(cr);
+    cairo_restore(cr);
+
+    cairo_set_source_rgb(cr, 1, 0.8, 0);
+    cairo_move_to(cr, SIZE / 2, SIZE / 2 - 12);
+    cairo_line_to(cr, SIZE / 2 + 10, SIZE / 2 + 12);
+    cairo_line_to(cr, SIZE / 2 - 10, SIZE / 2 + 12);
+    cairo_close_path(cr);
+    cairo_fill(cr);
+    av_display_finish_back_buffer(bench->cairo);
+}
+
+// The same scene, through the canvas. Frames start out transparent, so there is nothing to clear.
+static void draw_vector(bench_t *bench) {
+    av_canvas_t *canvas = av_display_get_canvas(bench->vector);
+    av_canvas_save(canvas);
+    av_canvas_translate(canvas, SIZE / 2, SIZE / 2);
+    av_canvas_set_rgba(canvas, 1, 1, 1, 1);
+    av_canvas_set_line_width(canvas, 2);
+    av_canvas_arc(canvas, 0, 0, 200, 0, 2 * M_PI);
+    av_canvas_stroke(canvas);
+
+    av_canvas_rotate(canvas, -bench->heading * M_PI / 180.0);
+    av_canvas_set_font(canvas, bench->font);
+    for(int i = 0; i < 72; ++i) {
+        double length = (i % 2) ? 10 : 20;
+        av_canvas_move_to(canvas, 0, -200);
+        av_canvas_line_to(canvas, 0, -200 + length);
+        av_canvas_stroke(canvas);
+        if(i % 6 == 0) {
+            char label[4];
+            snprintf(label, sizeof(label), "%d", i / 2);
+            av_canvas_show_text(canvas, -6, -160, label);
+        }
+        av_canvas_rotate(canvas, M_PI / 36.0);
+    }
+
+    av_canvas_set_rgba(canvas, 1, 0.4, 1, 0.8);
+    av_canvas_move_to(canvas, 0, -120);
+    av_canvas_curve_to(canvas, 60, -60, -60, 60, 0, 120);
+    av_canvas_stroke(canvas);
+    av_canvas_restore(canvas);
+
+    av_canvas_set_rgba(canvas, 1, 0.8, 0, 1);
+    av_canvas_move_to(canvas, SIZE / 2, SIZE / 2 - 12);
+    av_canvas_line_to(canvas, SIZE / 2 + 10, SIZE / 2 + 12);
+    av_canvas_line_to(canvas, SIZE / 2 - 10, SIZE / 2 + 12);
+    av_canvas_close_path(canvas);
+    av_canvas_fill(canvas);
+    av_display_finish_back_buffer(bench->vector);
+}
+
+static void init(void *user_data) {
+    bench_t *bench = user_data;
+    av_render_init();
+
+    FT_Init_FreeType(&bench->ft_library);
+    FT_New_Face(bench->ft_library, FONT_PATH, 0, &bench->ft_font);
+    bench->cairo_font = cairo_ft_font_face_create_for_ft_face(bench->ft_font, 0);
+    bench->font = av_font_new(FONT_PATH, FONT_SIZE);
+
+    bench->cairo = av_display_new(SIZE, SIZE);
+    bench->vector = av_display_new_desc(&(av_display_desc_t){
+        .width = SIZE,
+        .height = SIZE,
+        .backend = AV_DISPLAY_BACKEND_VECTOR,
+    });
+    if(!bench->font || !bench->vector) {
+        CCERROR("the vector backend is not available");
+        abort();
+    }
+    bench->target = av_target_new(0, 0, SIZE * 2, SIZE);
+}
+
+static void fini(void *user_data) {
+    bench_t *bench = user_data;
+    av_display_delete(bench->cairo);
+    av_display_delete(bench->vector);
+    av_font_delete(bench->font);
+    av_target_delete(bench->target);
+
+    cairo_font_face_destroy(bench->cairo_font);
+    FT_Done_Face(bench->ft_font);
+    FT_Done_FreeType(bench->ft_library);
+    av_render_deinit();
+}
+
+// Each backend is timed from the start of drawing to the moment its texture is ready, glFinish()
+// making sure the GPU work of the vector backend is counted.
+static void update(double delta, const renderer_t *r, void *user_data) {
+    (void)r;
+    bench_t *bench = user_data;
+    bench->heading = fmod(bench->heading + 30 * delta, 360);
+
+    double start = now();
+    draw_cairo(bench);
+    av_display_upload(bench->cairo);
+    glFinish();
+    double middle = now();
+    draw_vector(bench);
+    av_display_upload(bench->vector);
+    glFinish();
+    double end = now();
+
+    bench->cairo_time += middle - start;
+    bench->vector_time += end - middle;
+    if(++bench->frames == REPORT_FRAMES) {
+        CCINFO("cairo: %.3fms/frame, vector: %.3fms/frame",
+            bench->cairo_time * 1e3 / REPORT_FRAMES,
+            bench->vector_time * 1e3 / REPORT_FRAMES);
+        bench->frames = 0;
+        bench->cairo_time = 0;
+        bench->vector_time = 0;
+    }
+
+    av_render_begin();
+    av_render_display(bench->target, bench->cairo, CC_VEC2(0, 0), CC_VEC2(SIZE, SIZE), 1);
+    av_render_display(bench->target, bench->vector, CC_VEC2(SIZE, 0), CC_VEC2(SIZE, SIZE), 1);
+    av_render_end();
+}
+
+int main(int argc, const char **argv) {
+    cc_set_log_name("bench");
+
+    app_desc_t desc;
+    desc.name = "libavionics backend benchmark";
+    desc.width = SIZE * 2;
+    desc.height = SIZE;
+    desc.version_major = 3;
+    desc.version_minor = 0;
+
+    bench_t bench = {0};
+    app_main(&desc, init, update, fini, &bench);
+}
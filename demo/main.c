@@ -25,7 +25,7 @@
 #define radians(v) ((v) * M_PI/180.0)
 
 typedef struct {
-    mfd_display_t *efis;
+    av_display_t *efis;
     bool stop;
     pthread_t efis_thread;
     unsigned tex;
@@ -39,16 +39,13 @@ typedef struct {
 static void efis_frame(app_data_t *data) {
     if(!data->efis) return;
 
-    cairo_t *cr = display_get_cairo(data->efis);
+    av_display_clear(data->efis);
+    cairo_t *cr = av_display_get_cairo(data->efis);
 
     // cairo_set_antialias(cr, CAIRO_ANTIALIAS_SUBPIXEL);
 
 
-    cairo_set_source_rgba(cr, 0, 0, 0, 0);
     cairo_identity_matrix(cr);
-    cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
-    cairo_rectangle(cr, 0, 0, WIDTH, HEIGHT);
-    cairo_fill(cr);
     cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
 
 
@@ -138,7 +135,7 @@ static void efis_frame(app_data_t *data) {
     // cairo_fill(cr);
 
 
-    display_finish_back_buffer(data->efis);
+    av_display_finish_back_buffer(data->efis);
 }
 
 static void *efis_thread(void *user_data) {
@@ -155,7 +152,7 @@ static void *efis_thread(void *user_data) {
 
 static void init(void *user_data) {
     app_data_t *data = user_data;
-    data->efis = display_new(WIDTH, HEIGHT);
+    data->efis = av_display_new(WIDTH, HEIGHT);
     data->stop = false;
 
     FT_Init_FreeType(&data->ft_library);
@@ -173,13 +170,13 @@ static void fini(void *user_data) {
     FT_Done_Face(data->ft_font);
     FT_Done_FreeType(data->ft_library);
 
-    display_delete(data->efis);
+    av_display_delete(data->efis);
 }
 
 void update(double delta, const renderer_t *r, void *user_data) {
     app_data_t *data = user_data;
-    display_upload(data->efis);
-    render_quad(r, display_get_texture(data->efis), 0, 0, WIDTH, HEIGHT);
+    av_display_upload(data->efis);
+    render_quad(r, av_display_get_texture(data->efis), 0, 0, WIDTH, HEIGHT);
 }
 
 int main(int argc, const char **argv) {
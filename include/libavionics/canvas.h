@@ -0,0 +1,78 @@
+//===--------------------------------------------------------------------------------------------===
+// canvas.h - Vector drawing onto GL-rendered displays
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2021 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#pragma once
+#include <stdbool.h>
+#include <libavionics/display.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Displays created with AV_DISPLAY_BACKEND_VECTOR are drawn through a canvas rather than Cairo. The
+// drawing thread records paths and text, and av_display_upload() renders them on the GPU, straight
+// into the display's texture. The API follows Cairo's, for the subset it supports.
+
+typedef struct av_canvas_s av_canvas_t;
+typedef struct av_font_s av_font_t;
+
+/// Loads the font at [path], to be rendered [size] pixels high. Returns NULL if it can't be loaded.
+av_font_t *av_font_new(const char *path, double size);
+
+/// Deletes [font]. Must be called on the GL thread, once no display uses it anymore.
+void av_font_delete(av_font_t *font);
+
+/// Returns the canvas to draw the next frame of a vector display onto. Drawing thread only.
+av_canvas_t *av_display_get_canvas(av_display_t *display);
+
+/// Saves the canvas' transform, colour, line width and font.
+void av_canvas_save(av_canvas_t *canvas);
+
+/// Restores the state of the matching av_canvas_save().
+void av_canvas_restore(av_canvas_t *canvas);
+
+void av_canvas_translate(av_canvas_t *canvas, double x, double y);
+void av_canvas_scale(av_canvas_t *canvas, double x, double y);
+/// Rotates the canvas by [angle] radians.
+void av_canvas_rotate(av_canvas_t *canvas, double angle);
+
+/// Sets the colour of the following fills, strokes and text, with straight alpha.
+void av_canvas_set_rgba(av_canvas_t *canvas, double r, double g, double b, double a);
+
+/// Sets the width of strokes, in user units.
+void av_canvas_set_line_width(av_canvas_t *canvas, double width);
+
+void av_canvas_set_font(av_canvas_t *canvas, av_font_t *font);
+
+/// Clears the current path.
+void av_canvas_new_path(av_canvas_t *canvas);
+void av_canvas_move_to(av_canvas_t *canvas, double x, double y);
+void av_canvas_line_to(av_canvas_t *canvas, double x, double y);
+void av_canvas_curve_to(av_canvas_t *canvas, double x1, double y1, double x2, double y2, double x3, double y3);
+
+/// Adds a circular arc around (xc, yc), clockwise from [angle1] to [angle2] in radians, connected
+/// to the current point by a line if there is one.
+void av_canvas_arc(av_canvas_t *canvas, double xc, double yc, double radius, double angle1, double angle2);
+
+void av_canvas_rectangle(av_canvas_t *canvas, double x, double y, double width, double height);
+void av_canvas_close_path(av_canvas_t *canvas);
+
+/// Fills the current path with the non-zero winding rule, and clears it.
+void av_canvas_fill(av_canvas_t *canvas);
+void av_canvas_fill_preserve(av_canvas_t *canvas);
+
+/// Strokes the current path with mitred joins and butt caps, and clears it.
+void av_canvas_stroke(av_canvas_t *canvas);
+void av_canvas_stroke_preserve(av_canvas_t *canvas);
+
+/// Draws UTF-8 [text] with the current font, its baseline starting at (x, y).
+void av_canvas_show_text(av_canvas_t *canvas, double x, double y, const char *text);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
@@ -7,6 +7,7 @@
 //===--------------------------------------------------------------------------------------------===
 #pragma once
 #include <stdbool.h>
+#include <stdint.h>
 #include <pthread.h>
 #include <cairo/cairo.h>
 #include <libavionics/renderer.h>
@@ -16,21 +17,328 @@ extern "C" {
 #endif
 
 typedef struct av_display_s av_display_t;
+typedef struct av_atlas_s av_atlas_t;
+struct dref_t;
+
+/// Creation flags for av_display_new_desc().
+typedef enum {
+    /// Cairo draws straight into the mapped transfer buffer instead of a private surface. Saves a
+    /// full-frame copy, but av_display_get_cairo() returns NULL until the last frame is uploaded,
+    /// and the surface contents are undefined at the start of each frame.
+    AV_DISPLAY_ZERO_COPY    = 1 << 0,
+    /// Only the regions reported through av_display_damage*() are copied and uploaded. A frame
+    /// with no damage costs nothing past the drawing thread. Ignored in zero-copy mode.
+    AV_DISPLAY_DAMAGE       = 1 << 1,
+    /// Frames are uploaded with straight rather than premultiplied alpha, for hosts that blend
+    /// with GL_SRC_ALPHA. ARGB32 and RGBA32 displays only, without layers, zero-copy or capture.
+    AV_DISPLAY_STRAIGHT_ALPHA = 1 << 2,
+    /// Cairo draws A8, RGB565 and INDEX8 displays in ARGB32, and frames are converted down as they
+    /// are copied. Costs more memory on the drawing side, but RGB565 antialiasing is only rounded
+    /// once. Not available in zero-copy mode.
+    AV_DISPLAY_DRAW_ARGB32  = 1 << 3,
+} av_display_flag_t;
+
+/// Pixel formats a display can be drawn and uploaded in.
+typedef enum {
+    /// Full colour with alpha. 4 bytes per pixel.
+    AV_DISPLAY_FORMAT_ARGB32,
+    /// Coverage only, rendered in the description's tint colour. 1 byte per pixel.
+    AV_DISPLAY_FORMAT_A8,
+    /// Opaque 16-bit colour. 2 bytes per pixel.
+    AV_DISPLAY_FORMAT_RGB565,
+    /// Indices into a palette of up to 256 colours. 1 byte per pixel. Draw with
+    /// av_display_set_source_index(): contexts are set up without antialiasing, so that indices
+    /// are never blended together.
+    AV_DISPLAY_FORMAT_INDEX8,
+    /// Full colour with alpha, in R, G, B, A byte order, as GL_RGBA textures and most image
+    /// libraries expect it. Drawn in ARGB32 and converted as frames are copied. 4 bytes per pixel.
+    AV_DISPLAY_FORMAT_RGBA32,
+    AV_DISPLAY_FORMAT_COUNT,
+} av_display_format_t;
+
+/// Where finished frames go.
+typedef enum {
+    /// Uploaded to an OpenGL texture. Needs a current GL context on the creating thread.
+    AV_DISPLAY_BACKEND_GL,
+    /// Handed to a callback on the thread calling av_display_upload(). Makes no GL calls at all.
+    AV_DISPLAY_BACKEND_CPU,
+    /// Drawn with an av_canvas_t instead of Cairo, and rendered by the GPU into the texture during
+    /// av_display_upload(). ARGB32 only, without bands, budget, capture or straight alpha.
+    AV_DISPLAY_BACKEND_VECTOR,
+} av_display_backend_t;
+
+/// A finished frame, as handed to CPU backend consumers.
+typedef struct {
+    /// Only the damaged rectangle is guaranteed to be up to date: consumers that need whole frames
+    /// should keep their own copy, and update the damaged part of it.
+    const uint8_t *pixels;
+    unsigned stride;
+    av_display_format_t format;
+    /// Size of the frame, which is smaller than the display when it renders at a reduced scale.
+    unsigned width;
+    unsigned height;
+    unsigned damage_x;
+    unsigned damage_y;
+    unsigned damage_width;
+    unsigned damage_height;
+    uint64_t seq;
+} av_display_frame_t;
+
+/// Receives a finished frame. [frame] and its pixels are only valid during the call.
+typedef void (*av_display_consumer_f)(const av_display_frame_t *frame, void *data);
+
+#define AV_DISPLAY_MIN_SLOTS (2)
+#define AV_DISPLAY_MAX_SLOTS (4)
+#define AV_DISPLAY_MAX_BANDS (16)
+#define AV_DISPLAY_MAX_LAYERS (4)
+#define AV_DISPLAY_SCALE_TIERS (4)
+
+typedef struct {
+    unsigned width;
+    unsigned height;
+    unsigned flags;
+    /// Number of frames in flight between the drawing and GL threads, 2 to 4. 0 picks 3.
+    unsigned slots;
+    /// Number of horizontal bands av_display_draw_tiled() splits frames into. 0 or 1 disables it.
+    unsigned bands;
+    av_display_format_t format;
+    /// Colour of A8 displays, as 0xRRGGBBAA. 0 picks opaque white.
+    uint32_t tint;
+    /// Colours of INDEX8 displays, as 0xRRGGBBAA. Missing entries are transparent.
+    const uint32_t *palette;
+    unsigned palette_size;
+    /// Atlas the display shares its texture with, if any. ARGB32 displays only.
+    av_atlas_t *atlas;
+    av_display_backend_t backend;
+    /// Called with each frame of AV_DISPLAY_BACKEND_CPU displays.
+    av_display_consumer_f consumer;
+    void *consumer_data;
+} av_display_desc_t;
+
+/// Draws (part of) a frame. Must only depend on [data] and the state of [cr].
+typedef void (*av_display_draw_f)(cairo_t *cr, void *data);
+
+typedef struct {
+    /// Whether the display streams through persistently mapped buffers.
+    bool is_persistent;
+    /// How many slots the GPU had to be done with before they could be reused.
+    unsigned long waits;
+    /// How many of those waits actually stalled the GL thread.
+    unsigned long blocked;
+} av_display_fence_stats_t;
+
+/// Stages of a frame's life, timed by each display.
+typedef enum {
+    /// From the first av_display_get_cairo() of a frame to av_display_finish_back_buffer().
+    AV_DISPLAY_STAGE_DRAW,
+    /// Handing the frame over in av_display_finish_back_buffer(), including the copy.
+    AV_DISPLAY_STAGE_COPY,
+    /// Transferring the frame to the texture in av_display_upload().
+    AV_DISPLAY_STAGE_UPLOAD,
+    /// From the frame being handed over to it being uploaded.
+    AV_DISPLAY_STAGE_LATENCY,
+    AV_DISPLAY_STAGE_COUNT,
+} av_display_stage_t;
+
+typedef struct {
+    unsigned long count;
+    /// Percentiles, in milliseconds. Estimated from power-of-two buckets.
+    double p50;
+    double p95;
+    double p99;
+    double max;
+} av_display_timing_t;
+
+typedef struct {
+    unsigned long produced;
+    unsigned long uploaded;
+    /// Frames superseded before the GL thread got to them.
+    unsigned long dropped;
+    /// Frames not drawn at all because none of the display's inputs changed.
+    unsigned long skipped;
+    av_display_timing_t stages[AV_DISPLAY_STAGE_COUNT];
+} av_display_stats_t;
+
+/// Time the GPU spent on some of libavionics' GL work, from timer queries.
+typedef struct {
+    /// False when GPU timing is off, or the driver has no timer queries.
+    bool is_available;
+    /// Measurements dropped because their results were still not back.
+    unsigned long skipped;
+    /// Sum of all measurements, in milliseconds.
+    double total;
+    av_display_timing_t timing;
+} av_gpu_timing_t;
+
+/// How captured frames are stored.
+typedef enum {
+    /// Every frame as is, in a single stream file.
+    AV_CAPTURE_RAW,
+    /// Every frame run-length encoded, in a single stream file.
+    AV_CAPTURE_RLE,
+    /// The difference with the previous frame, run-length encoded, with regular key frames.
+    AV_CAPTURE_DELTA,
+    /// One PNG file per frame.
+    AV_CAPTURE_PNG,
+} av_capture_encoding_t;
+
+typedef struct {
+    /// Frames queued for the writer.
+    unsigned long captured;
+    /// Frames dropped because the writer was behind.
+    unsigned long dropped;
+    /// Frames written so far, and their size on disk.
+    unsigned long written;
+    uint64_t bytes;
+} av_capture_stats_t;
 
 /// Creates a display manager.
 av_display_t *av_display_new(unsigned width, unsigned height);
 
-/// Deletes a display and its OpenGL resources.
+/// Creates a display manager from a full description. Returns NULL if the display doesn't fit
+/// in [desc->atlas], or if a vector display's framebuffer can't be created.
+av_display_t *av_display_new_desc(const av_display_desc_t *desc);
+
+/// Deletes a display and its OpenGL resources, stopping its capture if there is one.
 void av_display_delete(av_display_t *display);
 
-/// Copies the finished Cairo surface into the back PBO.
+/// Draws a frame by calling [draw] once per band, in parallel. Each call gets a fresh context that
+/// only covers its band, but uses display coordinates. Returns false if there was nothing to draw
+/// into (zero-copy display waiting on an upload). Falls back to a single call without bands.
+bool av_display_draw_tiled(av_display_t *display, av_display_draw_f draw, void *data);
+
+/// Hands the finished frame over to the GL thread. Never blocks: if the previous frame hasn't been
+/// uploaded yet, it is dropped in favour of this one.
 void av_display_finish_back_buffer(av_display_t *display);
 
-/// Swaps buffers, and uploads the new front buffer as a texture.
+/// Uploads the newest finished frame, if there is one, as the display's texture. Does nothing for
+/// displays in an atlas, which are uploaded by av_atlas_upload(). CPU backend displays hand the
+/// frame to their consumer instead.
 void av_display_upload(av_display_t *display);
 
-/// Returns a cairo context to draw onto the display.
-cairo_t *av_display_get_cairo(const av_display_t *display);
+/// Creates an atlas: a [width] by [height] texture, and transfer buffers, shared by displays.
+av_atlas_t *av_atlas_new(unsigned width, unsigned height);
+
+/// Deletes [atlas]. Its displays must have been deleted first.
+void av_atlas_delete(av_atlas_t *atlas);
+
+/// Uploads the newest frame of every display in [atlas], in a single transfer. Call once per frame
+/// on the GL thread.
+void av_atlas_upload(av_atlas_t *atlas);
+
+/// Adds a layer over [display], with its own surface, texture and damage. The layer is drawn into
+/// like any display, at most every [interval] seconds, and uploaded along with [display]. Layers
+/// are deleted with their display. Must be called on the GL thread, before drawing starts. Only
+/// ARGB32 displays can have layers.
+av_display_t *av_display_add_layer(av_display_t *display, double interval);
+
+/// Sets the minimum time, in seconds, between two frames of [display].
+void av_display_set_interval(av_display_t *display, double interval);
+
+/// Returns whether the display's update interval has elapsed since its last finished frame.
+bool av_display_is_due(const av_display_t *display);
+
+/// Renders [display] and all its layers, composited in a single pass.
+void av_render_display(av_target_t *target, av_display_t *display, vec2_t pos, vec2_t size, double alpha);
+
+/// Replaces the palette of an INDEX8 display. Must be called on the GL thread.
+void av_display_set_palette(av_display_t *display, const uint32_t *palette, unsigned count);
+
+/// Sets [cr]'s source to palette entry [index], for drawing onto INDEX8 displays.
+void av_display_set_source_index(cairo_t *cr, unsigned index);
+
+/// Lets [display] render at a lower resolution when drawing a frame takes longer than [budget]
+/// seconds, down to [min_scale] of its size. The texture is upscaled with linear filtering. 0
+/// disables scaling. Displays with layers can't be scaled. Drawing thread only; with a budget,
+/// call av_display_get_cairo() every frame, as the context changes when the resolution does.
+void av_display_set_budget(av_display_t *display, double budget, double min_scale);
+
+/// Sets the antialiasing used at resolution tier [tier], 0 being full resolution. Only applies to
+/// displays with a budget. Drawing thread only.
+void av_display_set_tier_antialias(av_display_t *display, unsigned tier, cairo_antialias_t antialias);
+
+/// Returns the fraction of its full resolution [display] currently renders at.
+double av_display_get_scale(const av_display_t *display);
+
+/// Returns the display's fence synchronisation counters. Only meaningful on the GL thread.
+void av_display_get_fence_stats(const av_display_t *display, av_display_fence_stats_t *stats);
+
+/// Returns the display's frame counters and stage timings since creation or the last reset.
+/// Can be called from any thread.
+void av_display_get_stats(const av_display_t *display, av_display_stats_t *stats);
+
+/// Clears the display's frame counters and timings, GPU ones included.
+void av_display_reset_stats(av_display_t *display);
+
+/// Turns GPU timing of uploads, vector drawing and quads on or off. Off by default. Does nothing
+/// if the driver has no timer queries. GL thread only.
+void av_render_set_gpu_timing(bool enabled);
+
+/// Returns the GPU time [display] spent uploading frames and, for vector displays, drawing them.
+/// [draw] only measures the first draw of the display's quad in each av_render_begin() run. Atlas
+/// uploads aren't measured. Can be called from any thread, results lag a few frames.
+void av_display_get_gpu_timing(const av_display_t *display, av_gpu_timing_t *upload, av_gpu_timing_t *draw);
+
+/// Returns the GPU time spent drawing quads to [target], layers and blending included. Each
+/// measurement spans one av_render_begin() run, from the first draw to [target] to the end.
+void av_target_get_gpu_timing(const av_target_t *target, av_gpu_timing_t *timing);
+
+/// Starts copying every uploaded frame of [display] to a queue of [queue_size] frames, written to
+/// [path] by a background thread. When the queue is full, frames are dropped rather than waited
+/// for. PNG captures write to [path]-000000.png, [path]-000001.png, etc. Returns false if [path]
+/// can't be written to. Call on the thread that uploads the display, like the other capture calls.
+bool av_display_start_capture(av_display_t *display, const char *path, av_capture_encoding_t encoding, unsigned queue_size);
+
+/// Writes the frames still queued, and the last frame if it was dropped, then stops capturing
+/// [display]. Fills in [stats] if not NULL.
+void av_display_stop_capture(av_display_t *display, av_capture_stats_t *stats);
+
+/// Returns the capture counters of [display], all zero if it isn't being captured.
+void av_display_get_capture_stats(const av_display_t *display, av_capture_stats_t *stats);
+
+/// Marks a rectangle of the display, in pixels, as changed in the frame being drawn.
+void av_display_damage(av_display_t *display, int x, int y, int width, int height);
+
+/// Marks the whole display as changed in the frame being drawn.
+void av_display_damage_all(av_display_t *display);
+
+/// Marks the area the current Cairo path would fill as changed. Call before cairo_fill().
+void av_display_damage_fill(av_display_t *display);
+
+/// Marks the area the current Cairo path would stroke as changed. Call before cairo_stroke().
+void av_display_damage_stroke(av_display_t *display);
+
+/// Returns a cairo context to draw onto the display. In zero-copy mode, the context changes every
+/// frame, and is NULL while the previous frame is waiting to be uploaded. Vector displays are drawn
+/// with av_display_get_canvas() instead.
+cairo_t *av_display_get_cairo(av_display_t *display);
+
+/// Clears the frame being drawn to transparent, black for RGB565 displays, or palette index 0 for
+/// INDEX8 ones, which is only transparent if the app made it so. Doesn't go through Cairo. With
+/// AV_DISPLAY_DAMAGE, only what was damaged so far this frame is cleared: report damage first.
+/// Returns false when av_display_get_cairo() would return NULL.
+bool av_display_clear(av_display_t *display);
+
+/// Redraws [display] when [dref] moves by more than [epsilon] from its value at the last redraw
+/// it caused. Only scalar datarefs can be watched. Call on the thread that polls the inputs.
+void av_display_watch_dref(av_display_t *display, const struct dref_t *dref, double epsilon);
+
+/// Redraws [display] whenever the counter at [version] changes. The app bumps it when something the
+/// display shows changes. It is read by av_display_poll_inputs(), on that thread.
+void av_display_watch_version(av_display_t *display, const uint64_t *version);
+
+/// Redraws [display] at least every [interval] seconds, whatever its inputs do. 0, the default,
+/// turns the forced refresh off. Drawing thread only.
+void av_display_set_refresh_interval(av_display_t *display, double interval);
+
+/// Samples the inputs of [display]. Call once per frame from a thread that can read datarefs,
+/// usually the flight loop.
+void av_display_poll_inputs(av_display_t *display);
+
+/// Returns whether the frame about to be drawn is needed. When it isn't, skip drawing and
+/// av_display_finish_back_buffer() altogether: nothing is copied or uploaded, and the texture
+/// keeps the last frame. Displays without inputs always need drawing. Drawing thread only.
+bool av_display_needs_redraw(av_display_t *display);
 
 /// 
 unsigned av_display_get_texture(const av_display_t *display);
@@ -41,6 +41,20 @@ extern "C" {
 } /* extern "C" */
 #endif
 
+// Programs are saved to [directory] once built, and loaded from there by later runs on the same
+// driver. NULL, the default, turns the cache off.
+void gl_set_program_cache(const char *directory);
+
+// Building a program can be split in two, so that programs started together are compiled in
+// parallel by drivers that can. The sources must outlive the call to gl_finish_program(), which
+// returns 0 if the program failed to build.
+GLuint gl_start_program(const char *vertex, const char *fragment);
+GLuint gl_finish_program(GLuint program);
+
+// Forgets a started program that will never be finished. Programs deleted through libavionics
+// are forgotten already, only those deleted with glDeleteProgram() need it.
+void gl_cancel_program(GLuint program);
+
 GLuint gl_create_program(const char *vertex, const char *fragment);
 GLuint gl_load_shader(const char *source, int type);
 GLuint gl_load_tex(const char *path, int *w, int *h);
@@ -15,6 +15,7 @@ extern "C" {
 
 typedef struct av_quad_s av_quad_t;
 typedef struct av_target_s av_target_t;
+typedef struct av_batch_s av_batch_t;
 
 av_quad_t *av_quad_new(unsigned texture, unsigned shader);
 void av_quad_delete(av_quad_t *quad);
@@ -26,8 +27,62 @@ void av_target_delete();
 
 void av_render_init();
 void av_render_deinit();
+
+typedef struct {
+    /// GL binding calls made, and those skipped because they would not have changed anything.
+    unsigned long issued;
+    unsigned long elided;
+} av_render_state_stats_t;
+
+/// Starts a run of drawing during which bindings are left in place from one draw to the next,
+/// instead of being reset to 0 after each. Forgets what it knew of the GL state first.
+void av_render_begin();
+
+/// Ends the run started by av_render_begin(), resetting bindings to 0.
+void av_render_end();
+
+/// Forgets what libavionics knows of the GL bindings. Call when other code may have changed them,
+/// such as X-Plane between two draw callbacks.
+void av_render_invalidate_state();
+
+void av_render_get_state_stats(av_render_state_stats_t *stats);
+void av_render_reset_state_stats();
+
 void av_render_quad(av_target_t *target, av_quad_t *quad, vec2_t pos, vec2_t size, double alpha);
 
+/// One copy of a quad drawn by av_render_quad_instanced(), uploaded to the GPU as it is.
+typedef struct {
+    /// Top-left corner and size, in target coordinates.
+    float x, y;
+    float width, height;
+    /// Rectangle of the quad's texture to show.
+    float u0, v0, u1, v1;
+    float alpha;
+    /// Rotation around the centre of the instance, in radians.
+    float rotation;
+} av_quad_instance_t;
+
+/// Draws [count] copies of [quad] with a single call, each above the ones before it. Quads with
+/// custom shaders, and contexts without instanced arrays, go through a batch instead.
+void av_render_quad_instanced(av_target_t *target, av_quad_t *quad, const av_quad_instance_t *instances, unsigned count);
+
+/// Creates a batch, which draws many quads with as few draw calls as it can.
+av_batch_t *av_batch_new();
+void av_batch_delete(av_batch_t *batch);
+
+/// Starts collecting quads to draw onto [target].
+void av_batch_begin(av_batch_t *batch, av_target_t *target);
+
+/// Adds [quad] to the batch, with the part of its texture the quad was set up with.
+void av_batch_add(av_batch_t *batch, av_quad_t *quad, vec2_t pos, vec2_t size, double alpha);
+
+/// Adds [quad] to the batch, showing the [uv0]-[uv1] rectangle of its texture.
+void av_batch_add_region(av_batch_t *batch, av_quad_t *quad, vec2_t pos, vec2_t size, vec2_t uv0, vec2_t uv1, double alpha);
+
+/// Draws the quads added since av_batch_begin(). Quads that overlap are drawn in the order they
+/// were added in, others are grouped by shader and texture.
+void av_batch_end(av_batch_t *batch);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -0,0 +1,70 @@
+//===--------------------------------------------------------------------------------------------===
+// symbol.h - Cache of pre-rasterised static symbology
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2021 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <cairo/cairo.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct av_symbol_cache_s av_symbol_cache_t;
+
+/// Draws a symbol with [color] (0xRRGGBBAA), in symbol units, inside its (0, 0, width, height) box.
+typedef void (*av_symbol_draw_f)(cairo_t *cr, uint32_t color, void *data);
+
+typedef struct {
+    /// Identifies what [draw] produces. Two symbols with the same id must draw the same thing.
+    uint32_t id;
+    /// Pixels per symbol unit the symbol is rasterised at.
+    double scale;
+    /// Colour passed to [draw], part of the cache key.
+    uint32_t color;
+    /// Size of the symbol's box, in symbol units.
+    double width;
+    double height;
+    /// Point of the box, in symbol units, that lands on the position the symbol is drawn at.
+    double origin_x;
+    double origin_y;
+    av_symbol_draw_f draw;
+    void *data;
+} av_symbol_t;
+
+typedef struct {
+    size_t bytes;
+    unsigned entries;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+} av_symbol_stats_t;
+
+/// Creates a symbol cache holding at most [max_bytes] of rasterised symbols.
+av_symbol_cache_t *av_symbol_cache_new(size_t max_bytes);
+
+/// Deletes [cache] and all its entries.
+void av_symbol_cache_delete(av_symbol_cache_t *cache);
+
+/// Draws [symbol] into [cr] with its origin at (x, y), rasterising it first if it isn't cached yet.
+/// [cr] should not be scaled or rotated, or the cached pixels are resampled. Thread safe.
+void av_symbol_draw(av_symbol_cache_t *cache, cairo_t *cr, const av_symbol_t *symbol, double x, double y);
+
+/// Drops every cached version of symbol [id], whatever its scale and colour.
+void av_symbol_invalidate(av_symbol_cache_t *cache, uint32_t id);
+
+/// Drops every cached symbol.
+void av_symbol_cache_clear(av_symbol_cache_t *cache);
+
+/// Returns the cache's memory use and hit counters.
+void av_symbol_cache_get_stats(av_symbol_cache_t *cache, av_symbol_stats_t *stats);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
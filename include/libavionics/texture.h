@@ -0,0 +1,124 @@
+//===--------------------------------------------------------------------------------------------===
+// texture.h - Background image loading into GL textures, and a cache of loaded textures
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2021 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct av_texture_loader_s av_texture_loader_t;
+typedef struct av_texture_s av_texture_t;
+typedef struct av_texture_cache_s av_texture_cache_t;
+
+/// Called on the GL thread once [texture] is ready to use, or failed to load.
+typedef void (*av_texture_loaded_f)(av_texture_t *texture, bool is_loaded, void *data);
+
+typedef struct {
+    /// Threads decoding images, 2 if 0.
+    unsigned threads;
+    /// Bytes uploaded by each call to av_texture_loader_update(), 4MiB if 0. An image row is
+    /// always uploaded whole, even if it is larger.
+    size_t upload_budget;
+    /// GL texture handed out in place of those that are not ready, or 0.
+    unsigned placeholder;
+} av_texture_loader_desc_t;
+
+typedef struct {
+    /// Minification filter, GL_LINEAR if 0. With a mipmap one, mipmaps are generated once the
+    /// image is uploaded.
+    unsigned min_filter;
+    /// Magnification filter, GL_LINEAR or GL_NEAREST, GL_LINEAR if 0.
+    unsigned mag_filter;
+    /// Wrap mode along both axes, GL_REPEAT if 0.
+    unsigned wrap;
+} av_texture_params_t;
+
+/// Creates a texture loader. [desc] may be NULL for the defaults.
+av_texture_loader_t *av_texture_loader_new(const av_texture_loader_desc_t *desc);
+
+/// Deletes [loader] and the textures it loaded, waiting for images being decoded. GL thread only.
+void av_texture_loader_delete(av_texture_loader_t *loader);
+
+/// Starts loading the image at [path] as an RGBA texture. Decoding happens on the loader's
+/// threads, and the upload in av_texture_loader_update(), which then calls [loaded] if not NULL.
+av_texture_t *av_texture_load(av_texture_loader_t *loader, const char *path, av_texture_loaded_f loaded, void *data);
+
+/// Same as av_texture_load(), with the sampling [params] set on the texture. [params] may be NULL.
+av_texture_t *av_texture_load_params(
+    av_texture_loader_t *loader,
+    const char *path,
+    const av_texture_params_t *params,
+    av_texture_loaded_f loaded,
+    void *data
+);
+
+/// Uploads decoded images, up to the loader's budget, and reports those that are done. Call once
+/// a frame on the GL thread.
+void av_texture_loader_update(av_texture_loader_t *loader);
+
+/// Blocks until every texture started so far is ready or has failed. GL thread only.
+void av_texture_loader_wait_all(av_texture_loader_t *loader);
+
+/// Deletes [texture], whether it finished loading or not. GL thread only.
+void av_texture_delete(av_texture_t *texture);
+
+/// Returns the texture's GL name, or the loader's placeholder while it isn't ready.
+unsigned av_texture_get_id(const av_texture_t *texture);
+
+bool av_texture_is_ready(const av_texture_t *texture);
+
+/// Returns whether [texture] was decoded, and if so its size in pixels.
+bool av_texture_get_size(const av_texture_t *texture, int *width, int *height);
+
+/// Returns the video memory used by [texture], 0 until it is ready.
+size_t av_texture_get_bytes(const av_texture_t *texture);
+
+typedef struct {
+    /// Video memory used by the cached textures that are ready, in use or not.
+    size_t bytes;
+    unsigned entries;
+    /// Entries nobody holds a reference to, which are evicted first.
+    unsigned unused;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+} av_texture_cache_stats_t;
+
+/// Called by av_texture_cache_visit() for each entry, with the path it was canonicalised to.
+typedef void (*av_texture_visit_f)(const char *path, const av_texture_t *texture, unsigned refs, void *data);
+
+/// Creates a cache of textures loaded through [loader], which must outlive it. Once the ready
+/// textures use more than [max_bytes], unused ones are deleted, least recently released first.
+av_texture_cache_t *av_texture_cache_new(av_texture_loader_t *loader, size_t max_bytes);
+
+/// Deletes [cache] and every texture in it, even those still referenced. GL thread only.
+void av_texture_cache_delete(av_texture_cache_t *cache);
+
+/// Returns a new reference to the texture for the file at [path] with [params], which may be NULL.
+/// Paths naming the same file share the texture, loaded the first time it's asked for. GL thread
+/// only.
+av_texture_t *av_texture_cache_acquire(av_texture_cache_t *cache, const char *path, const av_texture_params_t *params);
+
+/// Gives back a reference returned by av_texture_cache_acquire(). Textures without references are
+/// kept until evicted, and textures that failed to load are dropped. GL thread only.
+void av_texture_cache_release(av_texture_cache_t *cache, av_texture_t *texture);
+
+/// Changes the cache's budget, evicting unused textures at once if needed.
+void av_texture_cache_set_budget(av_texture_cache_t *cache, size_t max_bytes);
+
+void av_texture_cache_get_stats(const av_texture_cache_t *cache, av_texture_cache_stats_t *stats);
+
+/// Calls [visit] for each cached texture, to report their memory use.
+void av_texture_cache_visit(const av_texture_cache_t *cache, av_texture_visit_f visit, void *data);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
@@ -71,6 +71,9 @@ void xp_path_aircraft_prefix(const char *file, char *out, int max);
 
 bool xp_path_file_exists(const char *file);
 
+/// Caches built GL programs in [directory], under the plugin's own.
+void xp_use_program_cache(const char *directory);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -0,0 +1,198 @@
+//===--------------------------------------------------------------------------------------------===
+// atlas.c - Displays sharing one texture and one set of transfer buffers
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2021 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "display.h"
+#include <ccore/memory.h>
+#include <ccore/log.h>
+
+#define ATLAS_PBOS (3)
+
+struct av_atlas_s {
+    unsigned width, height;
+    unsigned texture;
+
+    // Each upload goes through the next buffer of the ring, so that we never wait on the transfer
+    // of the previous frame.
+    unsigned pbos[ATLAS_PBOS];
+    unsigned next_pbo;
+    size_t transfer_size;
+
+    // Displays are packed left to right in shelves, top to bottom.
+    unsigned shelf_x;
+    unsigned shelf_y;
+    unsigned shelf_height;
+
+    unsigned display_count;
+    unsigned display_capacity;
+    av_display_t **displays;
+    av_slot_t **frames;         // Scratch space for uploads.
+    av_rect_t *damage;
+};
+
+av_atlas_t *av_atlas_new(unsigned width, unsigned height) {
+    CCASSERT(width > 0);
+    CCASSERT(height > 0);
+
+    av_atlas_t *atlas = cc_alloc(sizeof(av_atlas_t));
+    atlas->width = width;
+    atlas->height = height;
+    atlas->next_pbo = 0;
+    atlas->transfer_size = 0;
+    atlas->shelf_x = 0;
+    atlas->shelf_y = 0;
+    atlas->shelf_height = 0;
+    atlas->display_count = 0;
+    atlas->display_capacity = 0;
+    atlas->displays = NULL;
+    atlas->frames = NULL;
+    atlas->damage = NULL;
+
+    glGenBuffers(ATLAS_PBOS, atlas->pbos);
+    glGenTextures(1, &atlas->texture);
+    av_gl_bind_texture(0, atlas->texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    av_gl_bind_texture(0, 0);
+    CHECK_GL();
+    return atlas;
+}
+
+void av_atlas_delete(av_atlas_t *atlas) {
+    CCASSERT(atlas);
+    CCASSERT(!atlas->display_count);
+    av_gl_delete_buffers(ATLAS_PBOS, atlas->pbos);
+    av_gl_delete_textures(1, &atlas->texture);
+    cc_free(atlas->displays);
+    cc_free(atlas->frames);
+    cc_free(atlas->damage);
+    cc_free(atlas);
+}
+
+// Space isn't reclaimed when a display is removed: cockpits create their displays once.
+bool av_atlas_add(av_atlas_t *atlas, av_display_t *display) {
+    CCASSERT(atlas);
+    CCASSERT(display);
+    unsigned width = display->width;
+    unsigned height = display->height;
+    if(width > atlas->width) return false;
+
+    if(atlas->shelf_x + width > atlas->width) {
+        atlas->shelf_y += atlas->shelf_height;
+        atlas->shelf_x = 0;
+        atlas->shelf_height = 0;
+    }
+    if(atlas->shelf_y + height > atlas->height) return false;
+
+    display->atlas_x = atlas->shelf_x;
+    display->atlas_y = atlas->shelf_y;
+    display->atlas_offset = atlas->transfer_size;
+    atlas->shelf_x += width;
+    atlas->shelf_height = cc_max(atlas->shelf_height, height);
+    atlas->transfer_size += display->stride * height;
+
+    if(atlas->display_count == atlas->display_capacity) {
+        atlas->display_capacity = atlas->display_capacity ? atlas->display_capacity * 2 : 8;
+        atlas->displays = cc_realloc(atlas->displays, atlas->display_capacity * sizeof(av_display_t *));
+        atlas->frames = cc_realloc(atlas->frames, atlas->display_capacity * sizeof(av_slot_t *));
+        atlas->damage = cc_realloc(atlas->damage, atlas->display_capacity * sizeof(av_rect_t));
+    }
+    atlas->displays[atlas->display_count++] = display;
+    return true;
+}
+
+void av_atlas_remove(av_atlas_t *atlas, av_display_t *display) {
+    CCASSERT(atlas);
+    for(unsigned i = 0; i < atlas->display_count; ++i) {
+        if(atlas->displays[i] != display) continue;
+        atlas->displays[i] = atlas->displays[--atlas->display_count];
+        return;
+    }
+    CCASSERT(false && "display is not in this atlas");
+}
+
+unsigned av_atlas_get_texture(const av_atlas_t *atlas) {
+    CCASSERT(atlas);
+    return atlas->texture;
+}
+
+void av_atlas_get_uv(const av_atlas_t *atlas, const av_display_t *display, double uv[4]) {
+    CCASSERT(atlas);
+    CCASSERT(display);
+    uv[0] = (double)display->atlas_x / atlas->width;
+    uv[1] = (double)display->atlas_y / atlas->height;
+    uv[2] = (double)(display->atlas_x + display->width) / atlas->width;
+    uv[3] = (double)(display->atlas_y + display->height) / atlas->height;
+}
+
+void av_atlas_upload(av_atlas_t *atlas) {
+    CCASSERT(atlas);
+
+    // Grab every display's newest frame first, so we know whether there's anything to do at all.
+    unsigned frame_count = 0;
+    for(unsigned i = 0; i < atlas->display_count; ++i) {
+        av_slot_t *slot = av_display_acquire_frame(atlas->displays[i]);
+        atlas->frames[i] = slot;
+        atlas->damage[i] = slot ? slot->damage : AV_RECT_EMPTY;
+        if(slot) frame_count += 1;
+    }
+    if(!frame_count) return;
+
+    // Orphan the buffer: we only write and upload the damaged parts of each display.
+    unsigned pbo = atlas->pbos[atlas->next_pbo];
+    atlas->next_pbo = (atlas->next_pbo + 1) % ATLAS_PBOS;
+    av_gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, atlas->transfer_size, NULL, GL_STREAM_DRAW);
+    uint8_t *transfer = glMapBufferRange(
+        GL_PIXEL_UNPACK_BUFFER, 0, atlas->transfer_size,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT
+    );
+    CHECK_GL();
+    if(!transfer) {
+        // Put the frames back: they'll be picked up again next time, unless newer ones replace them.
+        CCERROR("unable to map atlas transfer buffer %u", pbo);
+        av_gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        for(unsigned i = 0; i < atlas->display_count; ++i) {
+            if(atlas->frames[i]) atomic_store(&atlas->frames[i]->state, AV_SLOT_READY);
+        }
+        return;
+    }
+
+    // Display frames are plain memory: they go back to their drawing thread as soon as copied.
+    for(unsigned i = 0; i < atlas->display_count; ++i) {
+        av_display_t *display = atlas->displays[i];
+        av_slot_t *slot = atlas->frames[i];
+        if(!slot) continue;
+        if(!av_rect_is_empty(atlas->damage[i])) {
+            av_rect_copy(transfer + display->atlas_offset, slot->data, display->stride, 4, atlas->damage[i]);
+        }
+        av_display_release_frame(display, slot);
+    }
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    av_gl_bind_texture(0, atlas->texture);
+    for(unsigned i = 0; i < atlas->display_count; ++i) {
+        av_rect_t damage = atlas->damage[i];
+        if(av_rect_is_empty(damage)) continue;
+        av_display_t *display = atlas->displays[i];
+        size_t offset = display->atlas_offset + damage.y0 * display->stride + damage.x0 * 4;
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, display->stride / 4);
+        glTexSubImage2D(
+            GL_TEXTURE_2D, 0,
+            display->atlas_x + damage.x0, display->atlas_y + damage.y0,
+            damage.x1 - damage.x0, damage.y1 - damage.y0,
+            GL_BGRA, GL_UNSIGNED_BYTE, (const void *)offset
+        );
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    av_gl_bind_texture(0, 0);
+    av_gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    CHECK_GL();
+}
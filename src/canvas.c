@@ -0,0 +1,465 @@
+//===--------------------------------------------------------------------------------------------===
+// canvas.c - Records vector drawing into command lists for the GL renderer
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2021 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "vector.h"
+#include <ccore/memory.h>
+#include <ccore/log.h>
+#include <math.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI (3.14159265358979323846)
+#endif
+
+// Curves are flattened to within a quarter pixel, which is as good as antialiasing can show.
+#define TOLERANCE (0.25)
+#define MITER_LIMIT (10.0)
+#define MAX_CURVE_SEGMENTS (256)
+
+void av_vector_list_reset(av_vector_list_t *list) {
+    list->cmd_count = 0;
+    list->vertex_count = 0;
+    list->text_size = 0;
+    list->published_us = 0;
+}
+
+void av_vector_list_deinit(av_vector_list_t *list) {
+    cc_free(list->cmds);
+    cc_free(list->vertices);
+    cc_free(list->text);
+}
+
+av_vector_vertex_t *av_vector_list_alloc(av_vector_list_t *list, unsigned count) {
+    if(list->vertex_count + count > list->vertex_capacity) {
+        unsigned capacity = list->vertex_capacity ? list->vertex_capacity : 1024;
+        while(capacity < list->vertex_count + count) capacity *= 2;
+        list->vertices = cc_realloc(list->vertices, capacity * sizeof(av_vector_vertex_t));
+        list->vertex_capacity = capacity;
+    }
+    av_vector_vertex_t *vertices = list->vertices + list->vertex_count;
+    list->vertex_count += count;
+    return vertices;
+}
+
+static av_vector_cmd_t *push_cmd(av_vector_list_t *list, av_vector_op_t op, const float color[4]) {
+    if(list->cmd_count == list->cmd_capacity) {
+        list->cmd_capacity = list->cmd_capacity ? list->cmd_capacity * 2 : 64;
+        list->cmds = cc_realloc(list->cmds, list->cmd_capacity * sizeof(av_vector_cmd_t));
+    }
+    av_vector_cmd_t *cmd = &list->cmds[list->cmd_count++];
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->op = op;
+    memcpy(cmd->color, color, sizeof(cmd->color));
+    cmd->first = list->vertex_count;
+    return cmd;
+}
+
+static void reset_state(av_canvas_t *canvas) {
+    static const double identity[6] = {1, 0, 0, 1, 0, 0};
+    memcpy(canvas->state.matrix, identity, sizeof(identity));
+    for(unsigned i = 0; i < 4; ++i) {
+        canvas->state.color[i] = 1.f;
+    }
+    canvas->state.line_width = 2.0;
+    canvas->state.font = NULL;
+    canvas->depth = 0;
+}
+
+void av_canvas_init(av_canvas_t *canvas) {
+    canvas->list = NULL;
+    canvas->points = NULL;
+    canvas->point_count = 0;
+    canvas->point_capacity = 0;
+    canvas->subpaths = NULL;
+    canvas->subpath_count = 0;
+    canvas->subpath_capacity = 0;
+    reset_state(canvas);
+}
+
+void av_canvas_deinit(av_canvas_t *canvas) {
+    cc_free(canvas->points);
+    cc_free(canvas->subpaths);
+}
+
+void av_canvas_begin(av_canvas_t *canvas, av_vector_list_t *list) {
+    av_vector_list_reset(list);
+    canvas->list = list;
+    canvas->point_count = 0;
+    canvas->subpath_count = 0;
+    reset_state(canvas);
+}
+
+// MARK: - State
+
+void av_canvas_save(av_canvas_t *canvas) {
+    CCASSERT(canvas);
+    CCASSERT(canvas->depth < AV_CANVAS_MAX_DEPTH);
+    canvas->stack[canvas->depth++] = canvas->state;
+}
+
+void av_canvas_restore(av_canvas_t *canvas) {
+    CCASSERT(canvas);
+    CCASSERT(canvas->depth > 0);
+    canvas->state = canvas->stack[--canvas->depth];
+}
+
+// Applies [m] before the current transform, like cairo_transform().
+static void transform(av_canvas_t *canvas, const double m[6]) {
+    double *c = canvas->state.matrix;
+    double r[6] = {
+        m[0] * c[0] + m[1] * c[2],
+        m[0] * c[1] + m[1] * c[3],
+        m[2] * c[0] + m[3] * c[2],
+        m[2] * c[1] + m[3] * c[3],
+        m[4] * c[0] + m[5] * c[2] + c[4],
+        m[4] * c[1] + m[5] * c[3] + c[5],
+    };
+    memcpy(c, r, sizeof(r));
+}
+
+void av_canvas_translate(av_canvas_t *canvas, double x, double y) {
+    CCASSERT(canvas);
+    transform(canvas, (double[6]){1, 0, 0, 1, x, y});
+}
+
+void av_canvas_scale(av_canvas_t *canvas, double x, double y) {
+    CCASSERT(canvas);
+    transform(canvas, (double[6]){x, 0, 0, y, 0, 0});
+}
+
+void av_canvas_rotate(av_canvas_t *canvas, double angle) {
+    CCASSERT(canvas);
+    double c = cos(angle), s = sin(angle);
+    transform(canvas, (double[6]){c, s, -s, c, 0, 0});
+}
+
+void av_canvas_set_rgba(av_canvas_t *canvas, double r, double g, double b, double a) {
+    CCASSERT(canvas);
+    canvas->state.color[0] = r * a;
+    canvas->state.color[1] = g * a;
+    canvas->state.color[2] = b * a;
+    canvas->state.color[3] = a;
+}
+
+void av_canvas_set_line_width(av_canvas_t *canvas, double width) {
+    CCASSERT(canvas);
+    canvas->state.line_width = width;
+}
+
+void av_canvas_set_font(av_canvas_t *canvas, av_font_t *font) {
+    CCASSERT(canvas);
+    canvas->state.font = font;
+}
+
+// MARK: - Paths
+
+static av_vector_vertex_t to_device(const av_canvas_t *canvas, double x, double y) {
+    const double *m = canvas->state.matrix;
+    return (av_vector_vertex_t){
+        (float)(m[0] * x + m[2] * y + m[4]),
+        (float)(m[1] * x + m[3] * y + m[5]),
+        0.f, 0.f
+    };
+}
+
+// How much the transform scales lengths, on average.
+static double device_scale(const av_canvas_t *canvas) {
+    const double *m = canvas->state.matrix;
+    return sqrt(fabs(m[0] * m[3] - m[1] * m[2]));
+}
+
+static av_subpath_t *current_subpath(av_canvas_t *canvas) {
+    return canvas->subpath_count ? &canvas->subpaths[canvas->subpath_count - 1] : NULL;
+}
+
+static void push_point(av_canvas_t *canvas, av_vector_vertex_t p) {
+    av_subpath_t *sub = current_subpath(canvas);
+    CCASSERT(sub);
+    if(sub->count) {
+        av_vector_vertex_t last = canvas->points[sub->first + sub->count - 1];
+        if(last.x == p.x && last.y == p.y) return;
+    }
+    if(canvas->point_count == canvas->point_capacity) {
+        canvas->point_capacity = canvas->point_capacity ? canvas->point_capacity * 2 : 256;
+        canvas->points = cc_realloc(canvas->points, canvas->point_capacity * sizeof(av_vector_vertex_t));
+    }
+    canvas->points[canvas->point_count++] = p;
+    sub->count += 1;
+}
+
+static void start_subpath(av_canvas_t *canvas, av_vector_vertex_t p) {
+    if(canvas->subpath_count == canvas->subpath_capacity) {
+        canvas->subpath_capacity = canvas->subpath_capacity ? canvas->subpath_capacity * 2 : 16;
+        canvas->subpaths = cc_realloc(canvas->subpaths, canvas->subpath_capacity * sizeof(av_subpath_t));
+    }
+    canvas->subpaths[canvas->subpath_count++] = (av_subpath_t){canvas->point_count, 0, false};
+    push_point(canvas, p);
+}
+
+static bool has_current_point(const av_canvas_t *canvas) {
+    return canvas->subpath_count && !canvas->subpaths[canvas->subpath_count - 1].closed;
+}
+
+void av_canvas_new_path(av_canvas_t *canvas) {
+    CCASSERT(canvas);
+    canvas->point_count = 0;
+    canvas->subpath_count = 0;
+}
+
+void av_canvas_move_to(av_canvas_t *canvas, double x, double y) {
+    CCASSERT(canvas);
+    // A lone move_to doesn't draw anything: reuse its subpath.
+    av_subpath_t *sub = current_subpath(canvas);
+    if(sub && sub->count == 1 && !sub->closed) {
+        canvas->point_count -= 1;
+        canvas->subpath_count -= 1;
+    }
+    start_subpath(canvas, to_device(canvas, x, y));
+}
+
+void av_canvas_line_to(av_canvas_t *canvas, double x, double y) {
+    CCASSERT(canvas);
+    av_vector_vertex_t p = to_device(canvas, x, y);
+    if(!has_current_point(canvas)) {
+        start_subpath(canvas, p);
+        return;
+    }
+    push_point(canvas, p);
+}
+
+void av_canvas_curve_to(av_canvas_t *canvas, double x1, double y1, double x2, double y2, double x3, double y3) {
+    CCASSERT(canvas);
+    if(!has_current_point(canvas)) av_canvas_move_to(canvas, x1, y1);
+    av_subpath_t *sub = current_subpath(canvas);
+    av_vector_vertex_t p0 = canvas->points[sub->first + sub->count - 1];
+    av_vector_vertex_t p1 = to_device(canvas, x1, y1);
+    av_vector_vertex_t p2 = to_device(canvas, x2, y2);
+    av_vector_vertex_t p3 = to_device(canvas, x3, y3);
+
+    // Wang's formula gives the segment count that keeps the flattening error under TOLERANCE.
+    double ddx = fmax(fabs(p0.x - 2 * p1.x + p2.x), fabs(p1.x - 2 * p2.x + p3.x));
+    double ddy = fmax(fabs(p0.y - 2 * p1.y + p2.y), fabs(p1.y - 2 * p2.y + p3.y));
+    double segments = ceil(sqrt(0.75 * sqrt(ddx * ddx + ddy * ddy) / TOLERANCE));
+    unsigned n = (unsigned)fmin(fmax(segments, 1), MAX_CURVE_SEGMENTS);
+
+    for(unsigned i = 1; i <= n; ++i) {
+        float t = (float)i / n, u = 1.f - t;
+        float a = u * u * u, b = 3 * u * u * t, c = 3 * u * t * t, d = t * t * t;
+        push_point(canvas, (av_vector_vertex_t){
+            a * p0.x + b * p1.x + c * p2.x + d * p3.x,
+            a * p0.y + b * p1.y + c * p2.y + d * p3.y,
+            0.f, 0.f
+        });
+    }
+}
+
+void av_canvas_arc(av_canvas_t *canvas, double xc, double yc, double radius, double angle1, double angle2) {
+    CCASSERT(canvas);
+    CCASSERT(radius >= 0);
+    while(angle2 < angle1) angle2 += 2 * M_PI;
+
+    double r = radius * device_scale(canvas);
+    double step = r > TOLERANCE ? 2 * acos(1 - TOLERANCE / r) : M_PI / 2;
+    unsigned n = (unsigned)fmin(fmax(ceil((angle2 - angle1) / step), 1), MAX_CURVE_SEGMENTS);
+
+    double x = xc + radius * cos(angle1), y = yc + radius * sin(angle1);
+    if(has_current_point(canvas)) av_canvas_line_to(canvas, x, y);
+    else av_canvas_move_to(canvas, x, y);
+    for(unsigned i = 1; i <= n; ++i) {
+        double angle = angle1 + (angle2 - angle1) * i / n;
+        push_point(canvas, to_device(canvas, xc + radius * cos(angle), yc + radius * sin(angle)));
+    }
+}
+
+void av_canvas_rectangle(av_canvas_t *canvas, double x, double y, double width, double height) {
+    CCASSERT(canvas);
+    av_canvas_move_to(canvas, x, y);
+    av_canvas_line_to(canvas, x + width, y);
+    av_canvas_line_to(canvas, x + width, y + height);
+    av_canvas_line_to(canvas, x, y + height);
+    av_canvas_close_path(canvas);
+}
+
+void av_canvas_close_path(av_canvas_t *canvas) {
+    CCASSERT(canvas);
+    av_subpath_t *sub = current_subpath(canvas);
+    if(!sub || sub->closed) return;
+    // The closing segment is implicit.
+    av_vector_vertex_t first = canvas->points[sub->first];
+    av_vector_vertex_t last = canvas->points[sub->first + sub->count - 1];
+    if(sub->count > 1 && first.x == last.x && first.y == last.y) {
+        sub->count -= 1;
+        canvas->point_count -= 1;
+    }
+    sub->closed = true;
+}
+
+// MARK: - Tessellation
+
+static void push_triangle(av_vector_list_t *list, av_vector_vertex_t a, av_vector_vertex_t b, av_vector_vertex_t c) {
+    av_vector_vertex_t *v = av_vector_list_alloc(list, 3);
+    v[0] = a;
+    v[1] = b;
+    v[2] = c;
+}
+
+// Closes a fill or stroke command with the quad that covers all of its triangles.
+static void push_cover(av_vector_list_t *list, av_vector_cmd_t *cmd) {
+    cmd->count = list->vertex_count - cmd->first;
+    if(!cmd->count) {
+        list->cmd_count -= 1;
+        return;
+    }
+    float x0 = INFINITY, y0 = INFINITY, x1 = -INFINITY, y1 = -INFINITY;
+    for(unsigned i = cmd->first; i < cmd->first + cmd->count; ++i) {
+        av_vector_vertex_t v = list->vertices[i];
+        x0 = fminf(x0, v.x);
+        y0 = fminf(y0, v.y);
+        x1 = fmaxf(x1, v.x);
+        y1 = fmaxf(y1, v.y);
+    }
+    av_vector_vertex_t a = {x0, y0, 0, 0}, b = {x1, y0, 0, 0};
+    av_vector_vertex_t c = {x1, y1, 0, 0}, d = {x0, y1, 0, 0};
+    push_triangle(list, a, b, c);
+    push_triangle(list, a, c, d);
+}
+
+// Fans are enough with a stencil: overlapping triangles cancel out by winding.
+static void tessellate_fill(av_canvas_t *canvas) {
+    av_vector_list_t *list = canvas->list;
+    av_vector_cmd_t *cmd = push_cmd(list, AV_VECTOR_FILL, canvas->state.color);
+    for(unsigned s = 0; s < canvas->subpath_count; ++s) {
+        const av_subpath_t *sub = &canvas->subpaths[s];
+        const av_vector_vertex_t *p = canvas->points + sub->first;
+        for(unsigned i = 1; i + 1 < sub->count; ++i) {
+            push_triangle(list, p[0], p[i], p[i + 1]);
+        }
+    }
+    push_cover(list, cmd);
+}
+
+static av_vector_vertex_t offset(av_vector_vertex_t p, float nx, float ny, float k) {
+    return (av_vector_vertex_t){p.x + nx * k, p.y + ny * k, 0.f, 0.f};
+}
+
+// Segment normals, scaled to half the line width.
+static void segment_normal(av_vector_vertex_t a, av_vector_vertex_t b, float hw, float *nx, float *ny) {
+    float dx = b.x - a.x, dy = b.y - a.y;
+    float length = sqrtf(dx * dx + dy * dy);
+    *nx = -dy / length * hw;
+    *ny = dx / length * hw;
+}
+
+// Joins are a bevel on both sides, which the segments mostly cover on the inside, plus the miter
+// tip on the outside when it is within the limit.
+static void push_join(av_vector_list_t *list, av_vector_vertex_t a, av_vector_vertex_t p, av_vector_vertex_t b, float hw) {
+    float n0x, n0y, n1x, n1y;
+    segment_normal(a, p, hw, &n0x, &n0y);
+    segment_normal(p, b, hw, &n1x, &n1y);
+    push_triangle(list, p, offset(p, n0x, n0y, 1), offset(p, n1x, n1y, 1));
+    push_triangle(list, p, offset(p, n0x, n0y, -1), offset(p, n1x, n1y, -1));
+
+    float mx = n0x + n1x, my = n0y + n1y;
+    float m = sqrtf(mx * mx + my * my);
+    if(m < 1e-6f) return;
+    float cos_half = (mx * n0x + my * n0y) / (m * hw);
+    if(cos_half <= 0 || 1 / cos_half > MITER_LIMIT) return;
+
+    float cross = (p.x - a.x) * (b.y - p.y) - (p.y - a.y) * (b.x - p.x);
+    float side = cross > 0 ? -1.f : 1.f;
+    av_vector_vertex_t tip = offset(p, mx / m, my / m, side * hw / cos_half);
+    push_triangle(list, p, offset(p, n0x, n0y, side), tip);
+    push_triangle(list, p, tip, offset(p, n1x, n1y, side));
+}
+
+static void tessellate_stroke(av_canvas_t *canvas) {
+    av_vector_list_t *list = canvas->list;
+    av_vector_cmd_t *cmd = push_cmd(list, AV_VECTOR_STROKE, canvas->state.color);
+    float hw = (float)(canvas->state.line_width * device_scale(canvas) / 2.0);
+
+    for(unsigned s = 0; s < canvas->subpath_count && hw > 0; ++s) {
+        const av_subpath_t *sub = &canvas->subpaths[s];
+        const av_vector_vertex_t *p = canvas->points + sub->first;
+        unsigned n = sub->count;
+        if(n < 2) continue;
+        unsigned segments = sub->closed ? n : n - 1;
+
+        for(unsigned i = 0; i < segments; ++i) {
+            av_vector_vertex_t a = p[i], b = p[(i + 1) % n];
+            float nx, ny;
+            segment_normal(a, b, hw, &nx, &ny);
+            av_vector_vertex_t a0 = offset(a, nx, ny, 1), a1 = offset(a, nx, ny, -1);
+            av_vector_vertex_t b0 = offset(b, nx, ny, 1), b1 = offset(b, nx, ny, -1);
+            push_triangle(list, a0, b0, b1);
+            push_triangle(list, a0, b1, a1);
+        }
+
+        unsigned first_join = sub->closed ? 0 : 1;
+        unsigned last_join = sub->closed ? n : n - 1;
+        for(unsigned i = first_join; i < last_join; ++i) {
+            push_join(list, p[(i + n - 1) % n], p[i], p[(i + 1) % n], hw);
+        }
+    }
+    push_cover(list, cmd);
+}
+
+void av_canvas_fill(av_canvas_t *canvas) {
+    av_canvas_fill_preserve(canvas);
+    av_canvas_new_path(canvas);
+}
+
+void av_canvas_fill_preserve(av_canvas_t *canvas) {
+    CCASSERT(canvas);
+    CCASSERT(canvas->list);
+    tessellate_fill(canvas);
+}
+
+void av_canvas_stroke(av_canvas_t *canvas) {
+    av_canvas_stroke_preserve(canvas);
+    av_canvas_new_path(canvas);
+}
+
+void av_canvas_stroke_preserve(av_canvas_t *canvas) {
+    CCASSERT(canvas);
+    CCASSERT(canvas->list);
+    tessellate_stroke(canvas);
+}
+
+// MARK: - Text
+
+void av_canvas_show_text(av_canvas_t *canvas, double x, double y, const char *text) {
+    CCASSERT(canvas);
+    CCASSERT(canvas->list);
+    CCASSERT(text);
+    if(!canvas->state.font) {
+        CCERROR("can't draw text without a font");
+        return;
+    }
+
+    av_vector_list_t *list = canvas->list;
+    unsigned length = strlen(text) + 1;
+    if(list->text_size + length > list->text_capacity) {
+        unsigned capacity = list->text_capacity ? list->text_capacity : 1024;
+        while(capacity < list->text_size + length) capacity *= 2;
+        list->text = cc_realloc(list->text, capacity);
+        list->text_capacity = capacity;
+    }
+    memcpy(list->text + list->text_size, text, length);
+
+    av_vector_cmd_t *cmd = push_cmd(list, AV_VECTOR_TEXT, canvas->state.color);
+    av_vector_vertex_t origin = to_device(canvas, x, y);
+    const double *m = canvas->state.matrix;
+    cmd->font = canvas->state.font;
+    cmd->origin_x = origin.x;
+    cmd->origin_y = origin.y;
+    for(unsigned i = 0; i < 4; ++i) {
+        cmd->matrix[i] = (float)m[i];
+    }
+    cmd->text = list->text_size;
+    list->text_size += length;
+}
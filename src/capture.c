@@ -0,0 +1,435 @@
+//===--------------------------------------------------------------------------------------------===
+// capture.c - Asynchronous capture of display frames to disk
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2021 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "display.h"
+#include "capture.h"
+#include <ccore/memory.h>
+#include <ccore/log.h>
+#include <stdio.h>
+#include <string.h>
+
+#define RELAXED memory_order_relaxed
+
+typedef struct {
+    uint64_t seq;
+    uint64_t time_us;
+    unsigned width, height;
+    av_rect_t damage;
+    uint8_t *pixels;            // Full size, but only [damage] is up to date.
+} entry_t;
+
+struct av_capture_s {
+    av_capture_encoding_t encoding;
+    av_display_format_t format;
+    char *path;
+    FILE *file;
+
+    unsigned width, height;
+    unsigned stride;
+    unsigned bpp;
+    size_t frame_size;
+
+    // Upload thread. Frames only carry their damage, so the queue needs a full frame after a drop.
+    uint8_t *image;
+    uint64_t last_seq;
+    bool has_frame;
+    bool resync;
+    entry_t dropped_frame;      // Newest frame dropped since the last one queued.
+
+    pthread_t thread;
+    pthread_mutex_t mt;
+    pthread_cond_t cond;
+    entry_t *entries;
+    unsigned capacity;
+    unsigned head;
+    unsigned count;             // Includes the entry the writer is working on.
+    bool stop;
+
+    // Writer thread.
+    uint8_t *current;
+    uint8_t *packed;
+    uint8_t *previous;          // Last packed frame written, for deltas.
+    uint8_t *encoded;
+    unsigned since_key;
+    uint64_t *index;
+    size_t index_count;
+    size_t index_capacity;
+    bool failed;
+
+    _Atomic unsigned long captured;
+    _Atomic unsigned long dropped;
+    _Atomic unsigned long written;
+    _Atomic uint64_t bytes;
+};
+
+// Worst case is single literals between runs of two, which costs a control byte per pixel.
+static size_t rle_bound(size_t pixels, unsigned bpp) {
+    return pixels * (bpp + 1);
+}
+
+static size_t rle_encode(uint8_t *dst, const uint8_t *src, size_t pixels, unsigned bpp) {
+    size_t out = 0;
+    size_t i = 0;
+    while(i < pixels) {
+        size_t run = 1;
+        while(i + run < pixels && run < AV_RLE_MAX_RUN
+              && !memcmp(src + (i + run) * bpp, src + i * bpp, bpp)) {
+            run += 1;
+        }
+        if(run > 1) {
+            dst[out++] = (uint8_t)(run + 126);
+            memcpy(dst + out, src + i * bpp, bpp);
+            out += bpp;
+            i += run;
+            continue;
+        }
+
+        // Gather literals until the next run of at least two pixels.
+        size_t start = i;
+        size_t count = 0;
+        while(i < pixels && count < AV_RLE_MAX_LITERALS) {
+            if(i + 1 < pixels && !memcmp(src + (i + 1) * bpp, src + i * bpp, bpp)) break;
+            i += 1;
+            count += 1;
+        }
+        if(!count) continue;
+        dst[out++] = (uint8_t)(count - 1);
+        memcpy(dst + out, src + start * bpp, count * bpp);
+        out += count * bpp;
+    }
+    return out;
+}
+
+static void pack_frame(av_capture_t *capture) {
+    size_t row = capture->width * capture->bpp;
+    for(unsigned y = 0; y < capture->height; ++y) {
+        memcpy(capture->packed + y * row, capture->current + y * capture->stride, row);
+    }
+}
+
+static bool write_png(av_capture_t *capture, const entry_t *entry) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s-%06lu.png", capture->path, atomic_load_explicit(&capture->written, RELAXED));
+
+    // [encoded] is large enough: it was sized for the worst case RLE of the frame.
+    uint32_t *argb = (uint32_t *)capture->encoded;
+    av_capture_to_argb32(argb, capture->packed, entry->width, entry->height, capture->width * capture->bpp, capture->format);
+    cairo_surface_t *surface = cairo_image_surface_create_for_data(
+        (uint8_t *)argb, CAIRO_FORMAT_ARGB32, entry->width, entry->height, entry->width * 4
+    );
+    cairo_status_t status = cairo_surface_write_to_png(surface, path);
+    cairo_surface_destroy(surface);
+    if(status != CAIRO_STATUS_SUCCESS) {
+        CCERROR("unable to write capture frame `%s`", path);
+        return false;
+    }
+    atomic_fetch_add_explicit(&capture->bytes, (uint64_t)entry->width * entry->height * 4, RELAXED);
+    return true;
+}
+
+static bool write_record(av_capture_t *capture, const entry_t *entry) {
+    size_t pixels = (size_t)capture->width * capture->height;
+    av_capture_record_t record = {
+        .seq = entry->seq,
+        .time_us = entry->time_us,
+        .width = entry->width,
+        .height = entry->height,
+        .flags = 0,
+        .size = 0,
+    };
+
+    const uint8_t *data = capture->packed;
+    switch(capture->encoding) {
+    case AV_CAPTURE_RAW:
+        record.flags = AV_CAPTURE_KEY_FRAME;
+        record.size = capture->frame_size;
+        break;
+
+    case AV_CAPTURE_RLE:
+        record.flags = AV_CAPTURE_KEY_FRAME;
+        record.size = rle_encode(capture->encoded, capture->packed, pixels, capture->bpp);
+        data = capture->encoded;
+        break;
+
+    case AV_CAPTURE_DELTA:
+        // XOR with the previous frame turns everything that didn't change into long runs of zeroes.
+        if(capture->since_key && capture->since_key < AV_CAPTURE_KEY_INTERVAL) {
+            for(size_t i = 0; i < capture->frame_size; ++i) capture->previous[i] ^= capture->packed[i];
+            record.size = rle_encode(capture->encoded, capture->previous, pixels, capture->bpp);
+            capture->since_key += 1;
+        } else {
+            record.flags = AV_CAPTURE_KEY_FRAME;
+            record.size = rle_encode(capture->encoded, capture->packed, pixels, capture->bpp);
+            capture->since_key = 1;
+        }
+        memcpy(capture->previous, capture->packed, capture->frame_size);
+        data = capture->encoded;
+        break;
+
+    case AV_CAPTURE_PNG:
+        CCASSERT(false && "PNG captures don't have records");
+        break;
+    }
+
+    long offset = ftell(capture->file);
+    if(offset < 0
+       || fwrite(&record, sizeof(record), 1, capture->file) != 1
+       || fwrite(data, 1, record.size, capture->file) != record.size) {
+        CCERROR("unable to write capture `%s`", capture->path);
+        return false;
+    }
+
+    if(capture->index_count == capture->index_capacity) {
+        capture->index_capacity = capture->index_capacity ? capture->index_capacity * 2 : 256;
+        capture->index = cc_realloc(capture->index, capture->index_capacity * sizeof(uint64_t));
+    }
+    capture->index[capture->index_count++] = (uint64_t)offset;
+    atomic_fetch_add_explicit(&capture->bytes, sizeof(record) + record.size, RELAXED);
+    return true;
+}
+
+static void write_entry(av_capture_t *capture, const entry_t *entry) {
+    if(!av_rect_is_empty(entry->damage)) {
+        av_rect_copy(capture->current, entry->pixels, capture->stride, capture->bpp, entry->damage);
+    }
+    // Once writing failed, keep draining the queue so the upload thread never fills it up.
+    if(capture->failed) return;
+
+    pack_frame(capture);
+    bool ok = capture->encoding == AV_CAPTURE_PNG
+        ? write_png(capture, entry)
+        : write_record(capture, entry);
+    if(!ok) {
+        capture->failed = true;
+        return;
+    }
+    atomic_fetch_add_explicit(&capture->written, 1, RELAXED);
+}
+
+static void *writer_main(void *data) {
+    av_capture_t *capture = data;
+    pthread_mutex_lock(&capture->mt);
+    for(;;) {
+        while(!capture->count && !capture->stop) pthread_cond_wait(&capture->cond, &capture->mt);
+        if(!capture->count) break;
+        entry_t *entry = &capture->entries[capture->head];
+        pthread_mutex_unlock(&capture->mt);
+
+        write_entry(capture, entry);
+
+        pthread_mutex_lock(&capture->mt);
+        capture->head = (capture->head + 1) % capture->capacity;
+        capture->count -= 1;
+    }
+    pthread_mutex_unlock(&capture->mt);
+    return NULL;
+}
+
+static void write_index(av_capture_t *capture) {
+    av_capture_trailer_t trailer = {.count = capture->index_count};
+    memcpy(trailer.magic, AV_CAPTURE_INDEX_MAGIC, sizeof(trailer.magic));
+    if(fwrite(capture->index, sizeof(uint64_t), capture->index_count, capture->file) != capture->index_count
+       || fwrite(&trailer, sizeof(trailer), 1, capture->file) != 1) {
+        CCERROR("unable to write the index of capture `%s`", capture->path);
+    }
+}
+
+void av_capture_push(av_capture_t *capture, const av_display_t *display, const av_slot_t *slot) {
+    // Frames that couldn't be uploaded are acquired again on the next upload.
+    if(capture->has_frame && slot->seq == capture->last_seq) return;
+    capture->has_frame = true;
+    capture->last_seq = slot->seq;
+
+    if(!av_rect_is_empty(slot->damage)) {
+        av_rect_copy(capture->image, slot->data, capture->stride, capture->bpp, slot->damage);
+    }
+
+    pthread_mutex_lock(&capture->mt);
+    if(capture->count == capture->capacity) {
+        pthread_mutex_unlock(&capture->mt);
+        atomic_fetch_add_explicit(&capture->dropped, 1, RELAXED);
+        capture->resync = true;
+        capture->dropped_frame = (entry_t){
+            .seq = slot->seq,
+            .time_us = slot->published_us,
+            .width = slot->render_width,
+            .height = slot->render_height,
+            .damage = {0, 0, display->width, display->height},
+            .pixels = capture->image,
+        };
+        return;
+    }
+    entry_t *entry = &capture->entries[(capture->head + capture->count) % capture->capacity];
+    pthread_mutex_unlock(&capture->mt);
+
+    // We are the only producer, so nobody else can take this entry while we fill it.
+    entry->seq = slot->seq;
+    entry->time_us = slot->published_us;
+    entry->width = slot->render_width;
+    entry->height = slot->render_height;
+    entry->damage = capture->resync
+        ? (av_rect_t){0, 0, display->width, display->height}
+        : slot->damage;
+    if(!av_rect_is_empty(entry->damage)) {
+        av_rect_copy(entry->pixels, capture->image, capture->stride, capture->bpp, entry->damage);
+    }
+    capture->resync = false;
+
+    pthread_mutex_lock(&capture->mt);
+    capture->count += 1;
+    pthread_cond_signal(&capture->cond);
+    pthread_mutex_unlock(&capture->mt);
+    atomic_fetch_add_explicit(&capture->captured, 1, RELAXED);
+}
+
+bool av_display_start_capture(av_display_t *display, const char *path, av_capture_encoding_t encoding, unsigned queue_size) {
+    CCASSERT(display);
+    CCASSERT(path);
+    CCASSERT(!display->capture);
+    CCASSERT(!display->vector);
+    CCASSERT(!(display->flags & AV_DISPLAY_STRAIGHT_ALPHA));
+    CCASSERT(queue_size > 0);
+
+    FILE *file = NULL;
+    if(encoding != AV_CAPTURE_PNG) {
+        file = fopen(path, "wb");
+        if(!file) {
+            CCERROR("unable to open capture `%s`", path);
+            return false;
+        }
+    }
+
+    av_capture_t *capture = cc_alloc(sizeof(av_capture_t));
+    capture->encoding = encoding;
+    capture->format = display->format;
+    capture->path = cc_alloc(strlen(path) + 1);
+    strcpy(capture->path, path);
+    capture->file = file;
+
+    capture->width = display->width;
+    capture->height = display->height;
+    capture->stride = display->stride;
+    capture->bpp = display->bpp;
+    capture->frame_size = (size_t)display->width * display->height * display->bpp;
+
+    size_t image_size = (size_t)display->stride * display->height;
+    size_t pixels = (size_t)display->width * display->height;
+    size_t encoded_size = rle_bound(pixels, display->bpp);
+    if(encoded_size < pixels * 4) encoded_size = pixels * 4;
+
+    // Start from a blank frame, like the display's texture.
+    capture->image = cc_alloc(image_size);
+    capture->current = cc_alloc(image_size);
+    memset(capture->image, 0, image_size);
+    memset(capture->current, 0, image_size);
+    capture->packed = cc_alloc(capture->frame_size);
+    capture->previous = encoding == AV_CAPTURE_DELTA ? cc_alloc(capture->frame_size) : NULL;
+    capture->encoded = cc_alloc(encoded_size);
+    capture->last_seq = 0;
+    capture->has_frame = false;
+    capture->resync = false;
+    capture->since_key = 0;
+    capture->index = NULL;
+    capture->index_count = 0;
+    capture->index_capacity = 0;
+    capture->failed = false;
+
+    capture->capacity = queue_size;
+    capture->entries = cc_alloc(queue_size * sizeof(entry_t));
+    for(unsigned i = 0; i < queue_size; ++i) {
+        capture->entries[i].pixels = cc_alloc(image_size);
+    }
+    capture->head = 0;
+    capture->count = 0;
+    capture->stop = false;
+
+    atomic_init(&capture->captured, 0);
+    atomic_init(&capture->dropped, 0);
+    atomic_init(&capture->written, 0);
+    atomic_init(&capture->bytes, 0);
+
+    if(file) {
+        av_capture_header_t header = {
+            .version = AV_CAPTURE_VERSION,
+            .width = display->width,
+            .height = display->height,
+            .format = display->format,
+            .encoding = encoding,
+            .bpp = display->bpp,
+        };
+        memcpy(header.magic, AV_CAPTURE_MAGIC, sizeof(header.magic));
+        if(fwrite(&header, sizeof(header), 1, file) != 1) {
+            CCERROR("unable to write capture `%s`", path);
+            capture->failed = true;
+        }
+        atomic_store_explicit(&capture->bytes, sizeof(header), RELAXED);
+    }
+
+    pthread_mutex_init(&capture->mt, NULL);
+    pthread_cond_init(&capture->cond, NULL);
+    pthread_create(&capture->thread, NULL, writer_main, capture);
+    display->capture = capture;
+    return true;
+}
+
+static void get_stats(const av_capture_t *capture, av_capture_stats_t *stats) {
+    stats->captured = atomic_load_explicit(&capture->captured, RELAXED);
+    stats->dropped = atomic_load_explicit(&capture->dropped, RELAXED);
+    stats->written = atomic_load_explicit(&capture->written, RELAXED);
+    stats->bytes = atomic_load_explicit(&capture->bytes, RELAXED);
+}
+
+void av_display_stop_capture(av_display_t *display, av_capture_stats_t *stats) {
+    CCASSERT(display);
+    av_capture_t *capture = display->capture;
+    if(!capture) return;
+    display->capture = NULL;
+
+    pthread_mutex_lock(&capture->mt);
+    capture->stop = true;
+    pthread_cond_signal(&capture->cond);
+    pthread_mutex_unlock(&capture->mt);
+    pthread_join(capture->thread, NULL);
+    pthread_cond_destroy(&capture->cond);
+    pthread_mutex_destroy(&capture->mt);
+
+    // The writer is gone and the queue empty: make sure the capture ends on the last frame.
+    if(capture->resync) {
+        write_entry(capture, &capture->dropped_frame);
+        atomic_fetch_add_explicit(&capture->captured, 1, RELAXED);
+    }
+
+    if(capture->file) {
+        if(!capture->failed) write_index(capture);
+        fclose(capture->file);
+    }
+    if(stats) get_stats(capture, stats);
+
+    for(unsigned i = 0; i < capture->capacity; ++i) {
+        cc_free(capture->entries[i].pixels);
+    }
+    cc_free(capture->entries);
+    cc_free(capture->index);
+    cc_free(capture->encoded);
+    cc_free(capture->previous);
+    cc_free(capture->packed);
+    cc_free(capture->current);
+    cc_free(capture->image);
+    cc_free(capture->path);
+    cc_free(capture);
+}
+
+void av_display_get_capture_stats(const av_display_t *display, av_capture_stats_t *stats) {
+    CCASSERT(display);
+    CCASSERT(stats);
+    if(!display->capture) {
+        *stats = (av_capture_stats_t){0};
+        return;
+    }
+    get_stats(display->capture, stats);
+}
@@ -0,0 +1,118 @@
+//===--------------------------------------------------------------------------------------------===
+// capture.h - On-disk format of display captures, shared with the capture tool
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2021 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#pragma once
+#include <libavionics/display.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A capture stream is a header, followed by one record per frame, followed by an index of the
+// records' offsets and a trailer. Everything is in the writer's byte order. The index is only
+// written when the capture is stopped: without it, records can still be read one after the other.
+//
+// Frames are stored as the display's full size, with rows packed. Only the top-left
+// [width]x[height] of a frame is meaningful when the display renders at a reduced scale.
+#define AV_CAPTURE_MAGIC "AVCAPTUR"
+#define AV_CAPTURE_INDEX_MAGIC "AVCAPIDX"
+#define AV_CAPTURE_VERSION (1)
+
+// Delta records can only be decoded from the previous frame, key frames on their own.
+#define AV_CAPTURE_KEY_FRAME (1u << 0)
+#define AV_CAPTURE_KEY_INTERVAL (64)
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;            // av_display_format_t
+    uint32_t encoding;          // av_capture_encoding_t
+    uint32_t bpp;
+} av_capture_header_t;
+
+typedef struct {
+    uint64_t seq;
+    uint64_t time_us;
+    uint32_t width;
+    uint32_t height;
+    uint32_t flags;
+    uint32_t size;              // Of the data following the record.
+} av_capture_record_t;
+
+typedef struct {
+    uint64_t count;
+    char magic[8];
+} av_capture_trailer_t;
+
+// Run-length encoding works on whole pixels of [bpp] bytes. Each packet starts with a control
+// byte: c < 128 is followed by c + 1 literal pixels, c >= 128 by one pixel repeated c - 126 times.
+#define AV_RLE_MAX_LITERALS (128)
+#define AV_RLE_MAX_RUN (129)
+
+// Decodes [src] into exactly [dst_size] bytes. Returns false if [src] is truncated or too long.
+static inline bool av_rle_decode(uint8_t *dst, size_t dst_size, const uint8_t *src, size_t src_size, unsigned bpp) {
+    size_t in = 0, out = 0;
+    while(in < src_size && out < dst_size) {
+        unsigned control = src[in++];
+        if(control < 128) {
+            size_t bytes = (control + 1) * bpp;
+            if(in + bytes > src_size || out + bytes > dst_size) return false;
+            for(size_t i = 0; i < bytes; ++i) dst[out + i] = src[in + i];
+            in += bytes;
+            out += bytes;
+        } else {
+            size_t count = control - 126;
+            if(in + bpp > src_size || out + count * bpp > dst_size) return false;
+            for(size_t i = 0; i < count; ++i) {
+                for(unsigned b = 0; b < bpp; ++b) dst[out++] = src[in + b];
+            }
+            in += bpp;
+        }
+    }
+    return in == src_size && out == dst_size;
+}
+
+// Converts a packed frame to premultiplied ARGB32, as written to PNGs. A8 frames come out as white
+// coverage, and INDEX8 frames as grey levels, since the palette isn't part of the capture.
+static inline void av_capture_to_argb32(uint32_t *dst, const uint8_t *src, unsigned width, unsigned height, unsigned row_size, av_display_format_t format) {
+    for(unsigned y = 0; y < height; ++y) {
+        const uint8_t *row = src + (size_t)y * row_size;
+        uint32_t *out = dst + (size_t)y * width;
+        for(unsigned x = 0; x < width; ++x) {
+            uint32_t a = 0xff, r, g, b;
+            switch(format) {
+            case AV_DISPLAY_FORMAT_A8:
+                a = r = g = b = row[x];
+                break;
+            case AV_DISPLAY_FORMAT_RGB565: {
+                unsigned pixel = row[2 * x] | (row[2 * x + 1] << 8);
+                r = ((pixel >> 11) & 0x1f) * 255 / 31;
+                g = ((pixel >> 5) & 0x3f) * 255 / 63;
+                b = (pixel & 0x1f) * 255 / 31;
+                break;
+            }
+            case AV_DISPLAY_FORMAT_INDEX8:
+                r = g = b = row[x];
+                break;
+            case AV_DISPLAY_FORMAT_RGBA32:
+                r = row[4 * x];
+                g = row[4 * x + 1];
+                b = row[4 * x + 2];
+                a = row[4 * x + 3];
+                break;
+            default: {
+                const uint8_t *p = row + 4 * x;
+                out[x] = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+                continue;
+            }
+            }
+            out[x] = a << 24 | r << 16 | g << 8 | b;
+        }
+    }
+}
@@ -0,0 +1,489 @@
+//===--------------------------------------------------------------------------------------------===
+// convert.c - Scalar and SIMD pixel conversion kernels, picked at runtime
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2021 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "convert.h"
+#include <ccore/log.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define AV_CONVERT_SSE2 1
+#include <emmintrin.h>
+#if defined(__GNUC__)
+#define AV_CONVERT_AVX2 1
+#include <immintrin.h>
+#endif
+#elif defined(__aarch64__)
+#define AV_CONVERT_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Unpremultiplied channels are rounded to nearest even from c * (255 / a) in single precision,
+// which every instruction set below computes exactly the same way. Channels over their alpha are
+// out of spec for Cairo, and get clamped.
+
+typedef struct {
+    const char *name;
+    av_convert_row_f rows[AV_CONVERT_COUNT];
+} kernel_set_t;
+
+static uint32_t load_pixel(const uint8_t *src) {
+    uint32_t pixel;
+    memcpy(&pixel, src, sizeof(pixel));
+    return pixel;
+}
+
+static void store_pixel(uint8_t *dst, uint32_t pixel) {
+    memcpy(dst, &pixel, sizeof(pixel));
+}
+
+static uint32_t unpremultiply_channel(uint32_t c, float scale) {
+    float v = (float)c * scale;
+    return (uint32_t)lrintf(v > 255.f ? 255.f : v);
+}
+
+static uint32_t unpremultiply_pixel(uint32_t pixel, bool swizzle) {
+    uint32_t a = pixel >> 24;
+    float scale = 255.f / (float)(a ? a : 1);
+    uint32_t r = unpremultiply_channel((pixel >> 16) & 0xff, scale);
+    uint32_t g = unpremultiply_channel((pixel >> 8) & 0xff, scale);
+    uint32_t b = unpremultiply_channel(pixel & 0xff, scale);
+    return swizzle
+        ? a << 24 | b << 16 | g << 8 | r
+        : a << 24 | r << 16 | g << 8 | b;
+}
+
+static uint32_t swizzle_pixel(uint32_t pixel) {
+    return (pixel & 0xff00ff00) | ((pixel >> 16) & 0xff) | ((pixel & 0xff) << 16);
+}
+
+static uint16_t rgb565_pixel(uint32_t pixel) {
+    return ((pixel >> 8) & 0xf800) | ((pixel >> 5) & 0x07e0) | ((pixel >> 3) & 0x001f);
+}
+
+static void copy_row(uint8_t *dst, const uint8_t *src, size_t count) {
+    memcpy(dst, src, count * 4);
+}
+
+static void unpremultiply_row_scalar(uint8_t *dst, const uint8_t *src, size_t count) {
+    for(size_t i = 0; i < count; ++i) {
+        store_pixel(dst + 4 * i, unpremultiply_pixel(load_pixel(src + 4 * i), false));
+    }
+}
+
+static void swizzle_row_scalar(uint8_t *dst, const uint8_t *src, size_t count) {
+    for(size_t i = 0; i < count; ++i) {
+        store_pixel(dst + 4 * i, swizzle_pixel(load_pixel(src + 4 * i)));
+    }
+}
+
+static void unpremultiply_swizzle_row_scalar(uint8_t *dst, const uint8_t *src, size_t count) {
+    for(size_t i = 0; i < count; ++i) {
+        store_pixel(dst + 4 * i, unpremultiply_pixel(load_pixel(src + 4 * i), true));
+    }
+}
+
+static void rgb565_row_scalar(uint8_t *dst, const uint8_t *src, size_t count) {
+    for(size_t i = 0; i < count; ++i) {
+        uint16_t pixel = rgb565_pixel(load_pixel(src + 4 * i));
+        memcpy(dst + 2 * i, &pixel, sizeof(pixel));
+    }
+}
+
+static void a8_row_scalar(uint8_t *dst, const uint8_t *src, size_t count) {
+    for(size_t i = 0; i < count; ++i) {
+        dst[i] = load_pixel(src + 4 * i) >> 24;
+    }
+}
+
+static const kernel_set_t scalar_kernels = {
+    "scalar",
+    {
+        [AV_CONVERT_COPY] = copy_row,
+        [AV_CONVERT_UNPREMULTIPLY] = unpremultiply_row_scalar,
+        [AV_CONVERT_SWIZZLE] = swizzle_row_scalar,
+        [AV_CONVERT_UNPREMULTIPLY_SWIZZLE] = unpremultiply_swizzle_row_scalar,
+        [AV_CONVERT_RGB565] = rgb565_row_scalar,
+        [AV_CONVERT_A8] = a8_row_scalar,
+    },
+};
+
+#if AV_CONVERT_SSE2
+
+static __m128i unpremultiply_sse2(__m128i pixels, bool swizzle) {
+    const __m128i mask = _mm_set1_epi32(0xff);
+    const __m128i alpha_mask = _mm_set1_epi32(0xff000000);
+    if(_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(pixels, alpha_mask), alpha_mask)) == 0xffff) {
+        if(!swizzle) return pixels;
+        return _mm_or_si128(_mm_and_si128(pixels, _mm_set1_epi32(0xff00ff00)), _mm_or_si128(
+            _mm_and_si128(_mm_srli_epi32(pixels, 16), mask),
+            _mm_slli_epi32(_mm_and_si128(pixels, mask), 16)));
+    }
+
+    __m128i a = _mm_srli_epi32(pixels, 24);
+    __m128 scale = _mm_div_ps(_mm_set1_ps(255.f), _mm_cvtepi32_ps(_mm_max_epi16(a, _mm_set1_epi32(1))));
+    __m128 max = _mm_set1_ps(255.f);
+    __m128i r = _mm_cvtps_epi32(_mm_min_ps(_mm_mul_ps(
+        _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(pixels, 16), mask)), scale), max));
+    __m128i g = _mm_cvtps_epi32(_mm_min_ps(_mm_mul_ps(
+        _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(pixels, 8), mask)), scale), max));
+    __m128i b = _mm_cvtps_epi32(_mm_min_ps(_mm_mul_ps(
+        _mm_cvtepi32_ps(_mm_and_si128(pixels, mask)), scale), max));
+    if(swizzle) {
+        __m128i tmp = r;
+        r = b;
+        b = tmp;
+    }
+    return _mm_or_si128(_mm_or_si128(_mm_slli_epi32(a, 24), _mm_slli_epi32(r, 16)),
+        _mm_or_si128(_mm_slli_epi32(g, 8), b));
+}
+
+static void unpremultiply_row_sse2(uint8_t *dst, const uint8_t *src, size_t count) {
+    size_t i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m128i pixels = _mm_loadu_si128((const __m128i *)(src + 4 * i));
+        _mm_storeu_si128((__m128i *)(dst + 4 * i), unpremultiply_sse2(pixels, false));
+    }
+    unpremultiply_row_scalar(dst + 4 * i, src + 4 * i, count - i);
+}
+
+static void unpremultiply_swizzle_row_sse2(uint8_t *dst, const uint8_t *src, size_t count) {
+    size_t i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m128i pixels = _mm_loadu_si128((const __m128i *)(src + 4 * i));
+        _mm_storeu_si128((__m128i *)(dst + 4 * i), unpremultiply_sse2(pixels, true));
+    }
+    unpremultiply_swizzle_row_scalar(dst + 4 * i, src + 4 * i, count - i);
+}
+
+static void swizzle_row_sse2(uint8_t *dst, const uint8_t *src, size_t count) {
+    const __m128i mask = _mm_set1_epi32(0xff);
+    const __m128i keep = _mm_set1_epi32(0xff00ff00);
+    size_t i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m128i pixels = _mm_loadu_si128((const __m128i *)(src + 4 * i));
+        __m128i out = _mm_or_si128(_mm_and_si128(pixels, keep), _mm_or_si128(
+            _mm_and_si128(_mm_srli_epi32(pixels, 16), mask),
+            _mm_slli_epi32(_mm_and_si128(pixels, mask), 16)));
+        _mm_storeu_si128((__m128i *)(dst + 4 * i), out);
+    }
+    swizzle_row_scalar(dst + 4 * i, src + 4 * i, count - i);
+}
+
+// 565 words are sign-extended into their 32-bit lanes, so that the saturating pack keeps them.
+static __m128i rgb565_sse2(__m128i pixels) {
+    __m128i out = _mm_or_si128(
+        _mm_or_si128(
+            _mm_and_si128(_mm_srli_epi32(pixels, 8), _mm_set1_epi32(0xf800)),
+            _mm_and_si128(_mm_srli_epi32(pixels, 5), _mm_set1_epi32(0x07e0))),
+        _mm_and_si128(_mm_srli_epi32(pixels, 3), _mm_set1_epi32(0x001f)));
+    return _mm_srai_epi32(_mm_slli_epi32(out, 16), 16);
+}
+
+static void rgb565_row_sse2(uint8_t *dst, const uint8_t *src, size_t count) {
+    size_t i = 0;
+    for(; i + 8 <= count; i += 8) {
+        __m128i lo = rgb565_sse2(_mm_loadu_si128((const __m128i *)(src + 4 * i)));
+        __m128i hi = rgb565_sse2(_mm_loadu_si128((const __m128i *)(src + 4 * i + 16)));
+        _mm_storeu_si128((__m128i *)(dst + 2 * i), _mm_packs_epi32(lo, hi));
+    }
+    rgb565_row_scalar(dst + 2 * i, src + 4 * i, count - i);
+}
+
+static void a8_row_sse2(uint8_t *dst, const uint8_t *src, size_t count) {
+    size_t i = 0;
+    for(; i + 16 <= count; i += 16) {
+        __m128i a0 = _mm_srli_epi32(_mm_loadu_si128((const __m128i *)(src + 4 * i)), 24);
+        __m128i a1 = _mm_srli_epi32(_mm_loadu_si128((const __m128i *)(src + 4 * i + 16)), 24);
+        __m128i a2 = _mm_srli_epi32(_mm_loadu_si128((const __m128i *)(src + 4 * i + 32)), 24);
+        __m128i a3 = _mm_srli_epi32(_mm_loadu_si128((const __m128i *)(src + 4 * i + 48)), 24);
+        __m128i out = _mm_packus_epi16(_mm_packs_epi32(a0, a1), _mm_packs_epi32(a2, a3));
+        _mm_storeu_si128((__m128i *)(dst + i), out);
+    }
+    a8_row_scalar(dst + i, src + 4 * i, count - i);
+}
+
+static const kernel_set_t sse2_kernels = {
+    "sse2",
+    {
+        [AV_CONVERT_COPY] = copy_row,
+        [AV_CONVERT_UNPREMULTIPLY] = unpremultiply_row_sse2,
+        [AV_CONVERT_SWIZZLE] = swizzle_row_sse2,
+        [AV_CONVERT_UNPREMULTIPLY_SWIZZLE] = unpremultiply_swizzle_row_sse2,
+        [AV_CONVERT_RGB565] = rgb565_row_sse2,
+        [AV_CONVERT_A8] = a8_row_sse2,
+    },
+};
+
+#endif
+
+#if AV_CONVERT_AVX2
+#define AVX2 __attribute__((target("avx2")))
+
+static AVX2 __m256i swizzle_avx2(__m256i pixels) {
+    const __m256i shuffle = _mm256_setr_epi8(
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    return _mm256_shuffle_epi8(pixels, shuffle);
+}
+
+static AVX2 __m256i unpremultiply_avx2(__m256i pixels, bool swizzle) {
+    const __m256i mask = _mm256_set1_epi32(0xff);
+    const __m256i alpha_mask = _mm256_set1_epi32(0xff000000);
+    if(_mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(pixels, alpha_mask), alpha_mask)) == -1) {
+        return swizzle ? swizzle_avx2(pixels) : pixels;
+    }
+
+    __m256i a = _mm256_srli_epi32(pixels, 24);
+    __m256 scale = _mm256_div_ps(_mm256_set1_ps(255.f), _mm256_cvtepi32_ps(_mm256_max_epi32(a, _mm256_set1_epi32(1))));
+    __m256 max = _mm256_set1_ps(255.f);
+    __m256i r = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_mul_ps(
+        _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(pixels, 16), mask)), scale), max));
+    __m256i g = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_mul_ps(
+        _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(pixels, 8), mask)), scale), max));
+    __m256i b = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_mul_ps(
+        _mm256_cvtepi32_ps(_mm256_and_si256(pixels, mask)), scale), max));
+    if(swizzle) {
+        __m256i tmp = r;
+        r = b;
+        b = tmp;
+    }
+    return _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(a, 24), _mm256_slli_epi32(r, 16)),
+        _mm256_or_si256(_mm256_slli_epi32(g, 8), b));
+}
+
+static AVX2 void unpremultiply_row_avx2(uint8_t *dst, const uint8_t *src, size_t count) {
+    size_t i = 0;
+    for(; i + 8 <= count; i += 8) {
+        __m256i pixels = _mm256_loadu_si256((const __m256i *)(src + 4 * i));
+        _mm256_storeu_si256((__m256i *)(dst + 4 * i), unpremultiply_avx2(pixels, false));
+    }
+    unpremultiply_row_scalar(dst + 4 * i, src + 4 * i, count - i);
+}
+
+static AVX2 void unpremultiply_swizzle_row_avx2(uint8_t *dst, const uint8_t *src, size_t count) {
+    size_t i = 0;
+    for(; i + 8 <= count; i += 8) {
+        __m256i pixels = _mm256_loadu_si256((const __m256i *)(src + 4 * i));
+        _mm256_storeu_si256((__m256i *)(dst + 4 * i), unpremultiply_avx2(pixels, true));
+    }
+    unpremultiply_swizzle_row_scalar(dst + 4 * i, src + 4 * i, count - i);
+}
+
+static AVX2 void swizzle_row_avx2(uint8_t *dst, const uint8_t *src, size_t count) {
+    size_t i = 0;
+    for(; i + 8 <= count; i += 8) {
+        __m256i pixels = _mm256_loadu_si256((const __m256i *)(src + 4 * i));
+        _mm256_storeu_si256((__m256i *)(dst + 4 * i), swizzle_avx2(pixels));
+    }
+    swizzle_row_scalar(dst + 4 * i, src + 4 * i, count - i);
+}
+
+static AVX2 __m256i rgb565_avx2(__m256i pixels) {
+    return _mm256_or_si256(
+        _mm256_or_si256(
+            _mm256_and_si256(_mm256_srli_epi32(pixels, 8), _mm256_set1_epi32(0xf800)),
+            _mm256_and_si256(_mm256_srli_epi32(pixels, 5), _mm256_set1_epi32(0x07e0))),
+        _mm256_and_si256(_mm256_srli_epi32(pixels, 3), _mm256_set1_epi32(0x001f)));
+}
+
+// Packs work within 128-bit lanes, hence the permutes putting pixels back in order.
+static AVX2 void rgb565_row_avx2(uint8_t *dst, const uint8_t *src, size_t count) {
+    size_t i = 0;
+    for(; i + 16 <= count; i += 16) {
+        __m256i lo = rgb565_avx2(_mm256_loadu_si256((const __m256i *)(src + 4 * i)));
+        __m256i hi = rgb565_avx2(_mm256_loadu_si256((const __m256i *)(src + 4 * i + 32)));
+        __m256i out = _mm256_packus_epi32(lo, hi);
+        _mm256_storeu_si256((__m256i *)(dst + 2 * i), _mm256_permute4x64_epi64(out, 0xd8));
+    }
+    rgb565_row_scalar(dst + 2 * i, src + 4 * i, count - i);
+}
+
+static AVX2 void a8_row_avx2(uint8_t *dst, const uint8_t *src, size_t count) {
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    size_t i = 0;
+    for(; i + 32 <= count; i += 32) {
+        __m256i a0 = _mm256_srli_epi32(_mm256_loadu_si256((const __m256i *)(src + 4 * i)), 24);
+        __m256i a1 = _mm256_srli_epi32(_mm256_loadu_si256((const __m256i *)(src + 4 * i + 32)), 24);
+        __m256i a2 = _mm256_srli_epi32(_mm256_loadu_si256((const __m256i *)(src + 4 * i + 64)), 24);
+        __m256i a3 = _mm256_srli_epi32(_mm256_loadu_si256((const __m256i *)(src + 4 * i + 96)), 24);
+        __m256i out = _mm256_packus_epi16(_mm256_packs_epi32(a0, a1), _mm256_packs_epi32(a2, a3));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_permutevar8x32_epi32(out, order));
+    }
+    a8_row_scalar(dst + i, src + 4 * i, count - i);
+}
+
+static const kernel_set_t avx2_kernels = {
+    "avx2",
+    {
+        [AV_CONVERT_COPY] = copy_row,
+        [AV_CONVERT_UNPREMULTIPLY] = unpremultiply_row_avx2,
+        [AV_CONVERT_SWIZZLE] = swizzle_row_avx2,
+        [AV_CONVERT_UNPREMULTIPLY_SWIZZLE] = unpremultiply_swizzle_row_avx2,
+        [AV_CONVERT_RGB565] = rgb565_row_avx2,
+        [AV_CONVERT_A8] = a8_row_avx2,
+    },
+};
+
+#endif
+
+#if AV_CONVERT_NEON
+
+static uint32x4_t unpremultiply_channel_neon(uint32x4_t c, float32x4_t scale) {
+    float32x4_t v = vminq_f32(vmulq_f32(vcvtq_f32_u32(c), scale), vdupq_n_f32(255.f));
+    return vcvtnq_u32_f32(v);
+}
+
+static uint32x4_t unpremultiply_neon(uint32x4_t pixels, bool swizzle) {
+    const uint32x4_t mask = vdupq_n_u32(0xff);
+    uint32x4_t a = vshrq_n_u32(pixels, 24);
+    float32x4_t scale = vdivq_f32(vdupq_n_f32(255.f), vcvtq_f32_u32(vmaxq_u32(a, vdupq_n_u32(1))));
+    uint32x4_t r = unpremultiply_channel_neon(vandq_u32(vshrq_n_u32(pixels, 16), mask), scale);
+    uint32x4_t g = unpremultiply_channel_neon(vandq_u32(vshrq_n_u32(pixels, 8), mask), scale);
+    uint32x4_t b = unpremultiply_channel_neon(vandq_u32(pixels, mask), scale);
+    if(swizzle) {
+        uint32x4_t tmp = r;
+        r = b;
+        b = tmp;
+    }
+    return vorrq_u32(vorrq_u32(vshlq_n_u32(a, 24), vshlq_n_u32(r, 16)), vorrq_u32(vshlq_n_u32(g, 8), b));
+}
+
+static void unpremultiply_row_neon(uint8_t *dst, const uint8_t *src, size_t count) {
+    size_t i = 0;
+    for(; i + 4 <= count; i += 4) {
+        uint32x4_t pixels = vreinterpretq_u32_u8(vld1q_u8(src + 4 * i));
+        vst1q_u8(dst + 4 * i, vreinterpretq_u8_u32(unpremultiply_neon(pixels, false)));
+    }
+    unpremultiply_row_scalar(dst + 4 * i, src + 4 * i, count - i);
+}
+
+static void unpremultiply_swizzle_row_neon(uint8_t *dst, const uint8_t *src, size_t count) {
+    size_t i = 0;
+    for(; i + 4 <= count; i += 4) {
+        uint32x4_t pixels = vreinterpretq_u32_u8(vld1q_u8(src + 4 * i));
+        vst1q_u8(dst + 4 * i, vreinterpretq_u8_u32(unpremultiply_neon(pixels, true)));
+    }
+    unpremultiply_swizzle_row_scalar(dst + 4 * i, src + 4 * i, count - i);
+}
+
+static void swizzle_row_neon(uint8_t *dst, const uint8_t *src, size_t count) {
+    size_t i = 0;
+    for(; i + 16 <= count; i += 16) {
+        uint8x16x4_t pixels = vld4q_u8(src + 4 * i);
+        uint8x16_t tmp = pixels.val[0];
+        pixels.val[0] = pixels.val[2];
+        pixels.val[2] = tmp;
+        vst4q_u8(dst + 4 * i, pixels);
+    }
+    swizzle_row_scalar(dst + 4 * i, src + 4 * i, count - i);
+}
+
+// Shifting each channel to the top of a 16-bit lane and inserting it right truncates like pixman.
+static void rgb565_row_neon(uint8_t *dst, const uint8_t *src, size_t count) {
+    size_t i = 0;
+    for(; i + 16 <= count; i += 16) {
+        uint8x16x4_t pixels = vld4q_u8(src + 4 * i);
+        uint16x8_t lo = vshll_n_u8(vget_low_u8(pixels.val[2]), 8);
+        lo = vsriq_n_u16(lo, vshll_n_u8(vget_low_u8(pixels.val[1]), 8), 5);
+        lo = vsriq_n_u16(lo, vshll_n_u8(vget_low_u8(pixels.val[0]), 8), 11);
+        uint16x8_t hi = vshll_n_u8(vget_high_u8(pixels.val[2]), 8);
+        hi = vsriq_n_u16(hi, vshll_n_u8(vget_high_u8(pixels.val[1]), 8), 5);
+        hi = vsriq_n_u16(hi, vshll_n_u8(vget_high_u8(pixels.val[0]), 8), 11);
+        vst1q_u8(dst + 2 * i, vreinterpretq_u8_u16(lo));
+        vst1q_u8(dst + 2 * i + 16, vreinterpretq_u8_u16(hi));
+    }
+    rgb565_row_scalar(dst + 2 * i, src + 4 * i, count - i);
+}
+
+static void a8_row_neon(uint8_t *dst, const uint8_t *src, size_t count) {
+    size_t i = 0;
+    for(; i + 16 <= count; i += 16) {
+        vst1q_u8(dst + i, vld4q_u8(src + 4 * i).val[3]);
+    }
+    a8_row_scalar(dst + i, src + 4 * i, count - i);
+}
+
+static const kernel_set_t neon_kernels = {
+    "neon",
+    {
+        [AV_CONVERT_COPY] = copy_row,
+        [AV_CONVERT_UNPREMULTIPLY] = unpremultiply_row_neon,
+        [AV_CONVERT_SWIZZLE] = swizzle_row_neon,
+        [AV_CONVERT_UNPREMULTIPLY_SWIZZLE] = unpremultiply_swizzle_row_neon,
+        [AV_CONVERT_RGB565] = rgb565_row_neon,
+        [AV_CONVERT_A8] = a8_row_neon,
+    },
+};
+
+#endif
+
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+static const kernel_set_t *kernels = &scalar_kernels;
+// Every kernel set the CPU can run, slowest first, for tests and benchmarks.
+static const kernel_set_t *supported[3] = {&scalar_kernels};
+static unsigned supported_count = 1;
+
+static void pick_kernels() {
+#if AV_CONVERT_SSE2
+    supported[supported_count++] = &sse2_kernels;
+#endif
+#if AV_CONVERT_AVX2
+    if(__builtin_cpu_supports("avx2")) supported[supported_count++] = &avx2_kernels;
+#endif
+#if AV_CONVERT_NEON
+    supported[supported_count++] = &neon_kernels;
+#endif
+    kernels = supported[supported_count - 1];
+    CCDEBUG("pixel conversion kernels: %s", kernels->name);
+}
+
+unsigned av_convert_dst_bpp(av_convert_op_t op) {
+    CCASSERT(op < AV_CONVERT_COUNT);
+    switch(op) {
+    case AV_CONVERT_RGB565: return 2;
+    case AV_CONVERT_A8: return 1;
+    default: return 4;
+    }
+}
+
+av_convert_row_f av_convert_get_row(av_convert_op_t op) {
+    CCASSERT(op < AV_CONVERT_COUNT);
+    pthread_once(&kernels_once, pick_kernels);
+    return kernels->rows[op];
+}
+
+av_convert_row_f av_convert_get_reference_row(av_convert_op_t op) {
+    CCASSERT(op < AV_CONVERT_COUNT);
+    return scalar_kernels.rows[op];
+}
+
+const char *av_convert_get_isa() {
+    pthread_once(&kernels_once, pick_kernels);
+    return kernels->name;
+}
+
+unsigned av_convert_get_isa_count() {
+    pthread_once(&kernels_once, pick_kernels);
+    return supported_count;
+}
+
+const char *av_convert_get_isa_name(unsigned isa) {
+    pthread_once(&kernels_once, pick_kernels);
+    CCASSERT(isa < supported_count);
+    return supported[isa]->name;
+}
+
+av_convert_row_f av_convert_get_isa_row(unsigned isa, av_convert_op_t op) {
+    pthread_once(&kernels_once, pick_kernels);
+    CCASSERT(isa < supported_count);
+    CCASSERT(op < AV_CONVERT_COUNT);
+    return supported[isa]->rows[op];
+}
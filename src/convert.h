@@ -0,0 +1,47 @@
+//===--------------------------------------------------------------------------------------------===
+// convert.h - Pixel conversion kernels for copies into upload buffers
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2021 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// What happens to pixels on their way from Cairo's surface to an upload buffer. Everything but
+// AV_CONVERT_COPY reads premultiplied ARGB32, as native-endian 32-bit words.
+typedef enum {
+    AV_CONVERT_COPY,
+    AV_CONVERT_UNPREMULTIPLY,           // To straight ARGB32.
+    AV_CONVERT_SWIZZLE,                 // To premultiplied R, G, B, A bytes.
+    AV_CONVERT_UNPREMULTIPLY_SWIZZLE,   // To straight R, G, B, A bytes.
+    AV_CONVERT_RGB565,                  // Colour channels truncated, like pixman does.
+    AV_CONVERT_A8,                      // Alpha only.
+    AV_CONVERT_COUNT,
+} av_convert_op_t;
+
+typedef void (*av_convert_row_f)(uint8_t *dst, const uint8_t *src, size_t count);
+
+// Bytes per pixel written by [op]. AV_CONVERT_COPY has none of its own.
+unsigned av_convert_dst_bpp(av_convert_op_t op);
+
+// Returns the fastest kernel for [op] the CPU supports, picked on first use.
+av_convert_row_f av_convert_get_row(av_convert_op_t op);
+
+// Returns the scalar kernel for [op], which all others must match bit for bit.
+av_convert_row_f av_convert_get_reference_row(av_convert_op_t op);
+
+// Name of the instruction set the kernels were picked for, for logs and benchmarks.
+const char *av_convert_get_isa();
+
+// Number of instruction sets the CPU can run kernels for, scalar included. They are numbered from
+// slowest to fastest, and the last one is the one av_convert_get_row() uses.
+unsigned av_convert_get_isa_count();
+
+// Name of instruction set [isa].
+const char *av_convert_get_isa_name(unsigned isa);
+
+// Returns the kernel for [op] from instruction set [isa], whether it's the fastest or not.
+av_convert_row_f av_convert_get_isa_row(unsigned isa, av_convert_op_t op);
@@ -7,170 +7,1047 @@
 // =^•.•^=
 //===--------------------------------------------------------------------------------------------===
 #include "display.h"
+#include "timing.h"
 #include <ccore/memory.h>
 #include <ccore/log.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <math.h>
 // #include "glad.h"
 
-static void init_buffer(av_display_t *display, int idx) {
+#define PERSISTENT_FLAGS (GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT)
+
+typedef struct {
+    cairo_format_t cairo;
+    unsigned bpp;
+    GLenum internal;
+    GLenum format;
+    GLenum type;
+} format_info_t;
+
+// Resolution tiers of displays with a frame budget, and how the controller moves between them.
+static const double tier_scales[AV_DISPLAY_SCALE_TIERS] = {1.0, 0.8, 0.65, 0.5};
+#define DOWNGRADE_FRAMES (3)
+#define UPGRADE_FRAMES (30)
+#define UPGRADE_RATIO (0.6)
+
+// Palette indices are just coverage as far as Cairo and GL are concerned: the shader does the rest.
+// RGB565 stays unsized: GL_RGB5 would let the driver drop a bit of green.
+static const format_info_t formats[AV_DISPLAY_FORMAT_COUNT] = {
+    [AV_DISPLAY_FORMAT_ARGB32] = {CAIRO_FORMAT_ARGB32, 4, GL_RGBA8, GL_BGRA, GL_UNSIGNED_BYTE},
+    [AV_DISPLAY_FORMAT_A8] = {CAIRO_FORMAT_A8, 1, GL_R8, GL_RED, GL_UNSIGNED_BYTE},
+    [AV_DISPLAY_FORMAT_RGB565] = {CAIRO_FORMAT_RGB16_565, 2, GL_RGB, GL_RGB, GL_UNSIGNED_SHORT_5_6_5},
+    [AV_DISPLAY_FORMAT_INDEX8] = {CAIRO_FORMAT_A8, 1, GL_R8, GL_RED, GL_UNSIGNED_BYTE},
+    [AV_DISPLAY_FORMAT_RGBA32] = {CAIRO_FORMAT_ARGB32, 4, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE},
+};
+
+// Cairo only draws premultiplied ARGB32, A8 and RGB565. Anything else the texture wants is done
+// by the copy into the slot, which converts the damage as it goes.
+static av_convert_op_t pick_conversion(const av_display_desc_t *desc) {
+    bool is_straight = desc->flags & AV_DISPLAY_STRAIGHT_ALPHA;
+    bool is_down = desc->flags & AV_DISPLAY_DRAW_ARGB32;
+    switch(desc->format) {
+    case AV_DISPLAY_FORMAT_ARGB32:
+        return is_straight ? AV_CONVERT_UNPREMULTIPLY : AV_CONVERT_COPY;
+    case AV_DISPLAY_FORMAT_RGBA32:
+        return is_straight ? AV_CONVERT_UNPREMULTIPLY_SWIZZLE : AV_CONVERT_SWIZZLE;
+    case AV_DISPLAY_FORMAT_RGB565:
+        return is_down ? AV_CONVERT_RGB565 : AV_CONVERT_COPY;
+    case AV_DISPLAY_FORMAT_A8:
+    case AV_DISPLAY_FORMAT_INDEX8:
+        return is_down ? AV_CONVERT_A8 : AV_CONVERT_COPY;
+    default:
+        return AV_CONVERT_COPY;
+    }
+}
+
+static void init_buffer(av_display_t *display, av_slot_t *slot) {
     CCASSERT(display);
-    size_t size = display->width * display->height * 4;
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, display->pbos[idx]);
+    size_t size = display->stride * display->height;
+    av_gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, slot->pbo);
     CHECK_GL();
     glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
     CHECK_GL();
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    av_gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
     CHECK_GL();
 }
 
-void *map_buffer(av_display_t *display, int idx) {
+// Persistent buffers are allocated and mapped once, and stay mapped until the display is deleted.
+static void *init_persistent_buffer(av_display_t *display, av_slot_t *slot) {
+    CCASSERT(display);
+    size_t size = display->stride * display->height;
+    av_gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, slot->pbo);
+    CHECK_GL();
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, NULL, PERSISTENT_FLAGS);
+    CHECK_GL();
+    void *buffer = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, PERSISTENT_FLAGS);
+    CHECK_GL();
+    av_gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    CHECK_GL();
+    return buffer;
+}
+
+static void *map_buffer(av_display_t *display, av_slot_t *slot) {
     CCASSERT(display);
-    size_t size = display->width * display->height * 4;
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, display->pbos[idx]);
+    size_t size = display->stride * display->height;
+    av_gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, slot->pbo);
     CHECK_GL();
     glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
     CHECK_GL();
     void *buffer = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
     CHECK_GL();
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    av_gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
     CHECK_GL();
     return buffer;
 }
 
-void unmap_buffer(av_display_t *display, int idx) {
+static void unmap_buffer(av_display_t *display, av_slot_t *slot) {
     CCASSERT(display);
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, display->pbos[idx]);
+    av_gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, slot->pbo);
     CHECK_GL();
     glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
     CHECK_GL();
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    av_gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
     CHECK_GL();
 }
 
+cairo_t *av_display_create_cairo(const av_display_t *display, cairo_surface_t *surface) {
+    cairo_t *cr = cairo_create(surface);
+    if(display->format != AV_DISPLAY_FORMAT_INDEX8) return cr;
+    // Blending or antialiasing two palette indices gives a third, unrelated one.
+    cairo_set_antialias(cr, CAIRO_ANTIALIAS_NONE);
+    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+    // Text has its own antialiasing setting, which the context's doesn't cover.
+    cairo_font_options_t *options = cairo_font_options_create();
+    cairo_font_options_set_antialias(options, CAIRO_ANTIALIAS_NONE);
+    cairo_set_font_options(cr, options);
+    cairo_font_options_destroy(options);
+    return cr;
+}
+
+// In zero-copy mode, the Cairo surface aliases the mapped slot. It must be torn down before the
+// buffer is unmapped, and can only be rebuilt once a new buffer has been mapped.
+static void release_slot_surface(av_display_t *display, av_slot_t *slot) {
+    if(!(display->flags & AV_DISPLAY_ZERO_COPY)) return;
+    if(display->is_persistent) return;
+    if(slot->cairo) cairo_destroy(slot->cairo);
+    if(slot->surface) cairo_surface_destroy(slot->surface);
+    slot->cairo = NULL;
+    slot->surface = NULL;
+}
+
+static void bind_slot_surface(av_display_t *display, av_slot_t *slot) {
+    if(!(display->flags & AV_DISPLAY_ZERO_COPY)) return;
+    CCASSERT(!slot->surface);
+    CCASSERT(!slot->cairo);
+    CCASSERT(slot->data);
+    CCASSERT(((uintptr_t)slot->data & 3) == 0);
+
+    slot->surface = cairo_image_surface_create_for_data(
+        slot->data,
+        display->cairo_format,
+        display->width,
+        display->height,
+        display->stride
+    );
+    CCASSERT(slot->surface);
+    slot->cairo = av_display_create_cairo(display, slot->surface);
+    CCASSERT(slot->cairo);
+    slot->cairo_tier = -1;
+}
+
+// Atlas and headless displays draw into plain memory, other displays into their own GL buffers.
+static bool has_transfer_buffers(const av_display_t *display) {
+    return display->backend == AV_DISPLAY_BACKEND_GL && !display->atlas;
+}
+
+// Maps a slot the GL thread owns and gives it back to the drawing thread. If the driver won't map
+// the buffer, the slot stays with the GL thread and we try again on the next upload. Persistent
+// slots are always mapped.
+static void recycle_slot(av_display_t *display, av_slot_t *slot) {
+    if(!display->is_persistent && has_transfer_buffers(display)) {
+        slot->data = map_buffer(display, slot);
+        if(!slot->data) {
+            CCERROR("unable to map transfer buffer %u", slot->pbo);
+            atomic_store(&slot->state, AV_SLOT_UNMAPPED);
+            return;
+        }
+        bind_slot_surface(display, slot);
+    }
+    slot->damage = AV_RECT_EMPTY;
+    atomic_store(&slot->state, AV_SLOT_FREE);
+}
+
+// Waits for the GPU to finish reading from a fenced slot, then recycles it. Returns false if we
+// weren't allowed to block and the GPU isn't done yet.
+static bool wait_fence(av_display_t *display, av_slot_t *slot, bool block) {
+    CCASSERT(slot->fence);
+    GLenum result = glClientWaitSync(slot->fence, 0, 0);
+    if(result == GL_TIMEOUT_EXPIRED) {
+        if(!block) return false;
+        display->fence_stats.blocked += 1;
+        do {
+            result = glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        } while(result == GL_TIMEOUT_EXPIRED);
+    }
+    if(result == GL_WAIT_FAILED) CCERROR("fence wait failed on transfer buffer %u", slot->pbo);
+
+    display->fence_stats.waits += 1;
+    glDeleteSync(slot->fence);
+    slot->fence = NULL;
+    recycle_slot(display, slot);
+    return true;
+}
+
+static void poll_fences(av_display_t *display) {
+    for(unsigned i = 0; i < display->slot_count; ++i) {
+        av_slot_t *slot = &display->slots[i];
+        if(atomic_load(&slot->state) != AV_SLOT_FENCED) continue;
+        wait_fence(display, slot, false);
+    }
+}
+
+// The drawing thread needs somewhere to go next. If every slot it could take is still being read
+// by the GPU, we have no choice but to wait for the oldest one. Zero-copy drawing threads keep their
+// slot for the whole frame and can skip one, so we only wait once they found nothing to take.
+// Others can't skip a frame they finished, and always need a slot they can take or steal.
+static void ensure_free_slot(av_display_t *display) {
+    bool is_zero_copy = display->flags & AV_DISPLAY_ZERO_COPY;
+    if(is_zero_copy && !atomic_exchange(&display->is_starved, false)) return;
+
+    av_slot_t *oldest = NULL;
+    for(unsigned i = 0; i < display->slot_count; ++i) {
+        av_slot_t *slot = &display->slots[i];
+        int state = atomic_load(&slot->state);
+        if(state == AV_SLOT_FREE) return;
+        if(!is_zero_copy && (state == AV_SLOT_READY || state == AV_SLOT_WRITING)) return;
+        if(state != AV_SLOT_FENCED) continue;
+        if(!oldest || slot->seq < oldest->seq) oldest = slot;
+    }
+    if(oldest) wait_fence(display, oldest, true);
+}
+
+static bool slot_transition(av_slot_t *slot, int from, int to) {
+    return atomic_compare_exchange_strong(&slot->state, &from, to);
+}
+
+static av_slot_t *acquire_free_slot(av_display_t *display) {
+    for(unsigned i = 0; i < display->slot_count; ++i) {
+        av_slot_t *slot = &display->slots[i];
+        if(slot_transition(slot, AV_SLOT_FREE, AV_SLOT_WRITING)) return slot;
+    }
+    return NULL;
+}
+
+// Takes a slot for the drawing thread. Free slots come first. Failing that, we steal the oldest
+// finished frame the GL thread hasn't picked up yet -- it's about to be superseded anyway.
+static av_slot_t *acquire_slot(av_display_t *display, av_rect_t *dropped) {
+    av_slot_t *free_slot = acquire_free_slot(display);
+    if(free_slot) return free_slot;
+
+    av_slot_t *oldest = NULL;
+    for(unsigned i = 0; i < display->slot_count; ++i) {
+        av_slot_t *slot = &display->slots[i];
+        if(atomic_load(&slot->state) != AV_SLOT_READY) continue;
+        if(!oldest || slot->seq < oldest->seq) oldest = slot;
+    }
+    if(oldest && slot_transition(oldest, AV_SLOT_READY, AV_SLOT_WRITING)) {
+        *dropped = av_rect_union(*dropped, oldest->damage);
+        atomic_fetch_add_explicit(&display->counters.dropped, 1, memory_order_relaxed);
+        return oldest;
+    }
+    return NULL;
+}
+
+// Takes back every finished frame the GL thread hasn't started uploading, keeping track of what
+// they would have changed so the newer frame can carry it.
+static void drop_ready_slots(av_display_t *display, av_rect_t *dropped) {
+    for(unsigned i = 0; i < display->slot_count; ++i) {
+        av_slot_t *slot = &display->slots[i];
+        if(!slot_transition(slot, AV_SLOT_READY, AV_SLOT_WRITING)) continue;
+        *dropped = av_rect_union(*dropped, slot->damage);
+        slot->damage = AV_RECT_EMPTY;
+        atomic_fetch_add_explicit(&display->counters.dropped, 1, memory_order_relaxed);
+        atomic_store(&slot->state, AV_SLOT_FREE);
+    }
+}
+
+// Turns 0xRRGGBBAA into premultiplied floats.
+static void unpack_color(uint32_t rgba, float color[4]) {
+    float alpha = (rgba & 0xff) / 255.f;
+    color[0] = ((rgba >> 24) & 0xff) / 255.f * alpha;
+    color[1] = ((rgba >> 16) & 0xff) / 255.f * alpha;
+    color[2] = ((rgba >> 8) & 0xff) / 255.f * alpha;
+    color[3] = alpha;
+}
+
+static void publish_slot(av_display_t *display, av_slot_t *slot, av_rect_t damage) {
+    slot->damage = damage;
+    slot->render_width = display->render_width;
+    slot->render_height = display->render_height;
+    slot->seq = ++display->seq;
+    slot->published_us = av_time_us();
+    display->last_frame_us = slot->published_us;
+    atomic_fetch_add_explicit(&display->counters.produced, 1, memory_order_relaxed);
+    atomic_store(&slot->state, AV_SLOT_READY);
+}
+
+// Copies the rows of [rect] from [src] to [dst]. Full-width damage is one contiguous block.
+void av_rect_copy(uint8_t *dst, const uint8_t *src, size_t stride, size_t bpp, av_rect_t rect) {
+    size_t offset = rect.y0 * stride + rect.x0 * bpp;
+    size_t row = (rect.x1 - rect.x0) * bpp;
+    if(row == stride) {
+        memcpy(dst + offset, src + offset, row * (rect.y1 - rect.y0));
+        return;
+    }
+    for(int y = rect.y0; y < rect.y1; ++y) {
+        memcpy(dst + offset, src + offset, row);
+        offset += stride;
+    }
+}
+
+// Zeroes the rows of [rect] in [dst], which is transparent, black or palette index 0.
+static void rect_clear(uint8_t *dst, size_t stride, size_t bpp, av_rect_t rect) {
+    size_t offset = rect.y0 * stride + rect.x0 * bpp;
+    size_t row = (rect.x1 - rect.x0) * bpp;
+    if(row == stride) {
+        memset(dst + offset, 0, row * (rect.y1 - rect.y0));
+        return;
+    }
+    for(int y = rect.y0; y < rect.y1; ++y) {
+        memset(dst + offset, 0, row);
+        offset += stride;
+    }
+}
+
+// Converts the rows of [rect] from [src], in ARGB32, into [dst] with one pass over the pixels.
+static void convert_rect(uint8_t *dst, size_t dst_stride, const uint8_t *src, size_t src_stride, av_convert_op_t op, av_rect_t rect) {
+    av_convert_row_f convert = av_convert_get_row(op);
+    unsigned bpp = av_convert_dst_bpp(op);
+    dst += rect.y0 * dst_stride + rect.x0 * bpp;
+    src += rect.y0 * src_stride + rect.x0 * 4;
+    for(int y = rect.y0; y < rect.y1; ++y) {
+        convert(dst, src, rect.x1 - rect.x0);
+        dst += dst_stride;
+        src += src_stride;
+    }
+}
+
 av_display_t *av_display_new(unsigned width, unsigned height) {
-    CCASSERT(width > 0);
-    CCASSERT(height > 0);
+    av_display_desc_t desc = {
+        .width = width,
+        .height = height,
+        .flags = 0,
+        .slots = 0,
+        .bands = 0,
+        .format = AV_DISPLAY_FORMAT_ARGB32,
+    };
+    return av_display_new_desc(&desc);
+}
+
+static void create_private_surface(av_display_t *display) {
+    if(display->flags & AV_DISPLAY_ZERO_COPY) return;
+    display->surface = cairo_image_surface_create(display->cairo_format, display->width, display->height);
+    CCASSERT(display->surface);
+    CCASSERT(cairo_image_surface_get_stride(display->surface) == (int)display->surface_stride);
+    display->cairo = av_display_create_cairo(display, display->surface);
+    CCASSERT(display->cairo);
+}
+
+av_display_t *av_display_new_desc(const av_display_desc_t *desc) {
+    CCASSERT(desc);
+    CCASSERT(desc->width > 0);
+    CCASSERT(desc->height > 0);
+    CCASSERT(!desc->slots || desc->slots >= AV_DISPLAY_MIN_SLOTS);
+    CCASSERT(desc->slots <= AV_DISPLAY_MAX_SLOTS);
+    CCASSERT(desc->format < AV_DISPLAY_FORMAT_COUNT);
+    CCASSERT(desc->palette_size <= 256);
+    CCASSERT(!desc->atlas || desc->format == AV_DISPLAY_FORMAT_ARGB32);
+    CCASSERT(desc->backend != AV_DISPLAY_BACKEND_CPU || (desc->consumer && !desc->atlas));
+    CCASSERT(desc->backend != AV_DISPLAY_BACKEND_VECTOR
+        || (desc->format == AV_DISPLAY_FORMAT_ARGB32 && !desc->atlas && desc->bands <= 1
+            && !(desc->flags & AV_DISPLAY_STRAIGHT_ALPHA)));
+    CCASSERT(!(desc->flags & AV_DISPLAY_STRAIGHT_ALPHA)
+        || desc->format == AV_DISPLAY_FORMAT_ARGB32 || desc->format == AV_DISPLAY_FORMAT_RGBA32);
+    CCASSERT(!(desc->flags & AV_DISPLAY_ZERO_COPY) || pick_conversion(desc) == AV_CONVERT_COPY);
+
+    unsigned width = desc->width;
+    unsigned height = desc->height;
 
     av_display_t *display = cc_alloc(sizeof(av_display_t));
     display->width = width;
     display->height = height;
+    display->format = desc->format;
+    display->convert = pick_conversion(desc);
+    display->cairo_format = display->convert == AV_CONVERT_COPY
+        ? formats[desc->format].cairo
+        : CAIRO_FORMAT_ARGB32;
+    display->bpp = formats[desc->format].bpp;
+    display->stride = cairo_format_stride_for_width(formats[desc->format].cairo, width);
+    display->surface_stride = cairo_format_stride_for_width(display->cairo_format, width);
+    display->flags = desc->flags;
+    display->slot_count = desc->slots ? desc->slots : 3;
+    display->band_count = desc->bands > 1 ? desc->bands : 1;
+    CCASSERT(display->band_count <= AV_DISPLAY_MAX_BANDS);
+    CCASSERT(display->band_count <= height);
+    // The drawing thread draws a band itself, so we only need workers for the others.
+    display->pool = display->band_count > 1 ? av_pool_new(display->band_count - 1) : NULL;
+    display->backend = desc->backend;
+    display->consumer = desc->consumer;
+    display->consumer_data = desc->consumer_data;
+    display->capture = NULL;
+    display->vector = NULL;
+    display->atlas = desc->atlas;
+    display->atlas_offset = 0;
+    display->is_persistent = has_transfer_buffers(display)
+        && GLAD_GL_ARB_buffer_storage && glBufferStorage;
+    atomic_store(&display->is_starved, false);
+    display->fence_stats = (av_display_fence_stats_t){display->is_persistent, 0, 0};
+    av_display_counters_reset(&display->counters);
+    av_gpu_timer_init(&display->upload_timer);
+    display->inputs = NULL;
+    display->input_count = 0;
+    atomic_store(&display->has_inputs, false);
+    atomic_store(&display->is_dirty, true);
+    display->refresh_us = 0;
+    display->last_redraw_us = 0;
+
+    display->budget_us = 0;
+    display->tier = 0;
+    display->tier_count = 1;
+    display->draw_avg_us = 0;
+    display->over_budget = 0;
+    display->under_budget = 0;
+    for(unsigned i = 0; i < AV_DISPLAY_SCALE_TIERS; ++i) {
+        display->antialias[i] = CAIRO_ANTIALIAS_DEFAULT;
+    }
+    atomic_store(&display->scale, 1.0);
+    display->render_width = width;
+    display->render_height = height;
+    display->texture_width = width;
+    display->texture_height = height;
+
+    display->layer_count = 0;
+    display->parent = NULL;
+    display->interval_us = 0;
+    display->last_frame_us = 0;
 
-    display->front = 0;
-    display->back = 1;
-    display->is_back_ready = true;
-    display->current = NULL;
+    display->seq = 0;
+    display->writing = NULL;
+    display->frame_start_us = 0;
+    display->surface = NULL;
+    display->cairo = NULL;
 
+    // The first frame has to fill the texture, whether the app reports damage or not.
+    display->damage = (av_rect_t){0, 0, width, height};
+
+    if(display->backend == AV_DISPLAY_BACKEND_VECTOR) {
+        display->slot_count = 0;
+        display->vector = av_vector_new(width, height);
+        if(!display->vector) {
+            cc_free(display);
+            return NULL;
+        }
+        display->texture = av_vector_get_texture(display->vector);
+        display->lut = 0;
+        av_quad_init(&display->quad, display->texture, 0);
+        return display;
+    }
+
+    // Atlas displays share their texture and transfer buffers, and get a spot in the atlas instead.
+    if(display->atlas && !av_atlas_add(display->atlas, display)) {
+        CCERROR("no room for a %ux%u display in the atlas", width, height);
+        if(display->pool) av_pool_delete(display->pool);
+        cc_free(display);
+        return NULL;
+    }
 
     // Create our transfer buffers
-    glGenBuffers(2, display->pbos);
-    CHECK_GL();
-    init_buffer(display, 0);
-    init_buffer(display, 1);
+    unsigned pbos[AV_DISPLAY_MAX_SLOTS] = {0};
+    if(has_transfer_buffers(display)) {
+        glGenBuffers(display->slot_count, pbos);
+        CHECK_GL();
+    }
+    for(unsigned i = 0; i < display->slot_count; ++i) {
+        av_slot_t *slot = &display->slots[i];
+        slot->pbo = pbos[i];
+        slot->seq = 0;
+        slot->published_us = 0;
+        slot->fence = NULL;
+        slot->data = NULL;
+        slot->surface = NULL;
+        slot->cairo = NULL;
+        slot->cairo_tier = -1;
+        slot->render_width = width;
+        slot->render_height = height;
+        if(!has_transfer_buffers(display)) {
+            slot->data = cc_alloc(display->stride * height);
+            bind_slot_surface(display, slot);
+        } else if(display->is_persistent) {
+            slot->data = init_persistent_buffer(display, slot);
+            CCASSERT(slot->data);
+            bind_slot_surface(display, slot);
+        } else {
+            init_buffer(display, slot);
+        }
+        recycle_slot(display, slot);
+    }
 
-    display->current = map_buffer(display, display->back);
+    if(display->backend == AV_DISPLAY_BACKEND_CPU) {
+        display->texture = 0;
+        display->lut = 0;
+        create_private_surface(display);
+        return display;
+    }
 
+    if(display->atlas) {
+        display->texture = av_atlas_get_texture(display->atlas);
+        display->lut = 0;
+        av_quad_init(&display->quad, display->texture, 0);
+        double uv[4];
+        av_atlas_get_uv(display->atlas, display, uv);
+        av_quad_set_uv(&display->quad, uv[0], uv[1], uv[2], uv[3]);
+        create_private_surface(display);
+        return display;
+    }
     // Create the texture
     glGenTextures(1, &display->texture);
-    glBindTexture(GL_TEXTURE_2D, display->texture);
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, display->pbos[display->front]);
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, width);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+    av_gl_bind_texture(0, display->texture);
+    const format_info_t *info = &formats[display->format];
+    glTexImage2D(GL_TEXTURE_2D, 0, info->internal, width, height, 0, info->format, info->type, NULL);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    av_gl_bind_texture(0, 0);
     CHECK_GL();
 
-    display->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
-    CCASSERT(display->surface);
-    display->cairo = cairo_create(display->surface);
-    CCASSERT(display->cairo);
-    
+    display->lut = 0;
+    if(display->format == AV_DISPLAY_FORMAT_INDEX8) {
+        glGenTextures(1, &display->lut);
+        av_gl_bind_texture(0, display->lut);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 256, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        av_gl_bind_texture(0, 0);
+        CHECK_GL();
+        av_display_set_palette(display, desc->palette, desc->palette_size);
+    }
+
+    create_private_surface(display);
+
+    float tint[4];
+    unpack_color(desc->tint ? desc->tint : 0xffffffff, tint);
     av_quad_init(&display->quad, display->texture, 0);
-    pthread_mutex_init(&display->mt, NULL);
+    av_quad_set_format(&display->quad, display->format, display->lut, tint);
     return display;
 }
 
 void av_display_delete(av_display_t *display) {
     CCASSERT(display);
-    av_quad_deinit(&display->quad);
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    pthread_mutex_destroy(&display->mt);
-    glDeleteTextures(1, &display->texture);
-    glDeleteBuffers(2, display->pbos);
-    cairo_destroy(display->cairo);
-    cairo_surface_destroy(display->surface);
+    for(unsigned i = 0; i < display->layer_count; ++i) {
+        av_display_delete(display->layers[i]);
+    }
+    if(display->capture) av_display_stop_capture(display, NULL);
+    if(display->pool) av_pool_delete(display->pool);
+    if(display->backend != AV_DISPLAY_BACKEND_CPU) {
+        av_gpu_timer_deinit(&display->upload_timer);
+        av_quad_deinit(&display->quad);
+        av_gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        av_gl_bind_texture(0, 0);
+    }
+    if(display->cairo) cairo_destroy(display->cairo);
+    if(display->surface) cairo_surface_destroy(display->surface);
+
+    for(unsigned i = 0; i < display->slot_count; ++i) {
+        av_slot_t *slot = &display->slots[i];
+        if(slot->fence) glDeleteSync(slot->fence);
+        if(slot->cairo) cairo_destroy(slot->cairo);
+        if(slot->surface) cairo_surface_destroy(slot->surface);
+        if(!has_transfer_buffers(display)) {
+            cc_free(slot->data);
+            continue;
+        }
+        if(atomic_load(&slot->state) != AV_SLOT_UNMAPPED) unmap_buffer(display, slot);
+        av_gl_delete_buffers(1, &slot->pbo);
+    }
+    if(display->vector) {
+        av_vector_delete(display->vector);
+    } else if(display->atlas) {
+        av_atlas_remove(display->atlas, display);
+    } else if(display->texture) {
+        av_gl_delete_textures(1, &display->texture);
+    }
+    if(display->lut) av_gl_delete_textures(1, &display->lut);
+    if(display->inputs) cc_free(display->inputs);
 
     cc_free(display);
 }
 
-void *av_display_get_back_buffer(av_display_t *display) {
-    if(display->is_back_ready) return NULL; // We haven't drawn the old frame yet
-    return display->current;
+// Sets [cr] up to draw onto [surface] at the current tier's resolution and quality.
+static void apply_tier(av_display_t *display, cairo_surface_t *surface, cairo_t **cr) {
+    double scale = tier_scales[display->tier];
+    cairo_surface_set_device_scale(surface, scale, scale);
+    if(*cr) cairo_destroy(*cr);
+    *cr = av_display_create_cairo(display, surface);
+    if(display->format != AV_DISPLAY_FORMAT_INDEX8) {
+        cairo_set_antialias(*cr, display->antialias[display->tier]);
+    }
 }
 
-void av_display_finish_back_buffer(av_display_t *display) {
-    CCASSERT(display);
-    
-    if(display->is_back_ready || !display->current) {
+static void set_tier(av_display_t *display, unsigned tier) {
+    CCASSERT(tier < display->tier_count);
+    bool is_resized = tier != display->tier;
+    display->tier = tier;
+    display->over_budget = 0;
+    display->under_budget = 0;
+    display->draw_avg_us = 0;
+
+    double scale = tier_scales[tier];
+    atomic_store(&display->scale, scale);
+    display->render_width = cc_max((unsigned)ceil(display->width * scale), 1u);
+    display->render_height = cc_max((unsigned)ceil(display->height * scale), 1u);
+    if(display->flags & AV_DISPLAY_ZERO_COPY) return;
+
+    // The private surface is kept from frame to frame: old contents at another scale are garbage.
+    apply_tier(display, display->surface, &display->cairo);
+    if(!is_resized) return;
+    cairo_save(display->cairo);
+    cairo_set_operator(display->cairo, CAIRO_OPERATOR_CLEAR);
+    cairo_paint(display->cairo);
+    cairo_restore(display->cairo);
+    display->damage = (av_rect_t){0, 0, display->render_width, display->render_height};
+}
+
+// Keeps a running average of draw times, and moves down a tier when it goes over budget for a few
+// frames. Moving back up takes many frames well under budget, or we would oscillate.
+static void update_tier(av_display_t *display, uint64_t draw_us) {
+    if(!display->budget_us) return;
+    double avg = display->draw_avg_us;
+    avg = avg > 0 ? 0.8 * avg + 0.2 * (double)draw_us : (double)draw_us;
+    display->draw_avg_us = avg;
+
+    if(avg > display->budget_us) {
+        display->under_budget = 0;
+        display->over_budget += 1;
+        if(display->over_budget >= DOWNGRADE_FRAMES && display->tier + 1 < display->tier_count) {
+            set_tier(display, display->tier + 1);
+        }
+    } else if(avg < display->budget_us * UPGRADE_RATIO) {
+        display->over_budget = 0;
+        display->under_budget += 1;
+        if(display->under_budget >= UPGRADE_FRAMES && display->tier > 0) {
+            set_tier(display, display->tier - 1);
+        }
+    } else {
+        display->over_budget = 0;
+        display->under_budget = 0;
+    }
+}
+
+static void finish_frame(av_display_t *display) {
+    av_slot_t *slot = display->writing;
+    av_rect_t damage = AV_RECT_EMPTY;
+
+    if(display->flags & AV_DISPLAY_ZERO_COPY) {
+        // Cairo drew straight into the slot: flushing is all we need.
+        if(!slot) return;
+        cairo_surface_flush(slot->surface);
+        drop_ready_slots(display, &damage);
+        display->writing = NULL;
+        publish_slot(display, slot, (av_rect_t){0, 0, display->render_width, display->render_height});
         return;
     }
-    
+
     cairo_status_t status = cairo_surface_status(display->surface);
     if(status != CAIRO_STATUS_SUCCESS){
         CCDEBUG("surface %p status: %s", cairo_status_to_string(status));
         return;
     }
-    
-    const void *src = cairo_image_surface_get_data(display->surface);
-    CCASSERT(src);
-    
-    memcpy(display->current, src, 4 * display->width * display->height);
-    // pthread_mutex_lock(&display->mt);
-    display->is_back_ready = true;
-    // pthread_mutex_unlock(&display->mt);
+
+    // Whatever the frames we drop would have changed has to go into this one too. If we can't get
+    // a slot at all, the damage stays pending until the next frame, which must not be skipped.
+    slot = acquire_slot(display, &damage);
+    if(!slot) {
+        atomic_store(&display->is_dirty, true);
+        return;
+    }
+    drop_ready_slots(display, &damage);
+
+    damage = av_rect_union(damage, (display->flags & AV_DISPLAY_DAMAGE)
+        ? display->damage
+        : (av_rect_t){0, 0, display->render_width, display->render_height});
+    // Frames dropped before a resolution change may reach past the part we're drawing into.
+    damage = av_rect_clip(damage, display->render_width, display->render_height);
+
+    cairo_surface_flush(display->surface);
+    if(!av_rect_is_empty(damage)) {
+        const uint8_t *src = cairo_image_surface_get_data(display->surface);
+        CCASSERT(src);
+        if(display->convert == AV_CONVERT_COPY) {
+            av_rect_copy(slot->data, src, display->stride, display->bpp, damage);
+        } else {
+            convert_rect(slot->data, display->stride, src, display->surface_stride, display->convert, damage);
+        }
+    }
+    display->damage = AV_RECT_EMPTY;
+    publish_slot(display, slot, damage);
 }
 
-void av_display_upload(av_display_t *display) {
+void av_display_finish_back_buffer(av_display_t *display) {
     CCASSERT(display);
-    if(!display->is_back_ready) return;
+    av_display_counters_t *counters = &display->counters;
 
+    uint64_t start = av_time_us();
+    if(display->frame_start_us) {
+        av_histogram_record(&counters->stages[AV_DISPLAY_STAGE_DRAW], start - display->frame_start_us);
+    }
+    uint64_t draw_us = display->frame_start_us ? start - display->frame_start_us : 0;
+    display->frame_start_us = 0;
+    if(display->vector) {
+        if(av_vector_finish(display->vector)) {
+            atomic_fetch_add_explicit(&counters->dropped, 1, memory_order_relaxed);
+        }
+        display->last_frame_us = av_time_us();
+        atomic_fetch_add_explicit(&counters->produced, 1, memory_order_relaxed);
+        av_histogram_record(&counters->stages[AV_DISPLAY_STAGE_COPY], display->last_frame_us - start);
+        return;
+    }
+    finish_frame(display);
+    av_histogram_record(&counters->stages[AV_DISPLAY_STAGE_COPY], av_time_us() - start);
+    if(draw_us) update_tier(display, draw_us);
+}
 
-    // First, upload the data from the back glBufferData
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, display->pbos[display->front]);
-    CHECK_GL();
-    glBindTexture(GL_TEXTURE_2D, display->texture);
-    CHECK_GL();
-    glTexSubImage2D(
-        GL_TEXTURE_2D, 0, 0, 0,
-        display->width, display->height,
-        GL_BGRA, GL_UNSIGNED_BYTE, NULL
-    );
+// Scaled frames only fill part of the texture, which gets stretched back over the whole quad.
+static void update_texture_size(av_display_t *display, unsigned width, unsigned height) {
+    display->texture_width = width;
+    display->texture_height = height;
+    av_quad_set_uv(&display->quad, 0, 0, (double)width / display->width, (double)height / display->height);
+
+    bool is_scaled = width != display->width || height != display->height;
+    GLint filter = is_scaled && display->format != AV_DISPLAY_FORMAT_INDEX8 ? GL_LINEAR : GL_NEAREST;
+    av_gl_bind_texture(0, display->texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    av_gl_bind_texture(0, 0);
     CHECK_GL();
-    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// Grabs the newest finished frame. The drawing thread might steal it back between the scan and the
+// transition, in which case there is a newer one to look for.
+static av_slot_t *acquire_newest_frame(av_display_t *display) {
+    for(;;) {
+        av_slot_t *newest = NULL;
+        for(unsigned i = 0; i < display->slot_count; ++i) {
+            av_slot_t *slot = &display->slots[i];
+            if(atomic_load(&slot->state) != AV_SLOT_READY) continue;
+            if(!newest || slot->seq > newest->seq) newest = slot;
+        }
+        if(!newest) return NULL;
+        if(slot_transition(newest, AV_SLOT_READY, AV_SLOT_READING)) return newest;
+    }
+}
+
+av_slot_t *av_display_acquire_frame(av_display_t *display) {
+    av_slot_t *slot = acquire_newest_frame(display);
+    if(!slot) return NULL;
+    slot->upload_us = av_time_us();
+    if(display->capture) av_capture_push(display->capture, display, slot);
+    return slot;
+}
+
+void av_display_release_frame(av_display_t *display, av_slot_t *slot) {
+    uint64_t start = slot->upload_us;
+    uint64_t published = slot->published_us;
+    if(display->is_persistent) {
+        // The transfer is asynchronous: the slot can't be written to until the GPU is done with it.
+        slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        atomic_store(&slot->state, AV_SLOT_FENCED);
+        ensure_free_slot(display);
+    } else {
+        recycle_slot(display, slot);
+    }
     CHECK_GL();
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
-    
-    // Swap the buffers, so we can upload what was drawn in the back buffer
-    // pthread_mutex_lock(&display->mt);
-    unmap_buffer(display, display->back);
-    display->back = (display->back + 1) % 2;
-    display->front = (display->front + 1) % 2;
-    display->current = map_buffer(display, display->back);
-    display->is_back_ready = false;
-    // pthread_mutex_unlock(&display->mt);
+
+    av_display_counters_t *counters = &display->counters;
+    av_histogram_record(&counters->stages[AV_DISPLAY_STAGE_LATENCY], start - published);
+    av_histogram_record(&counters->stages[AV_DISPLAY_STAGE_UPLOAD], av_time_us() - start);
+    atomic_fetch_add_explicit(&counters->uploaded, 1, memory_order_relaxed);
+}
+
+static void consume_frame(av_display_t *display) {
+    av_slot_t *slot = av_display_acquire_frame(display);
+    if(!slot) return;
+
+    av_rect_t damage = slot->damage;
+    av_display_frame_t frame = {
+        .pixels = slot->data,
+        .stride = display->stride,
+        .format = display->format,
+        .width = slot->render_width,
+        .height = slot->render_height,
+        .damage_x = damage.x0,
+        .damage_y = damage.y0,
+        .damage_width = av_rect_is_empty(damage) ? 0 : damage.x1 - damage.x0,
+        .damage_height = av_rect_is_empty(damage) ? 0 : damage.y1 - damage.y0,
+        .seq = slot->seq,
+    };
+    display->consumer(&frame, display->consumer_data);
+    av_display_release_frame(display, slot);
+}
+
+static void render_vector(av_display_t *display) {
+    uint64_t start = av_time_us();
+    uint64_t published = 0;
+    if(!av_vector_render(display->vector, &display->upload_timer, &published)) return;
+
+    av_display_counters_t *counters = &display->counters;
+    av_histogram_record(&counters->stages[AV_DISPLAY_STAGE_LATENCY], start - published);
+    av_histogram_record(&counters->stages[AV_DISPLAY_STAGE_UPLOAD], av_time_us() - start);
+    atomic_fetch_add_explicit(&counters->uploaded, 1, memory_order_relaxed);
+}
+
+void av_display_upload(av_display_t *display) {
+    CCASSERT(display);
+    if(display->atlas) return;
+    if(display->vector) {
+        render_vector(display);
+        return;
+    }
+    if(display->backend == AV_DISPLAY_BACKEND_CPU) {
+        consume_frame(display);
+        return;
+    }
+    for(unsigned i = 0; i < display->layer_count; ++i) {
+        av_display_upload(display->layers[i]);
+    }
+
+    for(unsigned i = 0; i < display->slot_count; ++i) {
+        av_slot_t *slot = &display->slots[i];
+        if(atomic_load(&slot->state) == AV_SLOT_UNMAPPED) recycle_slot(display, slot);
+    }
+    if(display->is_persistent) poll_fences(display);
+
+    av_slot_t *slot = av_display_acquire_frame(display);
+    if(!slot) {
+        // A zero-copy drawing thread may be stuck without a slot, and no frame to give us.
+        if(display->is_persistent) ensure_free_slot(display);
+        return;
+    }
+
+    if(slot->render_width != display->texture_width || slot->render_height != display->texture_height) {
+        update_texture_size(display, slot->render_width, slot->render_height);
+    }
+
+    // The surface can't outlive the mapping, and the buffer has to be unmapped to upload from it.
+    // Coherent persistent mappings can be read by the GPU as they are.
+    if(!display->is_persistent) {
+        release_slot_surface(display, slot);
+        unmap_buffer(display, slot);
+    }
+
+    // Only the damaged rows were ever written to the slot.
+    av_rect_t damage = slot->damage;
+    if(!av_rect_is_empty(damage)) {
+        const format_info_t *info = &formats[display->format];
+        size_t offset = damage.y0 * display->stride + damage.x0 * display->bpp;
+        av_gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, slot->pbo);
+        CHECK_GL();
+        av_gl_bind_texture(0, display->texture);
+        CHECK_GL();
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, display->stride / display->bpp);
+        av_gpu_timer_begin(&display->upload_timer);
+        glTexSubImage2D(
+            GL_TEXTURE_2D, 0, damage.x0, damage.y0,
+            damage.x1 - damage.x0, damage.y1 - damage.y0,
+            info->format, info->type, (const void *)offset
+        );
+        av_gpu_timer_end(&display->upload_timer);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        CHECK_GL();
+        av_gl_bind_texture(0, 0);
+        CHECK_GL();
+        av_gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    av_display_release_frame(display, slot);
+}
+
+void av_display_set_budget(av_display_t *display, double budget, double min_scale) {
+    CCASSERT(display);
+    CCASSERT(budget >= 0);
+    CCASSERT(!display->layer_count && !display->parent);
+    // Linear filtering would bleed neighbouring displays in.
+    CCASSERT(!display->atlas);
+    CCASSERT(!display->vector);
+
+    display->budget_us = (uint64_t)(budget * 1e6);
+    display->tier_count = 1;
+    while(display->tier_count < AV_DISPLAY_SCALE_TIERS
+          && tier_scales[display->tier_count] >= min_scale) {
+        display->tier_count += 1;
+    }
+    set_tier(display, display->budget_us ? cc_min(display->tier, display->tier_count - 1) : 0);
+}
+
+void av_display_set_tier_antialias(av_display_t *display, unsigned tier, cairo_antialias_t antialias) {
+    CCASSERT(display);
+    CCASSERT(tier < AV_DISPLAY_SCALE_TIERS);
+    display->antialias[tier] = antialias;
+    if(tier == display->tier && display->budget_us) set_tier(display, tier);
+}
+
+double av_display_get_scale(const av_display_t *display) {
+    CCASSERT(display);
+    return atomic_load(&display->scale);
+}
+
+void av_display_set_palette(av_display_t *display, const uint32_t *palette, unsigned count) {
+    CCASSERT(display);
+    CCASSERT(display->format == AV_DISPLAY_FORMAT_INDEX8);
+    CCASSERT(display->backend == AV_DISPLAY_BACKEND_GL);
+    CCASSERT(count <= 256);
+    CCASSERT(palette || !count);
+
+    // The shader expects premultiplied colours, like everything else Cairo gives it.
+    uint8_t lut[256 * 4] = {0};
+    for(unsigned i = 0; i < count; ++i) {
+        float color[4];
+        unpack_color(palette[i], color);
+        for(unsigned c = 0; c < 4; ++c) {
+            lut[i * 4 + c] = (uint8_t)lroundf(color[c] * 255.f);
+        }
+    }
+    av_gl_bind_texture(0, display->lut);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 256, 1, GL_RGBA, GL_UNSIGNED_BYTE, lut);
+    av_gl_bind_texture(0, 0);
     CHECK_GL();
 }
 
-cairo_t *av_display_get_cairo(const av_display_t *display) {
+void av_display_set_source_index(cairo_t *cr, unsigned index) {
+    CCASSERT(cr);
+    CCASSERT(index < 256);
+    cairo_set_source_rgba(cr, 0, 0, 0, index / 255.0);
+}
+
+void av_display_get_fence_stats(const av_display_t *display, av_display_fence_stats_t *stats) {
     CCASSERT(display);
-    CCASSERT(display->cairo);
-    return display->cairo;
+    CCASSERT(stats);
+    *stats = display->fence_stats;
+}
+
+av_display_t *av_display_add_layer(av_display_t *display, double interval) {
+    CCASSERT(display);
+    CCASSERT(!display->parent);
+    CCASSERT(display->layer_count < AV_DISPLAY_MAX_LAYERS - 1);
+    CCASSERT(display->format == AV_DISPLAY_FORMAT_ARGB32);
+    CCASSERT(!(display->flags & AV_DISPLAY_STRAIGHT_ALPHA));
+    CCASSERT(!display->atlas);
+    CCASSERT(display->backend == AV_DISPLAY_BACKEND_GL);
+
+    av_display_desc_t desc = {
+        .width = display->width,
+        .height = display->height,
+        .flags = display->flags,
+        .slots = display->slot_count,
+        .bands = display->band_count,
+        .format = display->format,
+    };
+    av_display_t *layer = av_display_new_desc(&desc);
+    layer->parent = display;
+    av_display_set_interval(layer, interval);
+
+    display->layers[display->layer_count++] = layer;
+
+    unsigned textures[AV_DISPLAY_MAX_LAYERS - 1];
+    for(unsigned i = 0; i < display->layer_count; ++i) {
+        textures[i] = display->layers[i]->texture;
+    }
+    av_quad_set_layers(&display->quad, textures, display->layer_count);
+    return layer;
+}
+
+void av_display_set_interval(av_display_t *display, double interval) {
+    CCASSERT(display);
+    CCASSERT(interval >= 0);
+    display->interval_us = (uint64_t)(interval * 1e6);
+}
+
+bool av_display_is_due(const av_display_t *display) {
+    CCASSERT(display);
+    if(!display->interval_us || !display->last_frame_us) return true;
+    return av_time_us() - display->last_frame_us >= display->interval_us;
+}
+
+void av_render_display(av_target_t *target, av_display_t *display, vec2_t pos, vec2_t size, double alpha) {
+    CCASSERT(display);
+    CCASSERT(display->backend != AV_DISPLAY_BACKEND_CPU);
+    av_render_quad(target, &display->quad, pos, size, alpha);
+}
+
+cairo_t *av_display_get_cairo(av_display_t *display) {
+    CCASSERT(display);
+    CCASSERT(!display->vector);
+    if(!display->frame_start_us) display->frame_start_us = av_time_us();
+    if(!(display->flags & AV_DISPLAY_ZERO_COPY)) {
+        CCASSERT(display->cairo);
+        return display->cairo;
+    }
+
+    // The zero-copy surface belongs to whichever slot we're drawing into until the next finish.
+    // The only finished frame there could be to steal is the one we just handed over, which the GL
+    // thread should get: we would rather skip drawing, and let it know we need a slot. The frame
+    // we skip still has to be drawn once we get one.
+    if(!display->writing) {
+        av_slot_t *slot = acquire_free_slot(display);
+        if(!slot) {
+            atomic_store(&display->is_starved, true);
+            atomic_store(&display->is_dirty, true);
+            return NULL;
+        }
+        // Fresh contexts are already right for full resolution, unless the tier has settings.
+        bool is_stale = slot->cairo_tier < 0
+            ? display->budget_us != 0
+            : slot->cairo_tier != (int)display->tier;
+        if(is_stale) {
+            apply_tier(display, slot->surface, &slot->cairo);
+            slot->cairo_tier = display->tier;
+        }
+        display->writing = slot;
+    }
+    return display->writing->cairo;
+}
+
+// Clearing through Cairo goes down pixman's general compositing path. Writing to the surface
+// directly only costs a memset per row.
+bool av_display_clear(av_display_t *display) {
+    CCASSERT(display);
+    cairo_t *cr = av_display_get_cairo(display);
+    if(!cr) return false;
+
+    av_rect_t rect = {0, 0, display->render_width, display->render_height};
+    if((display->flags & AV_DISPLAY_DAMAGE) && !(display->flags & AV_DISPLAY_ZERO_COPY)) {
+        rect = av_rect_clip(display->damage, display->render_width, display->render_height);
+    }
+    if(av_rect_is_empty(rect)) return true;
+
+    cairo_surface_t *surface = cairo_get_target(cr);
+    cairo_surface_flush(surface);
+    uint8_t *data = cairo_image_surface_get_data(surface);
+    CCASSERT(data);
+    size_t bpp = display->convert == AV_CONVERT_COPY ? display->bpp : 4;
+    rect_clear(data, display->surface_stride, bpp, rect);
+    cairo_surface_mark_dirty(surface);
+    return true;
+}
+
+av_canvas_t *av_display_get_canvas(av_display_t *display) {
+    CCASSERT(display);
+    CCASSERT(display->vector);
+    if(!display->frame_start_us) display->frame_start_us = av_time_us();
+    return av_vector_get_canvas(display->vector);
 }
 
 unsigned av_display_get_texture(const av_display_t *display) {
@@ -182,3 +1059,59 @@ av_quad_t *av_display_get_quad(av_display_t *display) {
     CCASSERT(display);
     return &display->quad;
 }
+
+void av_display_damage(av_display_t *display, int x, int y, int width, int height) {
+    CCASSERT(display);
+    if(width <= 0 || height <= 0) return;
+    double scale = tier_scales[display->tier];
+    av_rect_t rect = {
+        (int)floor(x * scale), (int)floor(y * scale),
+        (int)ceil((x + width) * scale), (int)ceil((y + height) * scale)
+    };
+    display->damage = av_rect_union(display->damage, rect);
+}
+
+void av_display_damage_all(av_display_t *display) {
+    CCASSERT(display);
+    display->damage = (av_rect_t){0, 0, display->width, display->height};
+}
+
+// Cairo gives us extents in user space. We need the device-space bounding box of that, with a
+// pixel of padding either side to catch antialiasing. Device space leaves out the surface's device
+// scale, which we apply ourselves to land in render pixels.
+static void damage_user_extents(av_display_t *display, double x0, double y0, double x1, double y1) {
+    cairo_t *cr = display->cairo;
+    double scale = tier_scales[display->tier];
+    double xs[4] = {x0, x1, x1, x0};
+    double ys[4] = {y0, y0, y1, y1};
+    double min_x = INFINITY, min_y = INFINITY, max_x = -INFINITY, max_y = -INFINITY;
+    for(int i = 0; i < 4; ++i) {
+        cairo_user_to_device(cr, &xs[i], &ys[i]);
+        min_x = fmin(min_x, xs[i]);
+        min_y = fmin(min_y, ys[i]);
+        max_x = fmax(max_x, xs[i]);
+        max_y = fmax(max_y, ys[i]);
+    }
+    if(max_x <= min_x || max_y <= min_y) return;
+    av_rect_t rect = {
+        (int)floor(min_x * scale) - 1, (int)floor(min_y * scale) - 1,
+        (int)ceil(max_x * scale) + 1, (int)ceil(max_y * scale) + 1
+    };
+    display->damage = av_rect_union(display->damage, rect);
+}
+
+void av_display_damage_fill(av_display_t *display) {
+    CCASSERT(display);
+    if(!display->cairo) return;
+    double x0, y0, x1, y1;
+    cairo_fill_extents(display->cairo, &x0, &y0, &x1, &y1);
+    damage_user_extents(display, x0, y0, x1, y1);
+}
+
+void av_display_damage_stroke(av_display_t *display) {
+    CCASSERT(display);
+    if(!display->cairo) return;
+    double x0, y0, x1, y1;
+    cairo_stroke_extents(display->cairo, &x0, &y0, &x1, &y1);
+    damage_user_extents(display, x0, y0, x1, y1);
+}
@@ -8,43 +8,296 @@
 //===--------------------------------------------------------------------------------------------===
 #pragma once
 #include <libavionics/display.h>
+#include <libavionics/canvas.h>
 #include <libavionics/renderer.h>
 #include <libavionics/gl.h>
+#include "convert.h"
+#include "glstate.h"
+#include "pool.h"
 #include <ccore/log.h>
 #include <ccore/math.h>
 #include <XPLMGraphics.h>
+#include <stdatomic.h>
+#include <stdint.h>
 // #include "glad.h"
 
+// Durations go in power-of-two buckets, of microseconds unless said otherwise: bucket i holds
+// [2^(i-1), 2^i), with bucket 0 for anything under one unit. Recording is a couple of relaxed
+// atomic adds, so stats can stay on in production and be read from any thread.
+#define AV_HISTOGRAM_BUCKETS (32)
+
+typedef struct {
+    _Atomic unsigned long buckets[AV_HISTOGRAM_BUCKETS];
+    _Atomic uint64_t max;
+} av_histogram_t;
+
+void av_histogram_record(av_histogram_t *histogram, uint64_t value);
+void av_histogram_reset(av_histogram_t *histogram);
+// Fills in [timing] in milliseconds, from a histogram of units worth [unit_ms] each.
+void av_histogram_query(const av_histogram_t *histogram, double unit_ms, av_display_timing_t *timing);
+
+// GPU durations come back from timer queries a few frames late. Each timer has a ring of
+// timestamp pairs, which nest fine unlike GL_TIME_ELAPSED queries. When the ring is full, the
+// measurement is skipped rather than waited for. Queries are only created once timing is on.
+#define AV_GPU_TIMER_DEPTH (16)
+
+typedef struct {
+    unsigned queries[AV_GPU_TIMER_DEPTH * 2];
+    unsigned head;              // Next pair to write.
+    unsigned pending;           // Pairs written but not read back yet, GL thread only.
+    bool is_open;
+    _Atomic unsigned long skipped;
+    _Atomic uint64_t total_ns;
+    av_histogram_t histogram;   // In nanoseconds.
+} av_gpu_timer_t;
+
+void av_gpu_timer_init(av_gpu_timer_t *timer);
+void av_gpu_timer_deinit(av_gpu_timer_t *timer);
+void av_gpu_timer_begin(av_gpu_timer_t *timer);
+void av_gpu_timer_end(av_gpu_timer_t *timer);
+void av_gpu_timer_reset(av_gpu_timer_t *timer);
+void av_gpu_timer_query(const av_gpu_timer_t *timer, av_gpu_timing_t *timing);
+
+typedef struct {
+    float x, y;
+    float u, v;
+    float alpha;
+} av_vertex_t;
+
 struct av_quad_s {
-    unsigned vbo;
-    unsigned ibo;
     unsigned shader;
     unsigned tex;
+
+    // Where vertex arrays are available, drawn on its own, a quad is just a bind and a draw. The
+    // vertex array is set up with [shader]'s locations, and [vbo] is only updated on change.
+    unsigned vao;
+    unsigned vbo;
+    bool has_vertices;
+    av_vertex_t vertices[4];    // What [vbo] holds.
     
     struct {
         int vtx_pos;
         int vtx_tex0;
+        int vtx_alpha;          // -1 for custom shaders that only take the alpha uniform.
         int pvm;
         int tex;
         int alpha;
+        int layer_count;
+        int layers[AV_DISPLAY_MAX_LAYERS - 1];
+        int lut;
+        int tint;
     } loc;
+
+    // How [tex] is decoded. [lut] is the palette of INDEX8 textures, [tint] the premultiplied
+    // colour of A8 ones.
+    av_display_format_t format;
+    unsigned lut;
+    float tint[4];
+
+    // Textures composited over [tex], bottom to top.
+    unsigned layer_count;
+    unsigned layers[AV_DISPLAY_MAX_LAYERS - 1];
     
-    vec2_t last_pos;
-    vec2_t last_size;
+    // Part of the texture to draw.
+    vec2_t uv0;
+    vec2_t uv1;
+
+    // Only the first draw of the quad on its own in each run is timed.
+    av_gpu_timer_t timer;
+    unsigned long timed_run;
 };
 
+typedef struct {
+    av_quad_t *quad;
+    float x, y;                 // In target coordinates. Negative sizes flip the quad.
+    float width, height;
+    float u0, v0, u1, v1;
+    float alpha;
+    float rotation;             // Radians, around the centre of the quad.
+    unsigned depth;             // Quads of a lower depth are drawn first.
+    unsigned index;             // Order the quad was added in.
+} av_batch_item_t;
+
+// Quads are drawn from a single streaming vertex buffer. Each is given the lowest depth that
+// keeps it above the quads it overlaps, which is the only order that matters, and quads of the
+// same depth and state share a draw call.
+struct av_batch_s {
+    av_target_t *target;        // NULL outside of av_batch_begin() and av_batch_end().
+    av_batch_item_t *items;
+    av_vertex_t *vertices;      // Four per item, written in draw order.
+    unsigned count;
+    unsigned capacity;
+
+    unsigned vbo;
+    unsigned ibo;
+    unsigned ibo_capacity;      // Quads [ibo] has indices for.
+};
+
+typedef struct {
+    int x0, y0;
+    int x1, y1;
+} av_rect_t;
+
+#define AV_RECT_EMPTY ((av_rect_t){0, 0, 0, 0})
+
+static inline bool av_rect_is_empty(av_rect_t r) {
+    return r.x1 <= r.x0 || r.y1 <= r.y0;
+}
+
+static inline av_rect_t av_rect_union(av_rect_t a, av_rect_t b) {
+    if(av_rect_is_empty(a)) return b;
+    if(av_rect_is_empty(b)) return a;
+    return (av_rect_t){
+        cc_min(a.x0, b.x0), cc_min(a.y0, b.y0),
+        cc_max(a.x1, b.x1), cc_max(a.y1, b.y1)
+    };
+}
+
+static inline av_rect_t av_rect_clip(av_rect_t r, int width, int height) {
+    r.x0 = cc_max(r.x0, 0);
+    r.y0 = cc_max(r.y0, 0);
+    r.x1 = cc_min(r.x1, width);
+    r.y1 = cc_min(r.y1, height);
+    return av_rect_is_empty(r) ? AV_RECT_EMPTY : r;
+}
+
+typedef struct {
+    _Atomic unsigned long produced;
+    _Atomic unsigned long uploaded;
+    _Atomic unsigned long dropped;
+    _Atomic unsigned long skipped;
+    av_histogram_t stages[AV_DISPLAY_STAGE_COUNT];
+} av_display_counters_t;
+
+void av_display_counters_reset(av_display_counters_t *counters);
+
+// A frame slot moves FREE -> WRITING (drawing thread) -> READY -> READING (GL thread) -> FREE.
+// The drawing thread may also steal a READY slot back when a newer frame supersedes it. Persistent
+// slots go through FENCED after READING, until the GPU is done reading from them.
+typedef enum {
+    AV_SLOT_FREE,
+    AV_SLOT_WRITING,
+    AV_SLOT_READY,
+    AV_SLOT_READING,
+    AV_SLOT_FENCED,
+    AV_SLOT_UNMAPPED,
+} av_slot_state_t;
+
+typedef struct {
+    _Atomic int state;
+    _Atomic uint64_t seq;       // Frame number, written before the slot is published.
+    av_rect_t damage;           // What this slot holds that the texture doesn't.
+    uint64_t published_us;
+    uint64_t upload_us;         // GL thread only.
+
+    unsigned pbo;
+    GLsync fence;
+    void *data;
+    cairo_surface_t *surface;   // Zero-copy only, aliases [data].
+    cairo_t *cairo;
+    int cairo_tier;             // Resolution tier [cairo] is set up for, -1 if none yet.
+
+    // Top-left part of the frame that was drawn into, smaller than the display when scaled.
+    unsigned render_width;
+    unsigned render_height;
+} av_slot_t;
+
+typedef struct av_capture_s av_capture_t;
+typedef struct av_vector_s av_vector_t;
+
+// Something a display's contents depend on: a scalar dataref or an app version counter.
+typedef struct {
+    const struct dref_t *dref;  // NULL for version counters.
+    const uint64_t *version;
+    double epsilon;
+    double last;                // Value at the last change that called for a redraw.
+    uint64_t last_version;
+} av_input_t;
+
 struct av_display_s {
     unsigned width, height;
+    unsigned stride;
+    unsigned flags;
     unsigned texture;
 
-    bool is_back_ready;
-    pthread_mutex_t mt;
-    unsigned front, back;
-    unsigned pbos[2];
-    void *current;
+    av_display_format_t format;
+    cairo_format_t cairo_format;
+    unsigned bpp;               // Bytes per pixel.
+    // Cairo draws in [cairo_format], which frames are converted from on their way to the slots.
+    unsigned surface_stride;
+    av_convert_op_t convert;
+    unsigned lut;               // INDEX8 palette texture.
+
+    unsigned slot_count;
+    av_slot_t slots[AV_DISPLAY_MAX_SLOTS];
+    bool is_persistent;
+    _Atomic bool is_starved;    // A zero-copy drawing thread found no free slot to draw into.
+    av_display_fence_stats_t fence_stats;
+    av_display_counters_t counters;
+    av_gpu_timer_t upload_timer;
+
+    // Tiled rasterization, drawing thread only.
+    unsigned band_count;
+    av_pool_t *pool;
+
+    // Drawing thread only.
+    uint64_t seq;
+    av_slot_t *writing;
+    av_rect_t damage;           // Accumulated since the last copy.
+    unsigned render_width;
+    unsigned render_height;
+    uint64_t frame_start_us;    // 0 until the frame's context is first requested.
     cairo_surface_t *surface;
     cairo_t *cairo;
-    
+
+    // Dynamic resolution, drawing thread only. The tier drops after a few frames over budget,
+    // and only climbs back after many frames comfortably under it.
+    uint64_t budget_us;
+    unsigned tier;
+    unsigned tier_count;
+    double draw_avg_us;
+    unsigned over_budget;
+    unsigned under_budget;
+    cairo_antialias_t antialias[AV_DISPLAY_SCALE_TIERS];
+    _Atomic double scale;
+
+    // Headless displays hand their frames to a callback instead of a texture.
+    av_display_backend_t backend;
+    av_display_consumer_f consumer;
+    void *consumer_data;
+
+    // Atlas displays draw into plain memory, and the atlas uploads them into its own texture.
+    av_atlas_t *atlas;
+    unsigned atlas_x, atlas_y;
+    size_t atlas_offset;        // Of the display's frames in the atlas transfer buffers.
+
+    // Size of the frame last uploaded to the texture, GL thread only.
+    unsigned texture_width;
+    unsigned texture_height;
+
+    // Layers are displays of their own, composited over this one when rendering.
+    unsigned layer_count;
+    av_display_t *layers[AV_DISPLAY_MAX_LAYERS - 1];
+    av_display_t *parent;
+    uint64_t interval_us;
+    uint64_t last_frame_us;
+
+    // Inputs whose changes call for a redraw. [inputs] belongs to the polling thread, which raises
+    // [is_dirty] for the drawing thread to clear. The drawing thread raises it again when it finds
+    // no slot for the frame it was asked to draw.
+    av_input_t *inputs;
+    unsigned input_count;
+    _Atomic bool has_inputs;
+    _Atomic bool is_dirty;
+    uint64_t refresh_us;        // Drawing thread only, like [last_redraw_us].
+    uint64_t last_redraw_us;
+
+    // Vector displays render recorded commands into their texture, and have no slots.
+    av_vector_t *vector;
+
+    // Capture of uploaded frames, if any. Upload thread only.
+    av_capture_t *capture;
+
     av_quad_t quad;
     // OpenGL renderer
 };
@@ -53,6 +306,10 @@ struct av_target_s {
     vec2_t size;
     vec2_t offset;
     float proj[16];
+    // Spans a whole run, from the first draw to the target to av_render_end().
+    av_gpu_timer_t timer;
+    unsigned long timed_run;
+    av_target_t *next_timed;    // In the list of targets timed in the current run.
 };
 
 static inline void check_gl(const char *where, int line) {
@@ -67,5 +324,46 @@ static inline void check_gl(const char *where, int line) {
 #define CHECK_GL()
 #endif
 
+void av_rect_copy(uint8_t *dst, const uint8_t *src, size_t stride, size_t bpp, av_rect_t rect);
+
+// Takes the newest finished frame for uploading, or returns NULL if there is none.
+av_slot_t *av_display_acquire_frame(av_display_t *display);
+
+// Hands a slot back to the drawing thread once its frame has been uploaded.
+void av_display_release_frame(av_display_t *display, av_slot_t *slot);
+
+// Queues a copy of [slot]'s frame for [capture]'s writer, or drops it if the queue is full.
+void av_capture_push(av_capture_t *capture, const av_display_t *display, const av_slot_t *slot);
+
+// Creates the framebuffer a vector display renders into. Returns NULL if it can't be.
+av_vector_t *av_vector_new(unsigned width, unsigned height);
+void av_vector_delete(av_vector_t *vector);
+unsigned av_vector_get_texture(const av_vector_t *vector);
+
+// Returns the canvas recording the frame being drawn, starting a new one if needed.
+av_canvas_t *av_vector_get_canvas(av_vector_t *vector);
+
+// Hands the recorded frame over to the GL thread. Returns true if it replaced one that wasn't
+// rendered yet.
+bool av_vector_finish(av_vector_t *vector);
+
+// Renders the newest recorded frame into the texture, timed with [timer]. Returns false if there
+// was none, without touching GL or the timer.
+bool av_vector_render(av_vector_t *vector, av_gpu_timer_t *timer, uint64_t *published_us);
+
+// Finds room for [display] in [atlas]. Returns false if it is full.
+bool av_atlas_add(av_atlas_t *atlas, av_display_t *display);
+void av_atlas_remove(av_atlas_t *atlas, av_display_t *display);
+unsigned av_atlas_get_texture(const av_atlas_t *atlas);
+
+// Returns the u0, v0, u1, v1 rectangle [display] occupies in [atlas].
+void av_atlas_get_uv(const av_atlas_t *atlas, const av_display_t *display, double uv[4]);
+
+// Creates a context to draw onto [surface], set up for the display's pixel format.
+cairo_t *av_display_create_cairo(const av_display_t *display, cairo_surface_t *surface);
+
 void av_quad_init(av_quad_t *r, unsigned texture, unsigned shader);
 void av_quad_deinit(av_quad_t *r);
+void av_quad_set_format(av_quad_t *r, av_display_format_t format, unsigned lut, const float tint[4]);
+void av_quad_set_layers(av_quad_t *r, const unsigned *textures, unsigned count);
+void av_quad_set_uv(av_quad_t *r, double u0, double v0, double u1, double v1);
@@ -1,10 +1,24 @@
 #include <libavionics/gl.h>
+#include "glstate.h"
+#include "hash.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include <libavionics/stb_image.h>
 #include <ccore/log.h>
 #include <ccore/filesystem.h>
 #include <ccore/memory.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#if IBM
+#include <direct.h>
+#define make_dir(path) _mkdir(path)
+#define is_separator(c) ((c) == '/' || (c) == '\\')
+#else
+#include <sys/stat.h>
+#define make_dir(path) mkdir(path, 0755)
+#define is_separator(c) ((c) == '/')
+#endif
 
 static bool check_shader(GLuint sh) {
     GLint is_compiled = 0;
@@ -36,29 +50,259 @@ static bool check_program(GLuint sh) {
     return false;
 }
 
-GLuint gl_create_program(const char *vertex, const char *fragment) {
-    CCASSERT(vertex);
-    CCASSERT(fragment);
+// Compiled programs are saved to the cache directory, named after a hash of their sources and of
+// the driver's strings, so a driver update never loads a stale binary. Files start with a header.
+#define CACHE_MAGIC (0x42505641)    // "AVPB"
+#define CACHE_VERSION (1)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t format;
+    uint32_t size;
+} cache_header_t;
+
+// Programs between gl_start_program() and gl_finish_program().
+typedef struct {
+    GLuint program;
+    uint64_t key;
+    const char *vertex;
+    const char *fragment;
+    bool is_binary;         // Loaded from the cache, so not compiled yet if the driver refuses it.
+} pending_t;
+
+static char cache_dir[1024] = {0};
+static bool has_driver_hash = false;
+static uint64_t driver_hash = 0;
+static bool has_parallel_compile = false;
+
+static pending_t *pending = NULL;
+static unsigned pending_count = 0;
+static unsigned pending_capacity = 0;
+
+// Strings are hashed with their terminator, so that "ab" + "c" and "a" + "bc" differ.
+static uint64_t hash_string(uint64_t hash, const char *str) {
+    if(!str) str = "";
+    return av_hash_bytes(hash, str, strlen(str) + 1);
+}
+
+// Creates [path] and any of its parents that don't exist yet.
+static bool make_dirs(const char *path) {
+    char partial[sizeof(cache_dir)];
+    snprintf(partial, sizeof(partial), "%s", path);
+    for(char *c = partial + 1; *c; ++c) {
+        if(!is_separator(*c)) continue;
+        char separator = *c;
+        *c = '\0';
+        if(make_dir(partial) != 0 && errno != EEXIST) return false;
+        *c = separator;
+    }
+    return make_dir(partial) == 0 || errno == EEXIST;
+}
+
+static bool is_cache_enabled() {
+    if(!cache_dir[0] || !GLAD_GL_ARB_get_program_binary) return false;
+    if(!glProgramBinary || !glGetProgramBinary || !glProgramParameteri) return false;
+    GLint format_count = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &format_count);
+    return format_count > 0;
+}
 
-    GLuint vert = gl_load_shader(vertex, GL_VERTEX_SHADER);
-    if(!vert) return 0;
+static uint64_t get_key(const char *vertex, const char *fragment) {
+    if(!has_driver_hash) {
+        driver_hash = AV_HASH_SEED;
+        driver_hash = hash_string(driver_hash, (const char *)glGetString(GL_VENDOR));
+        driver_hash = hash_string(driver_hash, (const char *)glGetString(GL_RENDERER));
+        driver_hash = hash_string(driver_hash, (const char *)glGetString(GL_VERSION));
+        driver_hash = hash_string(driver_hash, (const char *)glGetString(GL_SHADING_LANGUAGE_VERSION));
+        has_driver_hash = true;
+    }
+    uint64_t key = hash_string(driver_hash, vertex);
+    return hash_string(key, fragment);
+}
+
+static void get_cache_path(uint64_t key, char *out, size_t max) {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+    ccfs_path_concat(out, max, cache_dir, name, NULL);
+}
+
+static bool load_binary(GLuint program, uint64_t key) {
+    char path[1024];
+    get_cache_path(key, path, sizeof(path));
+    FILE *file = fopen(path, "rb");
+    if(!file) return false;
+
+    cache_header_t header;
+    void *data = NULL;
+    bool is_valid = fread(&header, sizeof(header), 1, file) == 1
+        && header.magic == CACHE_MAGIC
+        && header.version == CACHE_VERSION
+        && header.key == key
+        && header.size;
+    if(is_valid) {
+        data = cc_alloc(header.size);
+        is_valid = fread(data, 1, header.size, file) == header.size;
+    }
+    fclose(file);
+    if(is_valid) glProgramBinary(program, header.format, data, header.size);
+    if(data) cc_free(data);
+    return is_valid;
+}
+
+// Written to a temporary file first, so that a crash never leaves half a binary behind.
+static void save_binary(GLuint program, uint64_t key) {
+    GLint size = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+    if(size <= 0) return;
 
-    GLuint frag = gl_load_shader(fragment, GL_FRAGMENT_SHADER);
-    if(!frag) return 0;
+    cache_header_t header = {.magic = CACHE_MAGIC, .version = CACHE_VERSION, .key = key};
+    void *data = cc_alloc(size);
+    GLsizei length = 0;
+    GLenum format = 0;
+    glGetProgramBinary(program, size, &length, &format, data);
+    header.format = format;
+    header.size = length;
+
+    char path[1024];
+    char temp_path[1040];
+    get_cache_path(key, path, sizeof(path));
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    if(!make_dirs(cache_dir)) {
+        CCERROR("unable to create program cache directory `%s`", cache_dir);
+        cc_free(data);
+        return;
+    }
+    FILE *file = fopen(temp_path, "wb");
+    bool is_written = file
+        && length > 0
+        && fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(data, 1, length, file) == (size_t)length;
+    if(file) is_written = fclose(file) == 0 && is_written;
+    cc_free(data);
+
+#if IBM
+    if(is_written) remove(path);
+#endif
+    if(!is_written || rename(temp_path, path) != 0) {
+        CCERROR("unable to write program cache `%s`", path);
+        remove(temp_path);
+    }
+}
 
-    GLuint prog = glCreateProgram();
-    glAttachShader(prog, vert);
-    glAttachShader(prog, frag);
-    glLinkProgram(prog);
+// Compiles and links without checking, which would wait for the driver.
+static void compile_program(GLuint program, const char *vertex, const char *fragment, bool is_retrievable) {
+    GLuint vert = glCreateShader(GL_VERTEX_SHADER);
+    GLuint frag = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(vert, 1, &vertex, NULL);
+    glShaderSource(frag, 1, &fragment, NULL);
+    glCompileShader(vert);
+    glCompileShader(frag);
+    glAttachShader(program, vert);
+    glAttachShader(program, frag);
+    if(is_retrievable) glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(program);
 
+    // Attached shaders are only flagged, and live on for check_link() to read their logs.
     glDeleteShader(vert);
     glDeleteShader(frag);
+}
+
+static bool check_link(GLuint program) {
+    GLint is_linked = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &is_linked);
+    if(is_linked == GL_TRUE) return true;
+
+    GLuint shaders[2];
+    GLsizei count = 0;
+    glGetAttachedShaders(program, 2, &count, shaders);
+    for(GLsizei i = 0; i < count; ++i) {
+        check_shader(shaders[i]);
+    }
+    return check_program(program);
+}
+
+void gl_set_program_cache(const char *directory) {
+    if(!directory) {
+        cache_dir[0] = '\0';
+        return;
+    }
+    snprintf(cache_dir, sizeof(cache_dir), "%s", directory);
+}
+
+GLuint gl_start_program(const char *vertex, const char *fragment) {
+    CCASSERT(vertex);
+    CCASSERT(fragment);
+    if(GLAD_GL_KHR_parallel_shader_compile && glMaxShaderCompilerThreadsKHR && !has_parallel_compile) {
+        glMaxShaderCompilerThreadsKHR(0xffffffff);
+        has_parallel_compile = true;
+    }
+
+    if(pending_count == pending_capacity) {
+        pending_capacity = pending_capacity ? pending_capacity * 2 : 16;
+        pending = cc_realloc(pending, pending_capacity * sizeof(pending_t));
+    }
+    pending_t *job = &pending[pending_count++];
+    job->program = glCreateProgram();
+    job->key = 0;
+    job->vertex = vertex;
+    job->fragment = fragment;
+    job->is_binary = false;
 
-    if(!check_program(prog)) {
-        glDeleteProgram(prog);
+    bool is_cached = is_cache_enabled();
+    if(is_cached) {
+        job->key = get_key(vertex, fragment);
+        job->is_binary = load_binary(job->program, job->key);
+    }
+    if(!job->is_binary) compile_program(job->program, vertex, fragment, is_cached);
+    return job->program;
+}
+
+// Takes [program] off the pending list. Returns false if it wasn't on it.
+static bool take_pending(GLuint program, pending_t *job) {
+    for(unsigned i = 0; i < pending_count; ++i) {
+        if(pending[i].program != program) continue;
+        *job = pending[i];
+        pending[i] = pending[--pending_count];
+        if(!pending_count) {
+            cc_free(pending);
+            pending = NULL;
+            pending_capacity = 0;
+        }
+        return true;
+    }
+    return false;
+}
+
+void gl_cancel_program(GLuint program) {
+    pending_t job;
+    take_pending(program, &job);
+}
+
+GLuint gl_finish_program(GLuint program) {
+    if(!program) return 0;
+    pending_t job = {.program = program};
+    take_pending(program, &job);
+
+    // Drivers may still turn a binary down, after an update that kept the same strings.
+    if(job.is_binary) {
+        GLint is_linked = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &is_linked);
+        if(is_linked == GL_TRUE) return program;
+        CCINFO("cached program %016llx was rejected, compiling it", (unsigned long long)job.key);
+        compile_program(program, job.vertex, job.fragment, true);
+    }
+    if(!check_link(program)) {
+        glDeleteProgram(program);
         return 0;
     }
-    return prog;
+    if(job.key) save_binary(program, job.key);
+    return program;
+}
+
+GLuint gl_create_program(const char *vertex, const char *fragment) {
+    return gl_finish_program(gl_start_program(vertex, fragment));
 }
 
 GLuint gl_load_shader(const char *source, int type) {
@@ -91,7 +335,7 @@ GLuint gl_load_tex(const char *path, int *w, int *h) {
 
     GLuint tex = 0;
     glGenTextures(1, &tex);
-    glBindTexture(GL_TEXTURE_2D, tex);
+    av_gl_bind_texture(0, tex);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, *w, *h, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
     free(data);
 
@@ -0,0 +1,283 @@
+//===--------------------------------------------------------------------------------------------===
+// glstate.c - Shadow of the GL bindings libavionics uses, to skip redundant state changes
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2021 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "glstate.h"
+#include <libavionics/renderer.h>
+#include <ccore/log.h>
+
+// Bindings we can't vouch for, because someone else may have changed them.
+#define UNKNOWN (~0u)
+
+typedef enum {
+    BUFFER_ARRAY,
+    BUFFER_ELEMENT_ARRAY,
+    BUFFER_PIXEL_UNPACK,
+    BUFFER_COUNT,
+} buffer_slot_t;
+
+typedef enum {
+    ATTRIB_DISABLED,
+    ATTRIB_ENABLED,
+    ATTRIB_UNKNOWN,
+} attrib_state_t;
+
+typedef struct {
+    unsigned element_buffer;
+    attrib_state_t attribs[AV_GL_ATTRIBS];
+} array_state_t;
+
+static struct {
+    unsigned vertex_array;
+    // What we knew of the default vertex array, while another one is bound.
+    bool has_default_array;
+    array_state_t default_array;
+    unsigned program;
+    unsigned active_unit;
+    unsigned textures[AV_GL_TEXTURE_UNITS];
+    unsigned buffers[BUFFER_COUNT];
+    attrib_state_t attribs[AV_GL_ATTRIBS];
+    unsigned brackets;          // av_gl_begin() calls not matched by av_gl_end() yet.
+    unsigned long runs;
+    av_render_state_stats_t stats;
+} state = {
+    .vertex_array = UNKNOWN,
+    .has_default_array = false,
+    .program = UNKNOWN,
+    .active_unit = UNKNOWN,
+    .textures = {UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN},
+    .buffers = {UNKNOWN, UNKNOWN, UNKNOWN},
+    .attribs = {
+        ATTRIB_UNKNOWN, ATTRIB_UNKNOWN, ATTRIB_UNKNOWN, ATTRIB_UNKNOWN,
+        ATTRIB_UNKNOWN, ATTRIB_UNKNOWN, ATTRIB_UNKNOWN, ATTRIB_UNKNOWN,
+        ATTRIB_UNKNOWN, ATTRIB_UNKNOWN, ATTRIB_UNKNOWN, ATTRIB_UNKNOWN,
+        ATTRIB_UNKNOWN, ATTRIB_UNKNOWN, ATTRIB_UNKNOWN, ATTRIB_UNKNOWN,
+    },
+    .brackets = 0,
+    .runs = 0,
+    .stats = {0, 0},
+};
+
+// Counts the call, and returns whether it has to go to GL.
+static inline bool is_needed(unsigned current, unsigned wanted) {
+    if(state.brackets && current == wanted) {
+        state.stats.elided += 1;
+        return false;
+    }
+    state.stats.issued += 1;
+    return true;
+}
+
+static buffer_slot_t buffer_slot(GLenum target) {
+    switch(target) {
+    case GL_ARRAY_BUFFER: return BUFFER_ARRAY;
+    case GL_ELEMENT_ARRAY_BUFFER: return BUFFER_ELEMENT_ARRAY;
+    case GL_PIXEL_UNPACK_BUFFER: return BUFFER_PIXEL_UNPACK;
+    default: return BUFFER_COUNT;
+    }
+}
+
+void av_gl_use_program(unsigned program) {
+    if(!is_needed(state.program, program)) return;
+    glUseProgram(program);
+    state.program = program;
+}
+
+void av_gl_active_texture(unsigned unit) {
+    if(!is_needed(state.active_unit, unit)) return;
+    glActiveTexture(GL_TEXTURE0 + unit);
+    state.active_unit = unit;
+}
+
+void av_gl_bind_texture(unsigned unit, unsigned texture) {
+    if(unit >= AV_GL_TEXTURE_UNITS) {
+        av_gl_active_texture(unit);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        return;
+    }
+    // Texture calls that follow act on the active unit, so it has to be right either way.
+    av_gl_active_texture(unit);
+    if(!is_needed(state.textures[unit], texture)) return;
+    glBindTexture(GL_TEXTURE_2D, texture);
+    state.textures[unit] = texture;
+}
+
+void av_gl_bind_buffer(GLenum target, unsigned buffer) {
+    buffer_slot_t slot = buffer_slot(target);
+    if(slot == BUFFER_COUNT) {
+        glBindBuffer(target, buffer);
+        return;
+    }
+    if(!is_needed(state.buffers[slot], buffer)) return;
+    glBindBuffer(target, buffer);
+    state.buffers[slot] = buffer;
+}
+
+void av_gl_enable_attrib(int index) {
+    if(index < 0) return;
+    if(index >= AV_GL_ATTRIBS) {
+        glEnableVertexAttribArray(index);
+        return;
+    }
+    if(!is_needed(state.attribs[index], ATTRIB_ENABLED)) return;
+    glEnableVertexAttribArray(index);
+    state.attribs[index] = ATTRIB_ENABLED;
+}
+
+void av_gl_disable_attrib(int index) {
+    if(index < 0) return;
+    if(index >= AV_GL_ATTRIBS) {
+        glDisableVertexAttribArray(index);
+        return;
+    }
+    if(!is_needed(state.attribs[index], ATTRIB_DISABLED)) return;
+    glDisableVertexAttribArray(index);
+    state.attribs[index] = ATTRIB_DISABLED;
+}
+
+void av_gl_use_attribs(uint32_t mask) {
+    for(unsigned i = 0; i < AV_GL_ATTRIBS; ++i) {
+        if(mask & (1u << i)) {
+            av_gl_enable_attrib(i);
+        } else if(state.attribs[i] == ATTRIB_ENABLED) {
+            av_gl_disable_attrib(i);
+        }
+    }
+}
+
+static void forget_array_state() {
+    state.buffers[BUFFER_ELEMENT_ARRAY] = UNKNOWN;
+    for(unsigned i = 0; i < AV_GL_ATTRIBS; ++i) {
+        state.attribs[i] = ATTRIB_UNKNOWN;
+    }
+}
+
+// Switching vertex arrays swaps out the element buffer binding and the enabled attributes.
+static void switch_vertex_array(unsigned array) {
+    if(state.vertex_array == 0) {
+        state.has_default_array = true;
+        state.default_array.element_buffer = state.buffers[BUFFER_ELEMENT_ARRAY];
+        for(unsigned i = 0; i < AV_GL_ATTRIBS; ++i) {
+            state.default_array.attribs[i] = state.attribs[i];
+        }
+    }
+    forget_array_state();
+    if(array == 0 && state.has_default_array) {
+        state.buffers[BUFFER_ELEMENT_ARRAY] = state.default_array.element_buffer;
+        for(unsigned i = 0; i < AV_GL_ATTRIBS; ++i) {
+            state.attribs[i] = state.default_array.attribs[i];
+        }
+    }
+    state.vertex_array = array;
+}
+
+void av_gl_bind_vertex_array(unsigned array) {
+    if(!is_needed(state.vertex_array, array)) return;
+    glBindVertexArray(array);
+    switch_vertex_array(array);
+}
+
+void av_gl_delete_textures(unsigned count, const unsigned *textures) {
+    glDeleteTextures(count, textures);
+    for(unsigned i = 0; i < count; ++i) {
+        for(unsigned unit = 0; unit < AV_GL_TEXTURE_UNITS; ++unit) {
+            if(state.textures[unit] == textures[i]) state.textures[unit] = 0;
+        }
+    }
+}
+
+void av_gl_delete_buffers(unsigned count, const unsigned *buffers) {
+    glDeleteBuffers(count, buffers);
+    for(unsigned i = 0; i < count; ++i) {
+        for(unsigned slot = 0; slot < BUFFER_COUNT; ++slot) {
+            if(state.buffers[slot] == buffers[i]) state.buffers[slot] = 0;
+        }
+    }
+}
+
+// The name of a program deleted while in use can be handed out again, and binding the new one
+// must not be skipped.
+void av_gl_delete_program(unsigned program) {
+    gl_cancel_program(program);
+    glDeleteProgram(program);
+    if(state.program == program) state.program = UNKNOWN;
+}
+
+void av_gl_delete_vertex_arrays(unsigned count, const unsigned *arrays) {
+    glDeleteVertexArrays(count, arrays);
+    for(unsigned i = 0; i < count; ++i) {
+        if(state.vertex_array == arrays[i]) switch_vertex_array(0);
+    }
+}
+
+// Vertex arrays are only reset if we bound one: others may be the host's.
+static void restore_defaults() {
+    if(state.vertex_array != 0 && state.vertex_array != UNKNOWN) av_gl_bind_vertex_array(0);
+    for(unsigned i = 0; i < AV_GL_ATTRIBS; ++i) {
+        if(state.attribs[i] == ATTRIB_ENABLED) av_gl_disable_attrib(i);
+    }
+    av_gl_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    av_gl_bind_buffer(GL_ARRAY_BUFFER, 0);
+    for(unsigned i = AV_GL_TEXTURE_UNITS; i > 1; --i) {
+        if(state.textures[i - 1] != 0 && state.textures[i - 1] != UNKNOWN) av_gl_bind_texture(i - 1, 0);
+    }
+    av_gl_bind_texture(0, 0);
+    av_gl_use_program(0);
+}
+
+void av_render_invalidate_state() {
+    state.vertex_array = UNKNOWN;
+    state.has_default_array = false;
+    state.program = UNKNOWN;
+    state.active_unit = UNKNOWN;
+    for(unsigned i = 0; i < AV_GL_TEXTURE_UNITS; ++i) {
+        state.textures[i] = UNKNOWN;
+    }
+    for(unsigned i = 0; i < BUFFER_COUNT; ++i) {
+        state.buffers[i] = UNKNOWN;
+    }
+    for(unsigned i = 0; i < AV_GL_ATTRIBS; ++i) {
+        state.attribs[i] = ATTRIB_UNKNOWN;
+    }
+}
+
+void av_gl_begin() {
+    if(state.brackets++) return;
+    state.runs += 1;
+    av_render_invalidate_state();
+}
+
+void av_gl_end() {
+    CCASSERT(state.brackets);
+    if(state.brackets == 1) {
+        av_render_end_timers();
+        restore_defaults();
+    }
+    state.brackets -= 1;
+}
+
+unsigned long av_gl_get_run() {
+    return state.runs;
+}
+
+void av_render_begin() {
+    av_gl_begin();
+}
+
+void av_render_end() {
+    av_gl_end();
+}
+
+void av_render_get_state_stats(av_render_state_stats_t *stats) {
+    CCASSERT(stats);
+    *stats = state.stats;
+}
+
+void av_render_reset_state_stats() {
+    state.stats.issued = 0;
+    state.stats.elided = 0;
+}
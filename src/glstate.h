@@ -0,0 +1,48 @@
+//===--------------------------------------------------------------------------------------------===
+// glstate.h - Shadow of the GL bindings libavionics uses, to skip redundant state changes
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2021 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#pragma once
+#include <libavionics/gl.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Texture units and vertex attributes the shadow covers. Others go straight to GL, uncached.
+#define AV_GL_TEXTURE_UNITS (8)
+#define AV_GL_ATTRIBS (16)
+
+// Between av_gl_begin() and av_gl_end(), these skip the GL call when the binding is known to be
+// what is asked for already. Outside, other code may have changed anything, and every call goes
+// through. GL thread only. Texture bindings are GL_TEXTURE_2D ones.
+void av_gl_use_program(unsigned program);
+void av_gl_active_texture(unsigned unit);
+void av_gl_bind_texture(unsigned unit, unsigned texture);
+void av_gl_bind_buffer(GLenum target, unsigned buffer);
+void av_gl_enable_attrib(int index);
+void av_gl_disable_attrib(int index);
+// Enables exactly the attributes in [mask], one bit per index.
+void av_gl_use_attribs(uint32_t mask);
+// The element buffer and attributes are shadowed for the default vertex array only. Those of
+// other vertex arrays are set up once, and treated as unknown while they are bound.
+void av_gl_bind_vertex_array(unsigned array);
+
+// GL unbinds deleted textures and buffers itself, but a deleted program stays in use.
+void av_gl_delete_textures(unsigned count, const unsigned *textures);
+void av_gl_delete_buffers(unsigned count, const unsigned *buffers);
+void av_gl_delete_program(unsigned program);
+void av_gl_delete_vertex_arrays(unsigned count, const unsigned *arrays);
+
+// Brackets a run of GL work, with av_render_begin() and av_render_end() as the outermost ones.
+// The outermost begin forgets the known state, the outermost end puts bindings back to 0.
+void av_gl_begin();
+void av_gl_end();
+
+// Counts outermost brackets, so that work can be done once per run. 0 before the first one.
+unsigned long av_gl_get_run();
+
+// Ends the GPU timers the renderer opened during the run. Called by the outermost av_gl_end().
+void av_render_end_timers();
@@ -0,0 +1,100 @@
+//===--------------------------------------------------------------------------------------------===
+// gputimer.c - GPU timing of libavionics' GL work through timer queries
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2021 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "display.h"
+#include <ccore/log.h>
+
+#define RELAXED memory_order_relaxed
+
+static _Atomic bool is_enabled = false;
+
+void av_render_set_gpu_timing(bool enabled) {
+    if(enabled && !(GLAD_GL_ARB_timer_query && glQueryCounter && glGetQueryObjectui64v)) {
+        CCINFO("no timer queries, GPU timing stays off");
+        return;
+    }
+    atomic_store_explicit(&is_enabled, enabled, RELAXED);
+}
+
+void av_gpu_timer_init(av_gpu_timer_t *timer) {
+    CCASSERT(timer);
+    for(unsigned i = 0; i < AV_GPU_TIMER_DEPTH * 2; ++i) {
+        timer->queries[i] = 0;
+    }
+    timer->head = 0;
+    timer->pending = 0;
+    timer->is_open = false;
+    av_gpu_timer_reset(timer);
+}
+
+void av_gpu_timer_deinit(av_gpu_timer_t *timer) {
+    CCASSERT(timer);
+    if(timer->queries[0]) glDeleteQueries(AV_GPU_TIMER_DEPTH * 2, timer->queries);
+    timer->queries[0] = 0;
+}
+
+void av_gpu_timer_reset(av_gpu_timer_t *timer) {
+    CCASSERT(timer);
+    atomic_store_explicit(&timer->skipped, 0, RELAXED);
+    atomic_store_explicit(&timer->total_ns, 0, RELAXED);
+    av_histogram_reset(&timer->histogram);
+}
+
+// Reads back pairs oldest first, stopping at the first one the GPU isn't done with. The end
+// query is always the last to finish, so its result being there means the pair is complete.
+static void collect(av_gpu_timer_t *timer) {
+    while(timer->pending) {
+        unsigned pair = (timer->head + AV_GPU_TIMER_DEPTH - timer->pending) % AV_GPU_TIMER_DEPTH;
+        GLuint is_available = GL_FALSE;
+        glGetQueryObjectuiv(timer->queries[pair * 2 + 1], GL_QUERY_RESULT_AVAILABLE, &is_available);
+        if(!is_available) break;
+
+        GLuint64 start = 0, end = 0;
+        glGetQueryObjectui64v(timer->queries[pair * 2], GL_QUERY_RESULT, &start);
+        glGetQueryObjectui64v(timer->queries[pair * 2 + 1], GL_QUERY_RESULT, &end);
+        uint64_t elapsed = end > start ? end - start : 0;
+        av_histogram_record(&timer->histogram, elapsed);
+        atomic_fetch_add_explicit(&timer->total_ns, elapsed, RELAXED);
+        timer->pending -= 1;
+    }
+}
+
+void av_gpu_timer_begin(av_gpu_timer_t *timer) {
+    CCASSERT(timer);
+    CCASSERT(!timer->is_open);
+    if(!atomic_load_explicit(&is_enabled, RELAXED)) return;
+    if(!timer->queries[0]) glGenQueries(AV_GPU_TIMER_DEPTH * 2, timer->queries);
+
+    collect(timer);
+    if(timer->pending == AV_GPU_TIMER_DEPTH) {
+        atomic_fetch_add_explicit(&timer->skipped, 1, RELAXED);
+        return;
+    }
+    glQueryCounter(timer->queries[timer->head * 2], GL_TIMESTAMP);
+    timer->is_open = true;
+    CHECK_GL();
+}
+
+void av_gpu_timer_end(av_gpu_timer_t *timer) {
+    CCASSERT(timer);
+    if(!timer->is_open) return;
+    glQueryCounter(timer->queries[timer->head * 2 + 1], GL_TIMESTAMP);
+    timer->head = (timer->head + 1) % AV_GPU_TIMER_DEPTH;
+    timer->pending += 1;
+    timer->is_open = false;
+    CHECK_GL();
+}
+
+void av_gpu_timer_query(const av_gpu_timer_t *timer, av_gpu_timing_t *timing) {
+    CCASSERT(timer);
+    CCASSERT(timing);
+    timing->is_available = atomic_load_explicit(&is_enabled, RELAXED);
+    timing->skipped = atomic_load_explicit(&timer->skipped, RELAXED);
+    timing->total = (double)atomic_load_explicit(&timer->total_ns, RELAXED) * 1e-6;
+    av_histogram_query(&timer->histogram, 1e-6, &timing->timing);
+}
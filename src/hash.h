@@ -0,0 +1,23 @@
+//===--------------------------------------------------------------------------------------------===
+// hash.h - FNV-1a hashing for cache keys
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2021 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/// Hash every call to av_hash_bytes() starts from.
+#define AV_HASH_SEED (14695981039346656037llu)
+
+/// Returns [hash] updated with [size] bytes at [data]. Not suited to anything adversarial.
+static inline uint64_t av_hash_bytes(uint64_t hash, const void *data, size_t size) {
+    const uint8_t *bytes = data;
+    for(size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211llu;
+    }
+    return hash;
+}
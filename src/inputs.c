@@ -0,0 +1,92 @@
+//===--------------------------------------------------------------------------------------------===
+// inputs.c - Input tracking, so displays are only redrawn when what they show changes
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2021 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "display.h"
+#include "timing.h"
+#include <libavionics/xplane.h>
+#include <ccore/log.h>
+#include <ccore/memory.h>
+#include <math.h>
+
+static av_input_t *add_input(av_display_t *display) {
+    display->inputs = cc_realloc(display->inputs, (display->input_count + 1) * sizeof(av_input_t));
+    av_input_t *input = &display->inputs[display->input_count++];
+    input->dref = NULL;
+    input->version = NULL;
+    input->epsilon = 0;
+    input->last = 0;
+    input->last_version = 0;
+    // The display was drawn without knowing about this input yet.
+    atomic_store(&display->is_dirty, true);
+    atomic_store(&display->has_inputs, true);
+    return input;
+}
+
+void av_display_watch_dref(av_display_t *display, const dref_t *dref, double epsilon) {
+    CCASSERT(display);
+    CCASSERT(dref);
+    CCASSERT(dref->dref);
+    CCASSERT(dref->type & (xplmType_Int | xplmType_Float | xplmType_Double));
+    CCASSERT(epsilon >= 0);
+    av_input_t *input = add_input(display);
+    input->dref = dref;
+    input->epsilon = epsilon;
+    input->last = dref_get_f64(dref);
+}
+
+void av_display_watch_version(av_display_t *display, const uint64_t *version) {
+    CCASSERT(display);
+    CCASSERT(version);
+    av_input_t *input = add_input(display);
+    input->version = version;
+    input->last_version = *version;
+}
+
+void av_display_set_refresh_interval(av_display_t *display, double interval) {
+    CCASSERT(display);
+    CCASSERT(interval >= 0);
+    display->refresh_us = (uint64_t)(interval * 1e6);
+}
+
+// Each input is compared with its value at the last change, not the last poll, so that slow
+// drift still adds up to a redraw. Every input is sampled even once one has changed, for their
+// reference values to all be those of the frame that gets drawn.
+void av_display_poll_inputs(av_display_t *display) {
+    CCASSERT(display);
+    bool is_changed = false;
+    for(unsigned i = 0; i < display->input_count; ++i) {
+        av_input_t *input = &display->inputs[i];
+        if(input->version) {
+            uint64_t version = *input->version;
+            if(version == input->last_version) continue;
+            input->last_version = version;
+            is_changed = true;
+        } else {
+            double value = dref_get_f64(input->dref);
+            // Comparisons with NaN are false, so a NaN dataref redraws every frame.
+            if(fabs(value - input->last) <= input->epsilon) continue;
+            input->last = value;
+            is_changed = true;
+        }
+    }
+    if(is_changed) atomic_store(&display->is_dirty, true);
+}
+
+bool av_display_needs_redraw(av_display_t *display) {
+    CCASSERT(display);
+    if(!atomic_load_explicit(&display->has_inputs, memory_order_relaxed)) return true;
+
+    uint64_t now = av_time_us();
+    bool is_due = display->refresh_us && now - display->last_redraw_us >= display->refresh_us;
+    if(!atomic_exchange(&display->is_dirty, false) && !is_due) {
+        atomic_fetch_add_explicit(&display->counters.skipped, 1, memory_order_relaxed);
+        return false;
+    }
+    display->last_redraw_us = now;
+    return true;
+}
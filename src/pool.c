@@ -0,0 +1,129 @@
+//===--------------------------------------------------------------------------------------------===
+// pool.c - Minimal worker pool for the display internals
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2021 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "pool.h"
+#include <ccore/log.h>
+#include <ccore/memory.h>
+#include <pthread.h>
+#include <stdbool.h>
+
+typedef struct {
+    av_job_f job;
+    void *data;
+} job_t;
+
+struct av_pool_s {
+    unsigned thread_count;
+    pthread_t *threads;
+
+    // Jobs are kept in a growable ring buffer.
+    job_t *jobs;
+    unsigned capacity;
+    unsigned head;
+    unsigned count;
+    unsigned running;
+    bool stop;
+
+    pthread_mutex_t mt;
+    pthread_cond_t has_job;
+    pthread_cond_t is_idle;
+};
+
+static void *worker_thread(void *refcon) {
+    av_pool_t *pool = refcon;
+    pthread_mutex_lock(&pool->mt);
+    for(;;) {
+        while(!pool->count && !pool->stop) pthread_cond_wait(&pool->has_job, &pool->mt);
+        if(!pool->count && pool->stop) break;
+
+        job_t job = pool->jobs[pool->head];
+        pool->head = (pool->head + 1) % pool->capacity;
+        pool->count -= 1;
+        pool->running += 1;
+        pthread_mutex_unlock(&pool->mt);
+
+        job.job(job.data);
+
+        pthread_mutex_lock(&pool->mt);
+        pool->running -= 1;
+        if(!pool->count && !pool->running) pthread_cond_broadcast(&pool->is_idle);
+    }
+    pthread_mutex_unlock(&pool->mt);
+    return NULL;
+}
+
+av_pool_t *av_pool_new(unsigned threads) {
+    CCASSERT(threads > 0);
+    av_pool_t *pool = cc_alloc(sizeof(av_pool_t));
+    pool->thread_count = threads;
+    pool->capacity = 16;
+    pool->jobs = cc_alloc(pool->capacity * sizeof(job_t));
+    pool->head = 0;
+    pool->count = 0;
+    pool->running = 0;
+    pool->stop = false;
+
+    pthread_mutex_init(&pool->mt, NULL);
+    pthread_cond_init(&pool->has_job, NULL);
+    pthread_cond_init(&pool->is_idle, NULL);
+
+    pool->threads = cc_alloc(threads * sizeof(pthread_t));
+    for(unsigned i = 0; i < threads; ++i) {
+        pthread_create(&pool->threads[i], NULL, worker_thread, pool);
+    }
+    return pool;
+}
+
+void av_pool_delete(av_pool_t *pool) {
+    CCASSERT(pool);
+    pthread_mutex_lock(&pool->mt);
+    pool->stop = true;
+    pthread_mutex_unlock(&pool->mt);
+    pthread_cond_broadcast(&pool->has_job);
+
+    for(unsigned i = 0; i < pool->thread_count; ++i) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_cond_destroy(&pool->is_idle);
+    pthread_cond_destroy(&pool->has_job);
+    pthread_mutex_destroy(&pool->mt);
+    cc_free(pool->threads);
+    cc_free(pool->jobs);
+    cc_free(pool);
+}
+
+static void grow_queue(av_pool_t *pool) {
+    unsigned capacity = pool->capacity * 2;
+    job_t *jobs = cc_alloc(capacity * sizeof(job_t));
+    for(unsigned i = 0; i < pool->count; ++i) {
+        jobs[i] = pool->jobs[(pool->head + i) % pool->capacity];
+    }
+    cc_free(pool->jobs);
+    pool->jobs = jobs;
+    pool->capacity = capacity;
+    pool->head = 0;
+}
+
+void av_pool_submit(av_pool_t *pool, av_job_f job, void *data) {
+    CCASSERT(pool);
+    CCASSERT(job);
+    pthread_mutex_lock(&pool->mt);
+    CCASSERT(!pool->stop);
+    if(pool->count == pool->capacity) grow_queue(pool);
+    pool->jobs[(pool->head + pool->count) % pool->capacity] = (job_t){job, data};
+    pool->count += 1;
+    pthread_mutex_unlock(&pool->mt);
+    pthread_cond_signal(&pool->has_job);
+}
+
+void av_pool_wait(av_pool_t *pool) {
+    CCASSERT(pool);
+    pthread_mutex_lock(&pool->mt);
+    while(pool->count || pool->running) pthread_cond_wait(&pool->is_idle, &pool->mt);
+    pthread_mutex_unlock(&pool->mt);
+}
@@ -0,0 +1,24 @@
+//===--------------------------------------------------------------------------------------------===
+// pool.h - Minimal worker pool for the display internals
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2021 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#pragma once
+
+typedef struct av_pool_s av_pool_t;
+typedef void (*av_job_f)(void *data);
+
+/// Starts a pool of [threads] workers.
+av_pool_t *av_pool_new(unsigned threads);
+
+/// Waits for queued jobs to complete, then stops and deletes [pool].
+void av_pool_delete(av_pool_t *pool);
+
+/// Queues [job] to run on one of the pool's workers.
+void av_pool_submit(av_pool_t *pool, av_job_f job, void *data);
+
+/// Waits until every job submitted so far has completed.
+void av_pool_wait(av_pool_t *pool);
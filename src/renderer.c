@@ -9,48 +9,359 @@
 #include "display.h"
 #include <ccore/math.h>
 #include <ccore/memory.h>
+#include <math.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 
 static const char *vert_shader =
     "#version 120\n"
     "uniform mat4   pvm;\n"
     "attribute vec2 vtx_pos;\n"
     "attribute vec2 vtx_tex0;\n"
+    "attribute float vtx_alpha;\n"
     "varying vec2   tex_coord;\n"
+    "varying float  quad_alpha;\n"
     "void main() {\n"
     "    tex_coord = vtx_tex0;\n"
+    "    quad_alpha = vtx_alpha;\n"
     "    gl_Position = pvm * vec4(vtx_pos, 0.0, 1.0);\n"
     // "    gl_Position = vec4(vtx_pos, 0.0, 1.0);\n"
     "}\n";
 
+// Instances are a rectangle, a UV rectangle, and their alpha and rotation, spread over the corners
+// of a unit quad. write_vertices() does the same on the CPU.
+static const char *instanced_vert_shader =
+    "#version 120\n"
+    "uniform mat4   pvm;\n"
+    "attribute vec2 vtx_corner;\n"
+    "attribute vec4 inst_rect;\n"
+    "attribute vec4 inst_uv;\n"
+    "attribute vec2 inst_params;\n"
+    "varying vec2   tex_coord;\n"
+    "varying float  quad_alpha;\n"
+    "void main() {\n"
+    "    vec2 half_size = inst_rect.zw * 0.5;\n"
+    "    vec2 offset = (vtx_corner * 2.0 - 1.0) * half_size;\n"
+    "    float c = cos(inst_params.y);\n"
+    "    float s = sin(inst_params.y);\n"
+    "    vec2 pos = inst_rect.xy + half_size + vec2(c * offset.x - s * offset.y, s * offset.x + c * offset.y);\n"
+    "    tex_coord = mix(inst_uv.xy, inst_uv.zw, vtx_corner);\n"
+    "    quad_alpha = inst_params.x;\n"
+    "    gl_Position = pvm * vec4(pos, 0.0, 1.0);\n"
+    "}\n";
+
 static const char *frag_shader =
     "#version 120\n"
     "uniform sampler2D	tex;\n"
     "uniform float	alpha;\n"
     "varying vec2	tex_coord;\n"
+    "varying float	quad_alpha;\n"
+    "void main() {\n"
+    "    vec4 color = texture2D(tex, tex_coord);\n"
+    "    color.a *= alpha * quad_alpha;\n"
+    "    gl_FragColor = color;\n"
+    "}\n";
+
+// Cairo layers are premultiplied, so they stack with a premultiplied "over".
+static const char *layer_frag_shader =
+    "#version 120\n"
+    "uniform sampler2D	tex;\n"
+    "uniform sampler2D	tex1;\n"
+    "uniform sampler2D	tex2;\n"
+    "uniform sampler2D	tex3;\n"
+    "uniform int	layer_count;\n"
+    "uniform float	alpha;\n"
+    "varying vec2	tex_coord;\n"
+    "varying float	quad_alpha;\n"
+    "vec4 over(vec4 dst, vec4 src) {\n"
+    "    return src + dst * (1.0 - src.a);\n"
+    "}\n"
     "void main() {\n"
     "    vec4 color = texture2D(tex, tex_coord);\n"
-    "    color.a *= alpha;\n"
+    "    if(layer_count > 0) color = over(color, texture2D(tex1, tex_coord));\n"
+    "    if(layer_count > 1) color = over(color, texture2D(tex2, tex_coord));\n"
+    "    if(layer_count > 2) color = over(color, texture2D(tex3, tex_coord));\n"
+    "    color.a *= alpha * quad_alpha;\n"
+    "    gl_FragColor = color;\n"
+    "}\n";
+
+// Coverage, in the display's premultiplied tint colour.
+static const char *a8_frag_shader =
+    "#version 120\n"
+    "uniform sampler2D	tex;\n"
+    "uniform vec4	tint;\n"
+    "uniform float	alpha;\n"
+    "varying vec2	tex_coord;\n"
+    "varying float	quad_alpha;\n"
+    "void main() {\n"
+    "    vec4 color = tint * texture2D(tex, tex_coord).r;\n"
+    "    color.a *= alpha * quad_alpha;\n"
+    "    gl_FragColor = color;\n"
+    "}\n";
+
+static const char *rgb565_frag_shader =
+    "#version 120\n"
+    "uniform sampler2D	tex;\n"
+    "uniform float	alpha;\n"
+    "varying vec2	tex_coord;\n"
+    "varying float	quad_alpha;\n"
+    "void main() {\n"
+    "    gl_FragColor = vec4(texture2D(tex, tex_coord).rgb, alpha * quad_alpha);\n"
+    "}\n";
+
+// The index is stored as a normalised byte: scale it back and sample the middle of its texel.
+static const char *index8_frag_shader =
+    "#version 120\n"
+    "uniform sampler2D	tex;\n"
+    "uniform sampler2D	lut;\n"
+    "uniform float	alpha;\n"
+    "varying vec2	tex_coord;\n"
+    "varying float	quad_alpha;\n"
+    "void main() {\n"
+    "    float index = texture2D(tex, tex_coord).r * 255.0;\n"
+    "    vec4 color = texture2D(lut, vec2((index + 0.5) / 256.0, 0.5));\n"
+    "    color.a *= alpha * quad_alpha;\n"
     "    gl_FragColor = color;\n"
     "}\n";
 
+// Palettes are bound past the layer texture units.
+#define LUT_UNIT (AV_DISPLAY_MAX_LAYERS)
+
 static bool is_init = false;
+static av_batch_t *single_batch = NULL;
+static av_target_t *timed_targets = NULL;   // Whose timers are open until the end of the run.
+static bool has_vertex_arrays = false;
+static unsigned quad_ibo = 0;           // Indices of a single quad, for vertex arrays.
 static unsigned default_quad_shader = 0;
+static unsigned default_layer_shader = 0;
+static unsigned format_shaders[AV_DISPLAY_FORMAT_COUNT] = {0};
+
+// The instanced version of a built-in shader, and the vertex array that feeds it. Instance
+// attributes are pointed into the ring on each draw.
+typedef struct {
+    unsigned base;
+    unsigned program;
+    unsigned vao;
+    int pvm;
+    int alpha;
+    int layer_count;
+    int tint;
+    int inst_rect;
+    int inst_uv;
+    int inst_params;
+} instanced_shader_t;
+
+// Built-in shaders with a distinct fragment stage: the default, layer, A8, RGB565 and INDEX8 ones.
+#define INSTANCED_SHADER_COUNT (5)
+#define INSTANCE_RING_SIZE (1 << 20)
+
+static bool has_instancing = false;
+static instanced_shader_t instanced_shaders[INSTANCED_SHADER_COUNT];
+static unsigned corner_vbo = 0;         // Corners of a unit quad, shared by every instance.
+static unsigned instance_vbo = 0;       // Streaming ring of instances, orphaned when it wraps.
+static size_t instance_offset = 0;
+
+static void delete_shaders() {
+    if(default_quad_shader) av_gl_delete_program(default_quad_shader);
+    if(default_layer_shader) av_gl_delete_program(default_layer_shader);
+    // ARGB32 and RGBA32 use the default quad shader.
+    for(unsigned i = 0; i < AV_DISPLAY_FORMAT_COUNT; ++i) {
+        if(format_shaders[i] && format_shaders[i] != default_quad_shader) {
+            av_gl_delete_program(format_shaders[i]);
+        }
+        format_shaders[i] = 0;
+    }
+    default_quad_shader = 0;
+    default_layer_shader = 0;
+}
+
+static void set_samplers(unsigned program) {
+    av_gl_use_program(program);
+    glUniform1i(glGetUniformLocation(program, "tex"), 0);
+    for(unsigned i = 0; i < AV_DISPLAY_MAX_LAYERS - 1; ++i) {
+        char name[8];
+        snprintf(name, sizeof(name), "tex%u", i + 1);
+        glUniform1i(glGetUniformLocation(program, name), i + 1);
+    }
+    glUniform1i(glGetUniformLocation(program, "lut"), LUT_UNIT);
+}
+
+// Instancing needs GL 3.1's instanced draws and the divisors of GL_ARB_instanced_arrays.
+static bool can_instance() {
+    return has_vertex_arrays && GLAD_GL_VERSION_3_1 && GLAD_GL_ARB_instanced_arrays
+        && glDrawElementsInstanced && glVertexAttribDivisorARB;
+}
+
+static void setup_instanced_shader(instanced_shader_t *shader, unsigned base) {
+    unsigned program = shader->program;
+    shader->base = base;
+    shader->pvm = glGetUniformLocation(program, "pvm");
+    shader->alpha = glGetUniformLocation(program, "alpha");
+    shader->layer_count = glGetUniformLocation(program, "layer_count");
+    shader->tint = glGetUniformLocation(program, "tint");
+    shader->inst_rect = glGetAttribLocation(program, "inst_rect");
+    shader->inst_uv = glGetAttribLocation(program, "inst_uv");
+    shader->inst_params = glGetAttribLocation(program, "inst_params");
+    int corner = glGetAttribLocation(program, "vtx_corner");
+
+    // Everything but where the instances are stays put from one draw to the next.
+    av_gl_begin();
+    set_samplers(program);
+    glGenVertexArrays(1, &shader->vao);
+    av_gl_bind_vertex_array(shader->vao);
+    av_gl_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, quad_ibo);
+    if(corner != -1) {
+        av_gl_bind_buffer(GL_ARRAY_BUFFER, corner_vbo);
+        glVertexAttribPointer(corner, 2, GL_FLOAT, GL_FALSE, 0, NULL);
+        av_gl_enable_attrib(corner);
+    }
+    int per_instance[] = {shader->inst_rect, shader->inst_uv, shader->inst_params};
+    for(unsigned i = 0; i < 3; ++i) {
+        if(per_instance[i] == -1) continue;
+        av_gl_enable_attrib(per_instance[i]);
+        glVertexAttribDivisorARB(per_instance[i], 1);
+    }
+    av_gl_end();
+    CHECK_GL();
+}
+
+static void deinit_instancing() {
+    for(unsigned i = 0; i < INSTANCED_SHADER_COUNT; ++i) {
+        instanced_shader_t *shader = &instanced_shaders[i];
+        if(shader->vao) av_gl_delete_vertex_arrays(1, &shader->vao);
+        if(shader->program) av_gl_delete_program(shader->program);
+        shader->vao = 0;
+        shader->program = 0;
+        shader->base = 0;
+    }
+    if(corner_vbo) av_gl_delete_buffers(1, &corner_vbo);
+    if(instance_vbo) av_gl_delete_buffers(1, &instance_vbo);
+    corner_vbo = 0;
+    instance_vbo = 0;
+    has_instancing = false;
+}
+
+// Sets up the instanced programs started by av_render_init(). If one failed to build, instanced
+// quads go through a batch.
+static void init_instancing() {
+    for(unsigned i = 0; i < INSTANCED_SHADER_COUNT; ++i) {
+        if(!instanced_shaders[i].program) {
+            CCERROR("unable to create instanced shaders, instances will be batched");
+            deinit_instancing();
+            return;
+        }
+    }
+
+    static const float corners[] = {0, 0, 1, 0, 1, 1, 0, 1};
+    glGenBuffers(1, &corner_vbo);
+    glGenBuffers(1, &instance_vbo);
+    av_gl_begin();
+    av_gl_bind_buffer(GL_ARRAY_BUFFER, corner_vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+    av_gl_bind_buffer(GL_ARRAY_BUFFER, instance_vbo);
+    glBufferData(GL_ARRAY_BUFFER, INSTANCE_RING_SIZE, NULL, GL_STREAM_DRAW);
+    av_gl_end();
+    instance_offset = 0;
+
+    const unsigned bases[INSTANCED_SHADER_COUNT] = {
+        default_quad_shader,
+        default_layer_shader,
+        format_shaders[AV_DISPLAY_FORMAT_A8],
+        format_shaders[AV_DISPLAY_FORMAT_RGB565],
+        format_shaders[AV_DISPLAY_FORMAT_INDEX8],
+    };
+    for(unsigned i = 0; i < INSTANCED_SHADER_COUNT; ++i) {
+        setup_instanced_shader(&instanced_shaders[i], bases[i]);
+    }
+    has_instancing = true;
+}
+
+static const instanced_shader_t *get_instanced_shader(unsigned shader) {
+    if(!has_instancing) return NULL;
+    for(unsigned i = 0; i < INSTANCED_SHADER_COUNT; ++i) {
+        if(instanced_shaders[i].base == shader) return &instanced_shaders[i];
+    }
+    return NULL;
+}
 
 void av_render_init() {
     if(is_init) return;
-    default_quad_shader = gl_create_program(vert_shader, frag_shader);
-    if(!default_quad_shader) return;
+    has_vertex_arrays = GLAD_GL_VERSION_3_0 && glGenVertexArrays && glBindVertexArray;
+    bool is_instanced = can_instance();
+
+    // Every program is started before any is waited on, so drivers that can build them in
+    // parallel do. Those in the program cache are only loaded.
+    default_quad_shader = gl_start_program(vert_shader, frag_shader);
+    default_layer_shader = gl_start_program(vert_shader, layer_frag_shader);
+    format_shaders[AV_DISPLAY_FORMAT_A8] = gl_start_program(vert_shader, a8_frag_shader);
+    format_shaders[AV_DISPLAY_FORMAT_RGB565] = gl_start_program(vert_shader, rgb565_frag_shader);
+    format_shaders[AV_DISPLAY_FORMAT_INDEX8] = gl_start_program(vert_shader, index8_frag_shader);
+    const char *instanced_frags[INSTANCED_SHADER_COUNT] = {
+        frag_shader,
+        layer_frag_shader,
+        a8_frag_shader,
+        rgb565_frag_shader,
+        index8_frag_shader,
+    };
+    for(unsigned i = 0; is_instanced && i < INSTANCED_SHADER_COUNT; ++i) {
+        instanced_shaders[i].program = gl_start_program(instanced_vert_shader, instanced_frags[i]);
+    }
+
+    default_quad_shader = gl_finish_program(default_quad_shader);
+    default_layer_shader = gl_finish_program(default_layer_shader);
+    format_shaders[AV_DISPLAY_FORMAT_ARGB32] = default_quad_shader;
+    format_shaders[AV_DISPLAY_FORMAT_A8] = gl_finish_program(format_shaders[AV_DISPLAY_FORMAT_A8]);
+    format_shaders[AV_DISPLAY_FORMAT_RGB565] = gl_finish_program(format_shaders[AV_DISPLAY_FORMAT_RGB565]);
+    format_shaders[AV_DISPLAY_FORMAT_INDEX8] = gl_finish_program(format_shaders[AV_DISPLAY_FORMAT_INDEX8]);
+    format_shaders[AV_DISPLAY_FORMAT_RGBA32] = default_quad_shader;
+    for(unsigned i = 0; is_instanced && i < INSTANCED_SHADER_COUNT; ++i) {
+        instanced_shaders[i].program = gl_finish_program(instanced_shaders[i].program);
+    }
+
+    bool is_complete = default_layer_shader;
+    for(unsigned i = 0; i < AV_DISPLAY_FORMAT_COUNT; ++i) {
+        if(!format_shaders[i]) is_complete = false;
+    }
+    if(!is_complete) {
+        delete_shaders();
+        deinit_instancing();
+        has_vertex_arrays = false;
+        return;
+    }
+    single_batch = av_batch_new();
+    if(has_vertex_arrays) {
+        static const GLuint indices[] = {0, 1, 2, 0, 2, 3};
+        glGenBuffers(1, &quad_ibo);
+        av_gl_begin();
+        av_gl_bind_vertex_array(0);
+        av_gl_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, quad_ibo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+        av_gl_end();
+    }
+    if(is_instanced) init_instancing();
     is_init = true;
 }
 
 void av_render_deinit() {
     CCASSERT(is_init);
-    glDeleteProgram(default_quad_shader);
-    default_quad_shader = 0;
+    av_batch_delete(single_batch);
+    single_batch = NULL;
+    if(quad_ibo) av_gl_delete_buffers(1, &quad_ibo);
+    quad_ibo = 0;
+    has_vertex_arrays = false;
+    deinit_instancing();
+    delete_shaders();
     is_init = false;
 }
 
+static bool is_default_shader(unsigned shader) {
+    for(unsigned i = 0; i < AV_DISPLAY_FORMAT_COUNT; ++i) {
+        if(format_shaders[i] == shader) return true;
+    }
+    return shader == default_layer_shader;
+}
+
 av_target_t *av_target_new(double x, double y, double width, double height) {
     CCASSERT(width > 0);
     CCASSERT(height > 0);
@@ -59,11 +370,20 @@ av_target_t *av_target_new(double x, double y, double width, double height) {
     target->size = CC_VEC2(width, height);
     target->offset = CC_VEC2(x, y);
     gl_ortho(target->proj, target->offset.x, target->offset.y, target->size.x, target->size.y);
+    av_gpu_timer_init(&target->timer);
+    target->timed_run = 0;
+    target->next_timed = NULL;
     return target;
 }
 
 void av_target_delete(av_target_t *target) {
     CCASSERT(target);
+    for(av_target_t **it = &timed_targets; *it; it = &(*it)->next_timed) {
+        if(*it != target) continue;
+        *it = target->next_timed;
+        break;
+    }
+    av_gpu_timer_deinit(&target->timer);
     cc_free(target);
 }
 
@@ -82,6 +402,11 @@ void av_target_set_size(av_target_t *target, double width, double height) {
     gl_ortho(target->proj, target->offset.x, target->offset.y, width, height);
 }
 
+void av_target_get_gpu_timing(const av_target_t *target, av_gpu_timing_t *timing) {
+    CCASSERT(target);
+    av_gpu_timer_query(&target->timer, timing);
+}
+
 av_quad_t *av_quad_new(unsigned tex, unsigned shader) {
     av_quad_t *quad = cc_alloc(sizeof(av_quad_t));
     av_quad_init(quad, tex, shader);
@@ -93,131 +418,526 @@ void av_quad_delete(av_quad_t *quad) {
     cc_free(quad);
 }
 
-void av_quad_init(av_quad_t *quad, unsigned tex, unsigned shader) {
-    quad->last_pos = CC_VEC2_NULL;
-    quad->last_size = CC_VEC2_NULL;
-    
-    quad->tex = tex;
-    quad->shader = shader ? shader : default_quad_shader;
-    glGenBuffers(1, &quad->vbo);
-    glGenBuffers(1, &quad->ibo);
-    
-    static const GLuint indices[] = {0, 1, 2, 0, 2, 3};
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quad->ibo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-    
-    glUseProgram(quad->shader);
+static void load_locations(av_quad_t *quad) {
     quad->loc.pvm = glGetUniformLocation(quad->shader, "pvm");
     quad->loc.tex = glGetUniformLocation(quad->shader, "tex");
     quad->loc.alpha = glGetUniformLocation(quad->shader, "alpha");
-    
+    quad->loc.layer_count = glGetUniformLocation(quad->shader, "layer_count");
+    for(unsigned i = 0; i < AV_DISPLAY_MAX_LAYERS - 1; ++i) {
+        char name[8];
+        snprintf(name, sizeof(name), "tex%u", i + 1);
+        quad->loc.layers[i] = glGetUniformLocation(quad->shader, name);
+    }
+    quad->loc.lut = glGetUniformLocation(quad->shader, "lut");
+    quad->loc.tint = glGetUniformLocation(quad->shader, "tint");
+
     quad->loc.vtx_pos = glGetAttribLocation(quad->shader, "vtx_pos");
     quad->loc.vtx_tex0 = glGetAttribLocation(quad->shader, "vtx_tex0");
+    quad->loc.vtx_alpha = glGetAttribLocation(quad->shader, "vtx_alpha");
+
+    // Samplers always read from the same units, so they are set once and for all.
+    av_gl_begin();
+    set_samplers(quad->shader);
+    av_gl_end();
+}
 
-    glUseProgram(0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    // XPLMBindTexture2d(0, 0);
+static inline void set_attrib(GLint index, GLint size, size_t offset) {
+    if(index == -1) return;
+    glVertexAttribPointer(index, size, GL_FLOAT, GL_FALSE, sizeof(av_vertex_t), (void *)offset);
+}
 
-    CCDEBUG("Quad VBO: %u", quad->vbo);
-    CCDEBUG("Quad IBO: %u", quad->ibo);
+static inline uint32_t attrib_bit(GLint index) {
+    return index >= 0 && index < AV_GL_ATTRIBS ? 1u << index : 0;
+}
+
+// Points the quad's vertex array at its buffer, with the locations of its current shader.
+static void setup_vertex_array(av_quad_t *quad) {
+    av_gl_begin();
+    av_gl_bind_vertex_array(quad->vao);
+    av_gl_bind_buffer(GL_ARRAY_BUFFER, quad->vbo);
+    av_gl_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, quad_ibo);
+    for(unsigned i = 0; i < AV_GL_ATTRIBS; ++i) {
+        av_gl_disable_attrib(i);
+    }
+    av_gl_use_attribs(attrib_bit(quad->loc.vtx_pos) | attrib_bit(quad->loc.vtx_tex0) | attrib_bit(quad->loc.vtx_alpha));
+    set_attrib(quad->loc.vtx_pos, 2, offsetof(av_vertex_t, x));
+    set_attrib(quad->loc.vtx_tex0, 2, offsetof(av_vertex_t, u));
+    set_attrib(quad->loc.vtx_alpha, 1, offsetof(av_vertex_t, alpha));
+    av_gl_end();
+    CHECK_GL();
+}
+
+void av_quad_init(av_quad_t *quad, unsigned tex, unsigned shader) {
+    quad->uv0 = CC_VEC2(0, 0);
+    quad->uv1 = CC_VEC2(1, 1);
+    
+    av_gpu_timer_init(&quad->timer);
+    quad->timed_run = 0;
+    quad->tex = tex;
+    quad->shader = shader ? shader : default_quad_shader;
+    quad->format = AV_DISPLAY_FORMAT_ARGB32;
+    quad->lut = 0;
+    for(unsigned i = 0; i < 4; ++i) {
+        quad->tint[i] = 1.f;
+    }
+    quad->layer_count = 0;
+    load_locations(quad);
+
+    quad->vao = 0;
+    quad->vbo = 0;
+    quad->has_vertices = false;
+    if(has_vertex_arrays) {
+        glGenVertexArrays(1, &quad->vao);
+        glGenBuffers(1, &quad->vbo);
+        av_gl_begin();
+        av_gl_bind_buffer(GL_ARRAY_BUFFER, quad->vbo);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(quad->vertices), NULL, GL_DYNAMIC_DRAW);
+        av_gl_end();
+        setup_vertex_array(quad);
+    }
     CCDEBUG("Quad Shader: %u", quad->shader);
 }
 
- void av_quad_deinit(av_quad_t *quad) {
-    // XPLMSetGraphicsState(0, 1, 0, 0, 1, 0, 0);
-    glDeleteBuffers(1, &quad->vbo);
-    glDeleteBuffers(1, &quad->ibo);
+void av_quad_set_format(av_quad_t *quad, av_display_format_t format, unsigned lut, const float tint[4]) {
+    CCASSERT(quad);
+    CCASSERT(format < AV_DISPLAY_FORMAT_COUNT);
+    CCASSERT(!quad->layer_count);
+    quad->format = format;
+    quad->lut = lut;
+    for(unsigned i = 0; i < 4; ++i) {
+        quad->tint[i] = tint[i];
+    }
+
+    // Custom shaders are expected to decode the format themselves.
+    if(is_default_shader(quad->shader)) {
+        quad->shader = format_shaders[format];
+        load_locations(quad);
+        if(quad->vao) setup_vertex_array(quad);
+    }
 }
 
-typedef struct {
-    float x;
-    float y;
-} vec2f_t;
+void av_quad_set_uv(av_quad_t *quad, double u0, double v0, double u1, double v1) {
+    CCASSERT(quad);
+    quad->uv0 = CC_VEC2(u0, v0);
+    quad->uv1 = CC_VEC2(u1, v1);
+}
 
-typedef struct {
-    vec2f_t pos;
-    vec2f_t tex;
-} vertex_t;
+void av_quad_set_layers(av_quad_t *quad, const unsigned *textures, unsigned count) {
+    CCASSERT(quad);
+    CCASSERT(count < AV_DISPLAY_MAX_LAYERS);
+    for(unsigned i = 0; i < count; ++i) {
+        quad->layers[i] = textures[i];
+    }
+    quad->layer_count = count;
 
-static inline bool vec2_eq(vec2_t a, vec2_t b) {
-    return a.x == b.x && a.y == b.y;
+    // Custom shaders are on their own, but the default one doesn't know about layers.
+    if(quad->shader == default_quad_shader && count) {
+        CCASSERT(quad->format == AV_DISPLAY_FORMAT_ARGB32);
+        quad->shader = default_layer_shader;
+        load_locations(quad);
+        if(quad->vao) setup_vertex_array(quad);
+    }
 }
 
-static void prepare_vertices(av_quad_t *quad, vec2_t pos, vec2_t size) {
-    if(vec2_eq(quad->last_pos, pos) && vec2_eq(quad->last_size, size)) return;
-    vertex_t vert[4];
-    
-    vert[0].pos.x = pos.x;
-    vert[0].pos.y = pos.y;
-    vert[0].tex = (vec2f_t){0, 0};
+void av_quad_deinit(av_quad_t *quad) {
+    if(quad->vao) av_gl_delete_vertex_arrays(1, &quad->vao);
+    if(quad->vbo) av_gl_delete_buffers(1, &quad->vbo);
+    av_gpu_timer_deinit(&quad->timer);
+}
 
-    vert[1].pos.x = pos.x + size.x;
-    vert[1].pos.y = pos.y;
-    vert[1].tex = (vec2f_t){1, 0};
+av_batch_t *av_batch_new() {
+    av_batch_t *batch = cc_alloc(sizeof(av_batch_t));
+    batch->target = NULL;
+    batch->items = NULL;
+    batch->vertices = NULL;
+    batch->count = 0;
+    batch->capacity = 0;
+    batch->ibo_capacity = 0;
+    glGenBuffers(1, &batch->vbo);
+    glGenBuffers(1, &batch->ibo);
+    return batch;
+}
 
-    vert[2].pos.x = pos.x + size.x;
-    vert[2].pos.y = pos.y + size.y;
-    vert[2].tex = (vec2f_t){1, 1};
+void av_batch_delete(av_batch_t *batch) {
+    CCASSERT(batch);
+    CCASSERT(!batch->target);
+    av_gl_delete_buffers(1, &batch->vbo);
+    av_gl_delete_buffers(1, &batch->ibo);
+    if(batch->items) cc_free(batch->items);
+    if(batch->vertices) cc_free(batch->vertices);
+    cc_free(batch);
+}
 
-    vert[3].pos.x = pos.x;
-    vert[3].pos.y = pos.y + size.y;
-    vert[3].tex = (vec2f_t){0, 1};
-    
-    glBindBuffer(GL_ARRAY_BUFFER, quad->vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vert), vert, GL_STATIC_DRAW);
+void av_batch_begin(av_batch_t *batch, av_target_t *target) {
+    CCASSERT(batch);
+    CCASSERT(target);
+    CCASSERT(!batch->target);
+    batch->target = target;
+    batch->count = 0;
+}
+
+// Whether two quads can be drawn by the same call. Shaders without a vertex alpha take it as a
+// uniform, which then has to match too.
+static bool is_same_state(const av_batch_item_t *a, const av_batch_item_t *b) {
+    const av_quad_t *qa = a->quad;
+    const av_quad_t *qb = b->quad;
+    if(qa == qb) return qa->loc.vtx_alpha != -1 || a->alpha == b->alpha;
+    if(qa->shader != qb->shader || qa->tex != qb->tex || qa->lut != qb->lut) return false;
+    if(qa->layer_count != qb->layer_count) return false;
+    for(unsigned i = 0; i < qa->layer_count; ++i) {
+        if(qa->layers[i] != qb->layers[i]) return false;
+    }
+    for(unsigned i = 0; i < 4; ++i) {
+        if(qa->tint[i] != qb->tint[i]) return false;
+    }
+    return qa->loc.vtx_alpha != -1 || a->alpha == b->alpha;
+}
+
+// Axis-aligned box around the quad, once rotated.
+static inline void get_bounds(const av_batch_item_t *item, float *x0, float *y0, float *x1, float *y1) {
+    float hw = fabsf(item->width) * 0.5f, hh = fabsf(item->height) * 0.5f;
+    float cx = item->x + item->width * 0.5f, cy = item->y + item->height * 0.5f;
+    if(item->rotation) {
+        float c = fabsf(cosf(item->rotation)), s = fabsf(sinf(item->rotation));
+        float ex = hw * c + hh * s, ey = hw * s + hh * c;
+        hw = ex;
+        hh = ey;
+    }
+    *x0 = cx - hw;
+    *x1 = cx + hw;
+    *y0 = cy - hh;
+    *y1 = cy + hh;
+}
+
+static inline bool is_overlapping(const av_batch_item_t *a, const av_batch_item_t *b) {
+    float ax0, ay0, ax1, ay1, bx0, by0, bx1, by1;
+    get_bounds(a, &ax0, &ay0, &ax1, &ay1);
+    get_bounds(b, &bx0, &by0, &bx1, &by1);
+    return ax0 < bx1 && bx0 < ax1 && ay0 < by1 && by0 < ay1;
+}
+
+static void add_item(av_batch_t *batch, av_quad_t *quad, const av_quad_instance_t *instance) {
+    if(batch->count == batch->capacity) {
+        batch->capacity = batch->capacity ? batch->capacity * 2 : 16;
+        batch->items = cc_realloc(batch->items, batch->capacity * sizeof(av_batch_item_t));
+        batch->vertices = cc_realloc(batch->vertices, batch->capacity * 4 * sizeof(av_vertex_t));
+    }
+
+    av_batch_item_t *item = &batch->items[batch->count];
+    item->quad = quad;
+    item->x = instance->x;
+    item->y = instance->y;
+    item->width = instance->width;
+    item->height = instance->height;
+    item->u0 = instance->u0;
+    item->v0 = instance->v0;
+    item->u1 = instance->u1;
+    item->v1 = instance->v1;
+    item->alpha = instance->alpha;
+    item->rotation = instance->rotation;
+    item->index = batch->count;
+
+    // A quad that can share a call with one below it may sit at the same depth, otherwise it has
+    // to go above. Batches stay small enough for checking every pair to be cheap.
+    item->depth = 0;
+    for(unsigned i = 0; i < batch->count; ++i) {
+        const av_batch_item_t *below = &batch->items[i];
+        if(!is_overlapping(item, below)) continue;
+        unsigned depth = below->depth + (is_same_state(item, below) ? 0 : 1);
+        item->depth = cc_max(item->depth, depth);
+    }
+    batch->count += 1;
+}
+
+void av_batch_add_region(av_batch_t *batch, av_quad_t *quad, vec2_t pos, vec2_t size, vec2_t uv0, vec2_t uv1, double alpha) {
+    CCASSERT(batch);
+    CCASSERT(batch->target);
+    CCASSERT(quad);
+    av_quad_instance_t instance = {
+        .x = pos.x,
+        .y = pos.y,
+        .width = size.x,
+        .height = size.y,
+        .u0 = uv0.x,
+        .v0 = uv0.y,
+        .u1 = uv1.x,
+        .v1 = uv1.y,
+        .alpha = alpha,
+        .rotation = 0,
+    };
+    add_item(batch, quad, &instance);
+}
+
+void av_batch_add(av_batch_t *batch, av_quad_t *quad, vec2_t pos, vec2_t size, double alpha) {
+    CCASSERT(quad);
+    av_batch_add_region(batch, quad, pos, size, quad->uv0, quad->uv1, alpha);
+}
+
+static int compare_items(const void *a, const void *b) {
+    const av_batch_item_t *ia = a;
+    const av_batch_item_t *ib = b;
+    if(ia->depth != ib->depth) return ia->depth < ib->depth ? -1 : 1;
+    if(ia->quad->shader != ib->quad->shader) return ia->quad->shader < ib->quad->shader ? -1 : 1;
+    if(ia->quad->tex != ib->quad->tex) return ia->quad->tex < ib->quad->tex ? -1 : 1;
+    return ia->index < ib->index ? -1 : ia->index > ib->index;
+}
+
+// Rotated quads turn around their centre, like instanced_vert_shader does it.
+static void write_vertices(const av_batch_item_t *item, av_vertex_t *vert) {
+    if(item->rotation) {
+        float hw = item->width * 0.5f, hh = item->height * 0.5f;
+        float cx = item->x + hw, cy = item->y + hh;
+        float c = cosf(item->rotation), s = sinf(item->rotation);
+        static const float corners[4][2] = {{-1, -1}, {1, -1}, {1, 1}, {-1, 1}};
+        for(unsigned i = 0; i < 4; ++i) {
+            float ox = corners[i][0] * hw, oy = corners[i][1] * hh;
+            vert[i].x = cx + c * ox - s * oy;
+            vert[i].y = cy + s * ox + c * oy;
+            vert[i].alpha = item->alpha;
+        }
+        vert[0].u = vert[3].u = item->u0;
+        vert[1].u = vert[2].u = item->u1;
+        vert[0].v = vert[1].v = item->v0;
+        vert[2].v = vert[3].v = item->v1;
+        return;
+    }
+    float x0 = item->x, x1 = item->x + item->width;
+    float y0 = item->y, y1 = item->y + item->height;
+    vert[0] = (av_vertex_t){x0, y0, item->u0, item->v0, item->alpha};
+    vert[1] = (av_vertex_t){x1, y0, item->u1, item->v0, item->alpha};
+    vert[2] = (av_vertex_t){x1, y1, item->u1, item->v1, item->alpha};
+    vert[3] = (av_vertex_t){x0, y1, item->u0, item->v1, item->alpha};
+}
+
+static void ensure_indices(av_batch_t *batch, unsigned count) {
+    if(count <= batch->ibo_capacity) return;
+    unsigned capacity = batch->ibo_capacity ? batch->ibo_capacity : 16;
+    while(capacity < count) capacity *= 2;
+
+    GLuint *indices = cc_alloc(capacity * 6 * sizeof(GLuint));
+    for(unsigned i = 0; i < capacity; ++i) {
+        GLuint base = i * 4;
+        GLuint *quad = &indices[i * 6];
+        quad[0] = base + 0;
+        quad[1] = base + 1;
+        quad[2] = base + 2;
+        quad[3] = base + 0;
+        quad[4] = base + 2;
+        quad[5] = base + 3;
+    }
+    av_gl_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, batch->ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, capacity * 6 * sizeof(GLuint), indices, GL_STATIC_DRAW);
+    cc_free(indices);
+    batch->ibo_capacity = capacity;
+}
+
+// Binds what a quad samples from and the uniforms that change from draw to draw. Samplers were
+// set when the quad's shader was picked.
+static void bind_textures(const av_quad_t *quad) {
+    for(unsigned i = 0; i < quad->layer_count; ++i) {
+        av_gl_bind_texture(1 + i, quad->layers[i]);
+    }
+    if(quad->lut) av_gl_bind_texture(LUT_UNIT, quad->lut);
+    av_gl_bind_texture(0, quad->tex);
+}
+
+static void use_quad(const av_target_t *target, const av_batch_item_t *item) {
+    const av_quad_t *quad = item->quad;
+    bind_textures(quad);
+    av_gl_use_program(quad->shader);
+
+    glUniformMatrix4fv(quad->loc.pvm, 1, GL_TRUE, target->proj);
+    glUniform1f(quad->loc.alpha, quad->loc.vtx_alpha != -1 ? 1.f : item->alpha);
+    glUniform1i(quad->loc.layer_count, quad->layer_count);
+    glUniform4fv(quad->loc.tint, 1, quad->tint);
+}
+
+// Draws [count] quads that share their state, starting at the [first] quad of the vertex buffer.
+// Bindings are left in place for the next group, which often shares some of them.
+static void draw_group(const av_target_t *target, const av_batch_item_t *item, unsigned first, unsigned count) {
+    const av_quad_t *quad = item->quad;
+    av_gl_use_attribs(attrib_bit(quad->loc.vtx_pos) | attrib_bit(quad->loc.vtx_tex0) | attrib_bit(quad->loc.vtx_alpha));
+    set_attrib(quad->loc.vtx_pos, 2, offsetof(av_vertex_t, x));
+    set_attrib(quad->loc.vtx_tex0, 2, offsetof(av_vertex_t, u));
+    set_attrib(quad->loc.vtx_alpha, 1, offsetof(av_vertex_t, alpha));
+    use_quad(target, item);
+    glDrawElements(GL_TRIANGLES, count * 6, GL_UNSIGNED_INT, (void *)(first * 6 * sizeof(GLuint)));
     CHECK_GL();
-    
-    quad->last_pos = pos;
-    quad->last_size = size;
-    // glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
-static inline void enable_attrib(GLint index, GLint size, GLenum type,
-    GLboolean normalized, size_t stride, size_t offset)
-{
-	if (index != -1) {
-		glEnableVertexAttribArray(index);
-		glVertexAttribPointer(index, size, type, normalized,
-		    stride, (void *)offset);
-	}
+// Draws a quad on its own with its vertex array. Its buffer is only touched when it moved.
+// Timing every draw would fill the timers' rings within a frame. Targets are timed over the whole
+// run instead, and quads on the first draw they have to themselves.
+static void time_target(av_target_t *target) {
+    unsigned long run = av_gl_get_run();
+    if(target->timed_run == run) return;
+    target->timed_run = run;
+    av_gpu_timer_begin(&target->timer);
+    if(!target->timer.is_open) return;
+    target->next_timed = timed_targets;
+    timed_targets = target;
+}
+
+static bool begin_quad_timer(av_quad_t *quad) {
+    unsigned long run = av_gl_get_run();
+    if(quad->timed_run == run) return false;
+    quad->timed_run = run;
+    av_gpu_timer_begin(&quad->timer);
+    return true;
+}
+
+void av_render_end_timers() {
+    for(av_target_t *target = timed_targets; target; target = target->next_timed) {
+        av_gpu_timer_end(&target->timer);
+    }
+    timed_targets = NULL;
+}
+
+static void draw_alone(const av_target_t *target, const av_batch_item_t *item, const av_vertex_t *vertices) {
+    av_quad_t *quad = item->quad;
+    if(!quad->has_vertices || memcmp(quad->vertices, vertices, sizeof(quad->vertices))) {
+        memcpy(quad->vertices, vertices, sizeof(quad->vertices));
+        quad->has_vertices = true;
+        av_gl_bind_buffer(GL_ARRAY_BUFFER, quad->vbo);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(quad->vertices), quad->vertices);
+    }
+    use_quad(target, item);
+    av_gl_bind_vertex_array(quad->vao);
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, NULL);
+    CHECK_GL();
+}
+
+void av_batch_end(av_batch_t *batch) {
+    CCASSERT(is_init);
+    CCASSERT(batch);
+    CCASSERT(batch->target);
+    av_target_t *target = batch->target;
+    batch->target = NULL;
+    if(!batch->count) return;
+
+    // Vertices are written in draw order, so each group is a contiguous range of them.
+    av_batch_item_t *items = batch->items;
+    unsigned count = batch->count;
+    qsort(items, count, sizeof(av_batch_item_t), compare_items);
+    for(unsigned i = 0; i < count; ++i) {
+        write_vertices(&items[i], &batch->vertices[i * 4]);
+    }
+
+#if APPLE
+    glDisableClientState(GL_VERTEX_ARRAY);
+#endif
+    av_gl_begin();
+    time_target(target);
+    bool is_streamed = false;
+
+    unsigned first = 0;
+    while(first < count) {
+        unsigned last = first + 1;
+        while(last < count && items[last].depth == items[first].depth
+              && is_same_state(&items[last], &items[first])) {
+            last += 1;
+        }
+        // A quad's own timer only measures draws it has to itself.
+        bool is_alone = last == first + 1;
+        bool is_timed = is_alone && begin_quad_timer(items[first].quad);
+        if(is_alone && items[first].quad->vao) {
+            draw_alone(target, &items[first], &batch->vertices[first * 4]);
+        } else {
+            // Groups share the batch's buffers, filled the first time one needs them.
+            if(has_vertex_arrays) av_gl_bind_vertex_array(0);
+            if(!is_streamed) {
+                ensure_indices(batch, count);
+                av_gl_bind_buffer(GL_ARRAY_BUFFER, batch->vbo);
+                glBufferData(GL_ARRAY_BUFFER, count * 4 * sizeof(av_vertex_t), batch->vertices, GL_STREAM_DRAW);
+                is_streamed = true;
+            }
+            av_gl_bind_buffer(GL_ARRAY_BUFFER, batch->vbo);
+            av_gl_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, batch->ibo);
+            draw_group(target, &items[first], first, last - first);
+        }
+        if(is_timed) av_gpu_timer_end(&items[first].quad->timer);
+        first = last;
+    }
+    av_gl_end();
+    CHECK_GL();
 }
 
 void av_render_quad(av_target_t *target, av_quad_t *quad, vec2_t pos, vec2_t size, double alpha) {
     CCASSERT(is_init);
-    CCASSERT(quad);
+    av_batch_begin(single_batch, target);
+    av_batch_add(single_batch, quad, pos, size, alpha);
+    av_batch_end(single_batch);
+}
+
+// Copies instances to the ring and returns where they start. Past the end, the ring is orphaned
+// rather than waited on, so the range written to is never one a draw may still read.
+static size_t stream_instances(const av_quad_instance_t *instances, unsigned count) {
+    size_t size = count * sizeof(av_quad_instance_t);
+    av_gl_bind_buffer(GL_ARRAY_BUFFER, instance_vbo);
+    if(instance_offset + size > INSTANCE_RING_SIZE) {
+        glBufferData(GL_ARRAY_BUFFER, INSTANCE_RING_SIZE, NULL, GL_STREAM_DRAW);
+        instance_offset = 0;
+    }
+    size_t offset = instance_offset;
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+    void *dst = glMapBufferRange(GL_ARRAY_BUFFER, offset, size, flags);
+    if(dst) {
+        memcpy(dst, instances, size);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    } else {
+        glBufferSubData(GL_ARRAY_BUFFER, offset, size, instances);
+    }
+    instance_offset += size;
+    return offset;
+}
+
+static inline void set_instance_attrib(GLint index, GLint size, size_t offset) {
+    if(index == -1) return;
+    glVertexAttribPointer(index, size, GL_FLOAT, GL_FALSE, sizeof(av_quad_instance_t), (void *)offset);
+}
+
+void av_render_quad_instanced(av_target_t *target, av_quad_t *quad, const av_quad_instance_t *instances, unsigned count) {
+    CCASSERT(is_init);
     CCASSERT(target);
-    
+    CCASSERT(quad);
+    CCASSERT(instances || !count);
+    if(!count) return;
+
+    const instanced_shader_t *shader = get_instanced_shader(quad->shader);
+    if(!shader) {
+        av_batch_begin(single_batch, target);
+        for(unsigned i = 0; i < count; ++i) {
+            add_item(single_batch, quad, &instances[i]);
+        }
+        av_batch_end(single_batch);
+        return;
+    }
+
 #if APPLE
     glDisableClientState(GL_VERTEX_ARRAY);
 #endif
-    
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, quad->tex);
-    glBindBuffer(GL_ARRAY_BUFFER, quad->vbo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quad->ibo);
-    
-    enable_attrib(quad->loc.vtx_pos, 2, GL_FLOAT, GL_FALSE, sizeof(vertex_t), offsetof(vertex_t, pos));
-    enable_attrib(quad->loc.vtx_tex0, 2, GL_FLOAT, GL_FALSE, sizeof(vertex_t), offsetof(vertex_t, tex));
-    glUseProgram(quad->shader);
-    
-    prepare_vertices(quad, pos, size);
-    
-    glUniformMatrix4fv(quad->loc.pvm, 1, GL_TRUE, target->proj);
-    glUniform1f(quad->loc.alpha, alpha);
-    glUniform1i(quad->loc.tex, 0);
-    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-    CHECK_GL();
+    av_gl_begin();
+    time_target(target);
+    bool is_timed = begin_quad_timer(quad);
+    bind_textures(quad);
+    av_gl_use_program(shader->program);
+    glUniformMatrix4fv(shader->pvm, 1, GL_TRUE, target->proj);
+    glUniform1f(shader->alpha, 1.f);
+    glUniform1i(shader->layer_count, quad->layer_count);
+    glUniform4fv(shader->tint, 1, quad->tint);
+    av_gl_bind_vertex_array(shader->vao);
 
-    glDisableVertexAttribArray(quad->loc.vtx_pos);
-    glDisableVertexAttribArray(quad->loc.vtx_tex0);
-    
-    
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glUseProgram(0);
+    // Arrays larger than the ring are drawn a ring's worth at a time.
+    const unsigned max_count = INSTANCE_RING_SIZE / sizeof(av_quad_instance_t);
+    for(unsigned first = 0; first < count; first += max_count) {
+        unsigned chunk = cc_min(count - first, max_count);
+        size_t offset = stream_instances(&instances[first], chunk);
+        set_instance_attrib(shader->inst_rect, 4, offset + offsetof(av_quad_instance_t, x));
+        set_instance_attrib(shader->inst_uv, 4, offset + offsetof(av_quad_instance_t, u0));
+        set_instance_attrib(shader->inst_params, 2, offset + offsetof(av_quad_instance_t, alpha));
+        glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_INT, NULL, chunk);
+    }
+    if(is_timed) av_gpu_timer_end(&quad->timer);
+    av_gl_end();
     CHECK_GL();
 }
-
@@ -0,0 +1,117 @@
+//===--------------------------------------------------------------------------------------------===
+// stats.c - Per-display frame counters and timing histograms
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2021 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "display.h"
+#include <ccore/log.h>
+
+#define RELAXED memory_order_relaxed
+
+static unsigned bucket_for(uint64_t value) {
+    unsigned bucket = 0;
+    while(value && bucket < AV_HISTOGRAM_BUCKETS - 1) {
+        value >>= 1;
+        bucket += 1;
+    }
+    return bucket;
+}
+
+void av_histogram_record(av_histogram_t *histogram, uint64_t value) {
+    atomic_fetch_add_explicit(&histogram->buckets[bucket_for(value)], 1, RELAXED);
+    uint64_t max = atomic_load_explicit(&histogram->max, RELAXED);
+    while(value > max) {
+        if(atomic_compare_exchange_weak_explicit(&histogram->max, &max, value, RELAXED, RELAXED)) break;
+    }
+}
+
+void av_histogram_reset(av_histogram_t *histogram) {
+    for(unsigned i = 0; i < AV_HISTOGRAM_BUCKETS; ++i) {
+        atomic_store_explicit(&histogram->buckets[i], 0, RELAXED);
+    }
+    atomic_store_explicit(&histogram->max, 0, RELAXED);
+}
+
+void av_display_counters_reset(av_display_counters_t *counters) {
+    atomic_store_explicit(&counters->produced, 0, RELAXED);
+    atomic_store_explicit(&counters->uploaded, 0, RELAXED);
+    atomic_store_explicit(&counters->dropped, 0, RELAXED);
+    atomic_store_explicit(&counters->skipped, 0, RELAXED);
+    for(unsigned i = 0; i < AV_DISPLAY_STAGE_COUNT; ++i) {
+        av_histogram_reset(&counters->stages[i]);
+    }
+}
+
+// Finds the bucket the [p]th percentile falls in, and interpolates linearly inside it. Buckets
+// are read one at a time while other threads record, so the result is only approximate.
+static double percentile(const unsigned long *buckets, unsigned long total, double max, double p, double unit_ms) {
+    double rank = p * (double)total;
+    unsigned long seen = 0;
+    for(unsigned i = 0; i < AV_HISTOGRAM_BUCKETS; ++i) {
+        if(!buckets[i] || (double)(seen + buckets[i]) < rank) {
+            seen += buckets[i];
+            continue;
+        }
+        double lo = i ? (double)(1llu << (i - 1)) : 0.0;
+        double hi = (double)(1llu << i);
+        double value = lo + (hi - lo) * (rank - (double)seen) / (double)buckets[i];
+        return (value < max ? value : max) * unit_ms;
+    }
+    return max * unit_ms;
+}
+
+void av_histogram_query(const av_histogram_t *histogram, double unit_ms, av_display_timing_t *timing) {
+    unsigned long buckets[AV_HISTOGRAM_BUCKETS];
+    unsigned long total = 0;
+    for(unsigned i = 0; i < AV_HISTOGRAM_BUCKETS; ++i) {
+        buckets[i] = atomic_load_explicit(&histogram->buckets[i], RELAXED);
+        total += buckets[i];
+    }
+    double max = (double)atomic_load_explicit(&histogram->max, RELAXED);
+
+    timing->count = total;
+    if(!total) {
+        timing->p50 = timing->p95 = timing->p99 = timing->max = 0;
+        return;
+    }
+    timing->p50 = percentile(buckets, total, max, 0.50, unit_ms);
+    timing->p95 = percentile(buckets, total, max, 0.95, unit_ms);
+    timing->p99 = percentile(buckets, total, max, 0.99, unit_ms);
+    timing->max = max * unit_ms;
+}
+
+void av_display_get_stats(const av_display_t *display, av_display_stats_t *stats) {
+    CCASSERT(display);
+    CCASSERT(stats);
+    const av_display_counters_t *counters = &display->counters;
+    stats->produced = atomic_load_explicit(&counters->produced, RELAXED);
+    stats->uploaded = atomic_load_explicit(&counters->uploaded, RELAXED);
+    stats->dropped = atomic_load_explicit(&counters->dropped, RELAXED);
+    stats->skipped = atomic_load_explicit(&counters->skipped, RELAXED);
+    for(unsigned i = 0; i < AV_DISPLAY_STAGE_COUNT; ++i) {
+        av_histogram_query(&counters->stages[i], 1e-3, &stats->stages[i]);
+    }
+}
+
+void av_display_reset_stats(av_display_t *display) {
+    CCASSERT(display);
+    av_display_counters_reset(&display->counters);
+    if(display->backend == AV_DISPLAY_BACKEND_CPU) return;
+    av_gpu_timer_reset(&display->upload_timer);
+    av_gpu_timer_reset(&display->quad.timer);
+}
+
+void av_display_get_gpu_timing(const av_display_t *display, av_gpu_timing_t *upload, av_gpu_timing_t *draw) {
+    CCASSERT(display);
+    CCASSERT(upload);
+    CCASSERT(draw);
+    if(display->backend == AV_DISPLAY_BACKEND_CPU) {
+        *upload = *draw = (av_gpu_timing_t){0};
+        return;
+    }
+    av_gpu_timer_query(&display->upload_timer, upload);
+    av_gpu_timer_query(&display->quad.timer, draw);
+}
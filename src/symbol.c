@@ -0,0 +1,240 @@
+//===--------------------------------------------------------------------------------------------===
+// symbol.c - Cache of pre-rasterised static symbology
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2021 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include <libavionics/symbol.h>
+#include "hash.h"
+#include <ccore/log.h>
+#include <ccore/memory.h>
+#include <pthread.h>
+#include <math.h>
+
+#define BUCKET_COUNT (256)
+
+typedef struct entry_s entry_t;
+struct entry_s {
+    uint32_t id;
+    uint32_t color;
+    double scale;
+    uint64_t hash;
+
+    cairo_surface_t *surface;
+    size_t bytes;
+
+    entry_t *next_in_bucket;
+    // Least recently used entries are at the tail.
+    entry_t *prev;
+    entry_t *next;
+};
+
+struct av_symbol_cache_s {
+    pthread_mutex_t mt;
+    size_t max_bytes;
+    size_t bytes;
+    unsigned count;
+    entry_t *buckets[BUCKET_COUNT];
+    entry_t *head;
+    entry_t *tail;
+    // Bumped on invalidation, so that symbols rasterised meanwhile aren't cached stale.
+    unsigned long generation;
+
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+};
+
+static uint64_t hash_key(const av_symbol_t *symbol) {
+    uint64_t hash = av_hash_bytes(AV_HASH_SEED, &symbol->id, sizeof(symbol->id));
+    hash = av_hash_bytes(hash, &symbol->scale, sizeof(symbol->scale));
+    return av_hash_bytes(hash, &symbol->color, sizeof(symbol->color));
+}
+
+av_symbol_cache_t *av_symbol_cache_new(size_t max_bytes) {
+    av_symbol_cache_t *cache = cc_alloc(sizeof(av_symbol_cache_t));
+    pthread_mutex_init(&cache->mt, NULL);
+    cache->max_bytes = max_bytes;
+    cache->bytes = 0;
+    cache->count = 0;
+    for(unsigned i = 0; i < BUCKET_COUNT; ++i) {
+        cache->buckets[i] = NULL;
+    }
+    cache->head = cache->tail = NULL;
+    cache->generation = 0;
+    cache->hits = cache->misses = cache->evictions = 0;
+    return cache;
+}
+
+static void lru_unlink(av_symbol_cache_t *cache, entry_t *entry) {
+    if(entry->prev) entry->prev->next = entry->next;
+    else cache->head = entry->next;
+    if(entry->next) entry->next->prev = entry->prev;
+    else cache->tail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+static void lru_push(av_symbol_cache_t *cache, entry_t *entry) {
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if(cache->head) cache->head->prev = entry;
+    cache->head = entry;
+    if(!cache->tail) cache->tail = entry;
+}
+
+static void remove_entry(av_symbol_cache_t *cache, entry_t *entry) {
+    entry_t **link = &cache->buckets[entry->hash % BUCKET_COUNT];
+    while(*link != entry) link = &(*link)->next_in_bucket;
+    *link = entry->next_in_bucket;
+    lru_unlink(cache, entry);
+
+    cache->bytes -= entry->bytes;
+    cache->count -= 1;
+    // Frames being drawn may still hold a reference to the surface.
+    cairo_surface_destroy(entry->surface);
+    cc_free(entry);
+}
+
+static entry_t *find_entry(av_symbol_cache_t *cache, uint64_t hash, const av_symbol_t *symbol) {
+    for(entry_t *e = cache->buckets[hash % BUCKET_COUNT]; e; e = e->next_in_bucket) {
+        if(e->hash != hash) continue;
+        if(e->id == symbol->id && e->color == symbol->color && e->scale == symbol->scale) return e;
+    }
+    return NULL;
+}
+
+static void trim(av_symbol_cache_t *cache) {
+    // Always keep the most recent entry, even if it is larger than the whole budget.
+    while(cache->bytes > cache->max_bytes && cache->tail && cache->tail != cache->head) {
+        remove_entry(cache, cache->tail);
+        cache->evictions += 1;
+    }
+}
+
+static cairo_surface_t *rasterise(const av_symbol_t *symbol, size_t *bytes) {
+    int width = (int)ceil(symbol->width * symbol->scale);
+    int height = (int)ceil(symbol->height * symbol->scale);
+    if(width < 1) width = 1;
+    if(height < 1) height = 1;
+
+    cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+    cairo_t *cr = cairo_create(surface);
+    cairo_scale(cr, symbol->scale, symbol->scale);
+    symbol->draw(cr, symbol->color, symbol->data);
+    cairo_destroy(cr);
+    cairo_surface_flush(surface);
+
+    *bytes = (size_t)cairo_image_surface_get_stride(surface) * height;
+    return surface;
+}
+
+// Returns a new reference to the rasterised symbol, so that it can be painted without the lock.
+static cairo_surface_t *get_surface(av_symbol_cache_t *cache, const av_symbol_t *symbol) {
+    uint64_t hash = hash_key(symbol);
+
+    pthread_mutex_lock(&cache->mt);
+    entry_t *entry = find_entry(cache, hash, symbol);
+    if(entry) {
+        cache->hits += 1;
+        lru_unlink(cache, entry);
+        lru_push(cache, entry);
+        cairo_surface_t *surface = cairo_surface_reference(entry->surface);
+        pthread_mutex_unlock(&cache->mt);
+        return surface;
+    }
+    cache->misses += 1;
+    unsigned long generation = cache->generation;
+    pthread_mutex_unlock(&cache->mt);
+
+    // Rasterising can be slow, don't hold up other threads while we do it.
+    size_t bytes = 0;
+    cairo_surface_t *surface = rasterise(symbol, &bytes);
+
+    pthread_mutex_lock(&cache->mt);
+    if(generation != cache->generation || find_entry(cache, hash, symbol)) {
+        // Either another thread beat us to it, or the symbol changed while we were drawing it.
+        pthread_mutex_unlock(&cache->mt);
+        return surface;
+    }
+    entry = cc_alloc(sizeof(entry_t));
+    entry->id = symbol->id;
+    entry->color = symbol->color;
+    entry->scale = symbol->scale;
+    entry->hash = hash;
+    entry->surface = cairo_surface_reference(surface);
+    entry->bytes = bytes;
+    entry->next_in_bucket = cache->buckets[hash % BUCKET_COUNT];
+    cache->buckets[hash % BUCKET_COUNT] = entry;
+    lru_push(cache, entry);
+    cache->bytes += bytes;
+    cache->count += 1;
+    trim(cache);
+    pthread_mutex_unlock(&cache->mt);
+    return surface;
+}
+
+void av_symbol_draw(av_symbol_cache_t *cache, cairo_t *cr, const av_symbol_t *symbol, double x, double y) {
+    CCASSERT(cache);
+    CCASSERT(cr);
+    CCASSERT(symbol);
+    CCASSERT(symbol->draw);
+    CCASSERT(symbol->scale > 0);
+
+    cairo_surface_t *surface = get_surface(cache, symbol);
+
+    // Snap to the pixel grid, or every blit would be resampled.
+    x -= symbol->origin_x * symbol->scale;
+    y -= symbol->origin_y * symbol->scale;
+    cairo_user_to_device(cr, &x, &y);
+    x = round(x);
+    y = round(y);
+    cairo_device_to_user(cr, &x, &y);
+
+    cairo_save(cr);
+    cairo_set_source_surface(cr, surface, x, y);
+    cairo_paint(cr);
+    cairo_restore(cr);
+    cairo_surface_destroy(surface);
+}
+
+void av_symbol_invalidate(av_symbol_cache_t *cache, uint32_t id) {
+    CCASSERT(cache);
+    pthread_mutex_lock(&cache->mt);
+    entry_t *entry = cache->head;
+    while(entry) {
+        entry_t *next = entry->next;
+        if(entry->id == id) remove_entry(cache, entry);
+        entry = next;
+    }
+    cache->generation += 1;
+    pthread_mutex_unlock(&cache->mt);
+}
+
+void av_symbol_cache_clear(av_symbol_cache_t *cache) {
+    CCASSERT(cache);
+    pthread_mutex_lock(&cache->mt);
+    while(cache->head) remove_entry(cache, cache->head);
+    cache->generation += 1;
+    pthread_mutex_unlock(&cache->mt);
+}
+
+void av_symbol_cache_get_stats(av_symbol_cache_t *cache, av_symbol_stats_t *stats) {
+    CCASSERT(cache);
+    CCASSERT(stats);
+    pthread_mutex_lock(&cache->mt);
+    stats->bytes = cache->bytes;
+    stats->entries = cache->count;
+    stats->hits = cache->hits;
+    stats->misses = cache->misses;
+    stats->evictions = cache->evictions;
+    pthread_mutex_unlock(&cache->mt);
+}
+
+void av_symbol_cache_delete(av_symbol_cache_t *cache) {
+    CCASSERT(cache);
+    av_symbol_cache_clear(cache);
+    pthread_mutex_destroy(&cache->mt);
+    cc_free(cache);
+}
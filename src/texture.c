@@ -0,0 +1,587 @@
+//===--------------------------------------------------------------------------------------------===
+// texture.c - Background image loading into GL textures, and a cache of loaded textures
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2021 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include <libavionics/texture.h>
+#include <libavionics/stb_image.h>
+#include "display.h"
+#include "hash.h"
+#include "pool.h"
+#include <ccore/math.h>
+#include <ccore/memory.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_THREADS (2)
+#define DEFAULT_UPLOAD_BUDGET (4 << 20)
+#define BUCKET_COUNT (64)
+
+typedef enum {
+    TEXTURE_DECODING,
+    TEXTURE_DECODED,
+    TEXTURE_READY,
+    TEXTURE_FAILED,
+} texture_state_t;
+
+struct av_texture_s {
+    av_texture_loader_t *loader;
+    char *path;
+    av_texture_params_t params;
+    av_texture_loaded_f loaded;
+    void *data;
+
+    // Workers only touch a texture while it is decoding, and do so under the loader's lock.
+    texture_state_t state;
+    bool is_deleted;            // Deleted while decoding: the worker frees it instead.
+    int width;
+    int height;
+    uint8_t *pixels;            // RGBA, from decoding until fully uploaded.
+    int uploaded_rows;
+    unsigned id;
+
+    av_texture_t *prev;
+    av_texture_t *next;
+    av_texture_t *next_done;
+};
+
+// Decoded textures queue up for the GL thread, which uploads them in order, as much as the budget
+// allows on each update. [current] is the one it is part way through.
+struct av_texture_loader_s {
+    av_pool_t *pool;
+    size_t upload_budget;
+    unsigned placeholder;
+    unsigned pbo;
+
+    pthread_mutex_t mt;
+    av_texture_t *textures;
+    av_texture_t *done_head;
+    av_texture_t *done_tail;
+    unsigned decoding;
+
+    av_texture_t *current;
+};
+
+static void free_texture(av_texture_t *texture) {
+    if(texture->pixels) stbi_image_free(texture->pixels);
+    cc_free(texture->path);
+    cc_free(texture);
+}
+
+static void decode_job(void *data) {
+    av_texture_t *texture = data;
+    int width = 0, height = 0, components = 0;
+    uint8_t *pixels = stbi_load(texture->path, &width, &height, &components, 4);
+    if(!pixels) CCERROR("unable to load image `%s`", texture->path);
+
+    av_texture_loader_t *loader = texture->loader;
+    pthread_mutex_lock(&loader->mt);
+    loader->decoding -= 1;
+    if(texture->is_deleted) {
+        pthread_mutex_unlock(&loader->mt);
+        if(pixels) stbi_image_free(pixels);
+        free_texture(texture);
+        return;
+    }
+    texture->pixels = pixels;
+    texture->width = width;
+    texture->height = height;
+    texture->state = pixels ? TEXTURE_DECODED : TEXTURE_FAILED;
+    if(loader->done_tail) {
+        loader->done_tail->next_done = texture;
+    } else {
+        loader->done_head = texture;
+    }
+    loader->done_tail = texture;
+    pthread_mutex_unlock(&loader->mt);
+}
+
+av_texture_loader_t *av_texture_loader_new(const av_texture_loader_desc_t *desc) {
+    av_texture_loader_desc_t defaults = {0};
+    if(!desc) desc = &defaults;
+
+    av_texture_loader_t *loader = cc_alloc(sizeof(av_texture_loader_t));
+    loader->pool = av_pool_new(desc->threads ? desc->threads : DEFAULT_THREADS);
+    loader->upload_budget = desc->upload_budget ? desc->upload_budget : DEFAULT_UPLOAD_BUDGET;
+    loader->placeholder = desc->placeholder;
+    glGenBuffers(1, &loader->pbo);
+
+    pthread_mutex_init(&loader->mt, NULL);
+    loader->textures = NULL;
+    loader->done_head = NULL;
+    loader->done_tail = NULL;
+    loader->decoding = 0;
+    loader->current = NULL;
+    return loader;
+}
+
+void av_texture_loader_delete(av_texture_loader_t *loader) {
+    CCASSERT(loader);
+    av_pool_delete(loader->pool);
+    while(loader->textures) {
+        av_texture_delete(loader->textures);
+    }
+    av_gl_delete_buffers(1, &loader->pbo);
+    pthread_mutex_destroy(&loader->mt);
+    cc_free(loader);
+}
+
+static av_texture_params_t get_params(const av_texture_params_t *params) {
+    av_texture_params_t result = params ? *params : (av_texture_params_t){0};
+    if(!result.min_filter) result.min_filter = GL_LINEAR;
+    if(!result.mag_filter) result.mag_filter = GL_LINEAR;
+    CCASSERT(result.mag_filter == GL_LINEAR || result.mag_filter == GL_NEAREST);
+    if(!result.wrap) result.wrap = GL_REPEAT;
+    return result;
+}
+
+av_texture_t *av_texture_load(av_texture_loader_t *loader, const char *path, av_texture_loaded_f loaded, void *data) {
+    return av_texture_load_params(loader, path, NULL, loaded, data);
+}
+
+av_texture_t *av_texture_load_params(
+    av_texture_loader_t *loader,
+    const char *path,
+    const av_texture_params_t *params,
+    av_texture_loaded_f loaded,
+    void *data
+) {
+    CCASSERT(loader);
+    CCASSERT(path);
+    av_texture_t *texture = cc_alloc(sizeof(av_texture_t));
+    texture->loader = loader;
+    texture->path = cc_alloc(strlen(path) + 1);
+    strcpy(texture->path, path);
+    texture->params = get_params(params);
+    texture->loaded = loaded;
+    texture->data = data;
+
+    texture->state = TEXTURE_DECODING;
+    texture->is_deleted = false;
+    texture->width = 0;
+    texture->height = 0;
+    texture->pixels = NULL;
+    texture->uploaded_rows = 0;
+    texture->id = 0;
+    texture->next_done = NULL;
+
+    pthread_mutex_lock(&loader->mt);
+    texture->prev = NULL;
+    texture->next = loader->textures;
+    if(loader->textures) loader->textures->prev = texture;
+    loader->textures = texture;
+    loader->decoding += 1;
+    pthread_mutex_unlock(&loader->mt);
+
+    av_pool_submit(loader->pool, decode_job, texture);
+    return texture;
+}
+
+static av_texture_t *pop_done(av_texture_loader_t *loader) {
+    pthread_mutex_lock(&loader->mt);
+    av_texture_t *texture = loader->done_head;
+    if(texture) {
+        loader->done_head = texture->next_done;
+        if(!loader->done_head) loader->done_tail = NULL;
+        texture->next_done = NULL;
+    }
+    pthread_mutex_unlock(&loader->mt);
+    return texture;
+}
+
+static bool has_mipmaps(const av_texture_t *texture) {
+    return texture->params.min_filter != GL_LINEAR && texture->params.min_filter != GL_NEAREST;
+}
+
+// With an unpack buffer bound, a NULL pointer would be an offset into it.
+static void create_storage(av_texture_t *texture) {
+    av_gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glGenTextures(1, &texture->id);
+    av_gl_bind_texture(0, texture->id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, texture->params.wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, texture->params.wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, texture->params.min_filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, texture->params.mag_filter);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, texture->width, texture->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+}
+
+// Copies [rows] rows of [texture] through the loader's buffer, which is orphaned for each chunk so
+// the copy never waits on the previous one.
+static void upload_rows(av_texture_loader_t *loader, av_texture_t *texture, int rows) {
+    size_t stride = (size_t)texture->width * 4;
+    size_t size = stride * rows;
+    const uint8_t *src = texture->pixels + stride * texture->uploaded_rows;
+
+    av_gl_bind_texture(0, texture->id);
+    av_gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, loader->pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+    uint8_t *transfer = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if(transfer) {
+        memcpy(transfer, src, size);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        src = NULL;
+    } else {
+        av_gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, texture->uploaded_rows, texture->width, rows, GL_RGBA, GL_UNSIGNED_BYTE, src);
+    texture->uploaded_rows += rows;
+    CHECK_GL();
+}
+
+// Textures are reported once bindings are reset, as callbacks may well draw or delete them.
+static void upload(av_texture_loader_t *loader, size_t budget) {
+    for(;;) {
+        av_gl_begin();
+        av_texture_t *texture = NULL;
+        while(budget) {
+            if(!loader->current) loader->current = pop_done(loader);
+            if(!loader->current) break;
+
+            av_texture_t *current = loader->current;
+            if(current->state == TEXTURE_DECODED) {
+                if(!current->id) create_storage(current);
+                size_t stride = (size_t)current->width * 4;
+                size_t rows = budget >= stride ? budget / stride : 1;
+                rows = cc_min(rows, (size_t)(current->height - current->uploaded_rows));
+                upload_rows(loader, current, rows);
+                budget -= cc_min(budget, rows * stride);
+                if(current->uploaded_rows < current->height) continue;
+
+                if(has_mipmaps(current)) glGenerateMipmap(GL_TEXTURE_2D);
+                stbi_image_free(current->pixels);
+                current->pixels = NULL;
+                pthread_mutex_lock(&loader->mt);
+                current->state = TEXTURE_READY;
+                pthread_mutex_unlock(&loader->mt);
+            }
+            texture = current;
+            loader->current = NULL;
+            break;
+        }
+        av_gl_end();
+
+        if(!texture) return;
+        if(texture->loaded) texture->loaded(texture, texture->state == TEXTURE_READY, texture->data);
+    }
+}
+
+void av_texture_loader_update(av_texture_loader_t *loader) {
+    CCASSERT(loader);
+    upload(loader, loader->upload_budget);
+}
+
+// Callbacks may start loading more textures, which are waited for too.
+void av_texture_loader_wait_all(av_texture_loader_t *loader) {
+    CCASSERT(loader);
+    for(;;) {
+        av_pool_wait(loader->pool);
+        upload(loader, SIZE_MAX);
+        pthread_mutex_lock(&loader->mt);
+        bool is_done = !loader->decoding && !loader->done_head;
+        pthread_mutex_unlock(&loader->mt);
+        if(is_done) break;
+    }
+}
+
+void av_texture_delete(av_texture_t *texture) {
+    CCASSERT(texture);
+    av_texture_loader_t *loader = texture->loader;
+    pthread_mutex_lock(&loader->mt);
+    if(texture->prev) texture->prev->next = texture->next;
+    if(texture->next) texture->next->prev = texture->prev;
+    if(loader->textures == texture) loader->textures = texture->next;
+
+    if(texture->state == TEXTURE_DECODING) {
+        texture->is_deleted = true;
+        pthread_mutex_unlock(&loader->mt);
+        return;
+    }
+
+    // Decoded textures may still be waiting for their upload.
+    av_texture_t **link = &loader->done_head;
+    av_texture_t *last = NULL;
+    while(*link && *link != texture) {
+        last = *link;
+        link = &(*link)->next_done;
+    }
+    if(*link) {
+        *link = texture->next_done;
+        if(loader->done_tail == texture) loader->done_tail = last;
+    }
+    pthread_mutex_unlock(&loader->mt);
+
+    if(loader->current == texture) loader->current = NULL;
+    if(texture->id) av_gl_delete_textures(1, &texture->id);
+    free_texture(texture);
+}
+
+static texture_state_t get_state(const av_texture_t *texture) {
+    av_texture_loader_t *loader = texture->loader;
+    pthread_mutex_lock(&loader->mt);
+    texture_state_t state = texture->state;
+    pthread_mutex_unlock(&loader->mt);
+    return state;
+}
+
+unsigned av_texture_get_id(const av_texture_t *texture) {
+    CCASSERT(texture);
+    return get_state(texture) == TEXTURE_READY ? texture->id : texture->loader->placeholder;
+}
+
+bool av_texture_is_ready(const av_texture_t *texture) {
+    CCASSERT(texture);
+    return get_state(texture) == TEXTURE_READY;
+}
+
+bool av_texture_get_size(const av_texture_t *texture, int *width, int *height) {
+    CCASSERT(texture);
+    av_texture_loader_t *loader = texture->loader;
+    pthread_mutex_lock(&loader->mt);
+    bool is_decoded = texture->state == TEXTURE_DECODED || texture->state == TEXTURE_READY;
+    if(is_decoded) {
+        if(width) *width = texture->width;
+        if(height) *height = texture->height;
+    }
+    pthread_mutex_unlock(&loader->mt);
+    return is_decoded;
+}
+
+size_t av_texture_get_bytes(const av_texture_t *texture) {
+    CCASSERT(texture);
+    if(get_state(texture) != TEXTURE_READY) return 0;
+    size_t bytes = (size_t)texture->width * texture->height * 4;
+    if(!has_mipmaps(texture)) return bytes;
+
+    size_t total = bytes;
+    for(int w = texture->width, h = texture->height; w > 1 || h > 1;) {
+        w = cc_max(w / 2, 1);
+        h = cc_max(h / 2, 1);
+        total += (size_t)w * h * 4;
+    }
+    return total;
+}
+
+// Cache entries hold the texture of a canonical path and parameters. Those nobody references are
+// kept in least recently released order, to be evicted once the cache is over budget.
+typedef struct entry_s entry_t;
+struct entry_s {
+    av_texture_cache_t *cache;
+    char *path;
+    av_texture_params_t params;
+    uint64_t hash;
+    av_texture_t *texture;
+    unsigned refs;
+    size_t bytes;               // Counted in the cache's total from when the texture is ready.
+
+    entry_t *next_in_bucket;
+    // Most recently released entries are at the head.
+    entry_t *prev;
+    entry_t *next;
+};
+
+struct av_texture_cache_s {
+    av_texture_loader_t *loader;
+    size_t max_bytes;
+    size_t bytes;
+    unsigned count;
+    unsigned unused;
+    entry_t *buckets[BUCKET_COUNT];
+    entry_t *head;
+    entry_t *tail;
+
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+};
+
+static uint64_t hash_key(const char *path, const av_texture_params_t *params) {
+    uint64_t hash = av_hash_bytes(AV_HASH_SEED, path, strlen(path));
+    hash = av_hash_bytes(hash, &params->min_filter, sizeof(params->min_filter));
+    hash = av_hash_bytes(hash, &params->mag_filter, sizeof(params->mag_filter));
+    return av_hash_bytes(hash, &params->wrap, sizeof(params->wrap));
+}
+
+// Paths to files that don't exist are kept as they are, and fail to load.
+static char *canonicalise(const char *path) {
+#if IBM
+    char *full = _fullpath(NULL, path, 0);
+#else
+    char *full = realpath(path, NULL);
+#endif
+    const char *src = full ? full : path;
+    char *result = cc_alloc(strlen(src) + 1);
+    strcpy(result, src);
+    if(full) free(full);
+    return result;
+}
+
+av_texture_cache_t *av_texture_cache_new(av_texture_loader_t *loader, size_t max_bytes) {
+    CCASSERT(loader);
+    av_texture_cache_t *cache = cc_alloc(sizeof(av_texture_cache_t));
+    cache->loader = loader;
+    cache->max_bytes = max_bytes;
+    cache->bytes = 0;
+    cache->count = 0;
+    cache->unused = 0;
+    for(unsigned i = 0; i < BUCKET_COUNT; ++i) {
+        cache->buckets[i] = NULL;
+    }
+    cache->head = cache->tail = NULL;
+    cache->hits = cache->misses = cache->evictions = 0;
+    return cache;
+}
+
+static void lru_unlink(av_texture_cache_t *cache, entry_t *entry) {
+    if(entry->prev) entry->prev->next = entry->next;
+    else cache->head = entry->next;
+    if(entry->next) entry->next->prev = entry->prev;
+    else cache->tail = entry->prev;
+    entry->prev = entry->next = NULL;
+    cache->unused -= 1;
+}
+
+static void lru_push(av_texture_cache_t *cache, entry_t *entry) {
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if(cache->head) cache->head->prev = entry;
+    cache->head = entry;
+    if(!cache->tail) cache->tail = entry;
+    cache->unused += 1;
+}
+
+static void remove_entry(av_texture_cache_t *cache, entry_t *entry) {
+    entry_t **link = &cache->buckets[entry->hash % BUCKET_COUNT];
+    while(*link != entry) link = &(*link)->next_in_bucket;
+    *link = entry->next_in_bucket;
+    if(!entry->refs) lru_unlink(cache, entry);
+
+    cache->bytes -= entry->bytes;
+    cache->count -= 1;
+    av_texture_delete(entry->texture);
+    cc_free(entry->path);
+    cc_free(entry);
+}
+
+static entry_t *find_entry(av_texture_cache_t *cache, uint64_t hash, const char *path, const av_texture_params_t *params) {
+    for(entry_t *e = cache->buckets[hash % BUCKET_COUNT]; e; e = e->next_in_bucket) {
+        if(e->hash != hash) continue;
+        if(e->params.min_filter != params->min_filter || e->params.mag_filter != params->mag_filter) continue;
+        if(e->params.wrap != params->wrap) continue;
+        if(!strcmp(e->path, path)) return e;
+    }
+    return NULL;
+}
+
+// Only unused entries are evicted, so textures in use may keep the cache over budget.
+static void trim(av_texture_cache_t *cache) {
+    while(cache->bytes > cache->max_bytes && cache->tail) {
+        remove_entry(cache, cache->tail);
+        cache->evictions += 1;
+    }
+}
+
+static void cache_loaded(av_texture_t *texture, bool is_loaded, void *data) {
+    entry_t *entry = data;
+    av_texture_cache_t *cache = entry->cache;
+    if(!is_loaded) {
+        if(!entry->refs) remove_entry(cache, entry);
+        return;
+    }
+    entry->bytes = av_texture_get_bytes(texture);
+    cache->bytes += entry->bytes;
+    trim(cache);
+}
+
+void av_texture_cache_delete(av_texture_cache_t *cache) {
+    CCASSERT(cache);
+    for(unsigned i = 0; i < BUCKET_COUNT; ++i) {
+        while(cache->buckets[i]) remove_entry(cache, cache->buckets[i]);
+    }
+    cc_free(cache);
+}
+
+av_texture_t *av_texture_cache_acquire(av_texture_cache_t *cache, const char *path, const av_texture_params_t *params) {
+    CCASSERT(cache);
+    CCASSERT(path);
+    av_texture_params_t key_params = get_params(params);
+    char *key_path = canonicalise(path);
+    uint64_t hash = hash_key(key_path, &key_params);
+
+    entry_t *entry = find_entry(cache, hash, key_path, &key_params);
+    if(entry) {
+        cc_free(key_path);
+        if(!entry->refs) lru_unlink(cache, entry);
+        entry->refs += 1;
+        cache->hits += 1;
+        return entry->texture;
+    }
+
+    entry = cc_alloc(sizeof(entry_t));
+    entry->cache = cache;
+    entry->path = key_path;
+    entry->params = key_params;
+    entry->hash = hash;
+    entry->refs = 1;
+    entry->bytes = 0;
+    entry->prev = entry->next = NULL;
+    entry->next_in_bucket = cache->buckets[hash % BUCKET_COUNT];
+    cache->buckets[hash % BUCKET_COUNT] = entry;
+    cache->count += 1;
+    cache->misses += 1;
+    entry->texture = av_texture_load_params(cache->loader, key_path, &key_params, cache_loaded, entry);
+    return entry->texture;
+}
+
+void av_texture_cache_release(av_texture_cache_t *cache, av_texture_t *texture) {
+    CCASSERT(cache);
+    CCASSERT(texture);
+    CCASSERT(texture->loaded == cache_loaded);
+    entry_t *entry = texture->data;
+    CCASSERT(entry->cache == cache);
+    CCASSERT(entry->refs);
+
+    if(entry->refs > 1) {
+        entry->refs -= 1;
+        return;
+    }
+    // Dropped while still referenced, so remove_entry() doesn't look for it in the unused list.
+    if(get_state(texture) == TEXTURE_FAILED) {
+        remove_entry(cache, entry);
+        return;
+    }
+    entry->refs = 0;
+    lru_push(cache, entry);
+    trim(cache);
+}
+
+void av_texture_cache_set_budget(av_texture_cache_t *cache, size_t max_bytes) {
+    CCASSERT(cache);
+    cache->max_bytes = max_bytes;
+    trim(cache);
+}
+
+void av_texture_cache_get_stats(const av_texture_cache_t *cache, av_texture_cache_stats_t *stats) {
+    CCASSERT(cache);
+    CCASSERT(stats);
+    stats->bytes = cache->bytes;
+    stats->entries = cache->count;
+    stats->unused = cache->unused;
+    stats->hits = cache->hits;
+    stats->misses = cache->misses;
+    stats->evictions = cache->evictions;
+}
+
+void av_texture_cache_visit(const av_texture_cache_t *cache, av_texture_visit_f visit, void *data) {
+    CCASSERT(cache);
+    CCASSERT(visit);
+    for(unsigned i = 0; i < BUCKET_COUNT; ++i) {
+        for(const entry_t *e = cache->buckets[i]; e; e = e->next_in_bucket) {
+            visit(e->path, e->texture, e->refs, data);
+        }
+    }
+}
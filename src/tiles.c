@@ -0,0 +1,85 @@
+//===--------------------------------------------------------------------------------------------===
+// tiles.c - Parallel banded rasterization of a single display
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2021 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "display.h"
+#include <ccore/log.h>
+
+typedef struct {
+    av_display_draw_f draw;
+    void *data;
+    cairo_t *cairo;
+} band_t;
+
+static void draw_band(void *refcon) {
+    band_t *band = refcon;
+    band->draw(band->cairo, band->data);
+}
+
+// Each band gets its own image surface over its rows of the frame, so that no two threads ever
+// share Cairo objects. The device offset keeps user coordinates relative to the whole display.
+// Bands split the rows being drawn into, which are fewer than the display's when it is scaled.
+static cairo_t *create_band(av_display_t *display, cairo_t *parent, uint8_t *data, unsigned y0, unsigned y1) {
+    double scale = av_display_get_scale(display);
+    cairo_surface_t *surface = cairo_image_surface_create_for_data(
+        data + y0 * display->surface_stride,
+        display->cairo_format,
+        display->render_width,
+        y1 - y0,
+        display->surface_stride
+    );
+    cairo_surface_set_device_scale(surface, scale, scale);
+    cairo_surface_set_device_offset(surface, 0, -(double)y0);
+    cairo_t *cr = av_display_create_cairo(display, surface);
+    cairo_set_antialias(cr, cairo_get_antialias(parent));
+    cairo_surface_destroy(surface);
+
+    cairo_rectangle(cr, 0, y0 / scale, display->width, (y1 - y0) / scale);
+    cairo_clip(cr);
+    return cr;
+}
+
+bool av_display_draw_tiled(av_display_t *display, av_display_draw_f draw, void *data) {
+    CCASSERT(display);
+    CCASSERT(draw);
+
+    cairo_t *cr = av_display_get_cairo(display);
+    if(!cr) return false;
+    unsigned band_count = cc_min(display->band_count, display->render_height);
+    if(band_count < 2) {
+        draw(cr, data);
+        return true;
+    }
+
+    cairo_surface_t *target = cairo_get_target(cr);
+    cairo_surface_flush(target);
+    uint8_t *pixels = cairo_image_surface_get_data(target);
+    CCASSERT(pixels);
+
+    band_t bands[AV_DISPLAY_MAX_BANDS];
+    unsigned height = display->render_height / band_count;
+    for(unsigned i = 0; i < band_count; ++i) {
+        unsigned y0 = i * height;
+        unsigned y1 = i == band_count - 1 ? display->render_height : y0 + height;
+        bands[i].draw = draw;
+        bands[i].data = data;
+        bands[i].cairo = create_band(display, cr, pixels, y0, y1);
+    }
+
+    for(unsigned i = 1; i < band_count; ++i) {
+        av_pool_submit(display->pool, draw_band, &bands[i]);
+    }
+    draw_band(&bands[0]);
+    av_pool_wait(display->pool);
+
+    for(unsigned i = 0; i < band_count; ++i) {
+        cairo_destroy(bands[i].cairo);
+    }
+    // We wrote to the surface's memory behind the display context's back.
+    cairo_surface_mark_dirty(target);
+    return true;
+}
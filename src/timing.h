@@ -0,0 +1,30 @@
+//===--------------------------------------------------------------------------------------------===
+// timing.h - Monotonic clock for frame pacing and statistics
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2021 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#pragma once
+#include <stdint.h>
+
+#if WIN32
+#include <windows.h>
+#else /* !WIN32 */
+#include <time.h>
+#endif /* !WIN32 */
+
+/// Returns a monotonic timestamp in microseconds. Only differences between two calls are useful.
+static inline uint64_t av_time_us(void) {
+#if WIN32
+    LARGE_INTEGER val, freq;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&val);
+    return (uint64_t)(((double)val.QuadPart / (double)freq.QuadPart) * 1000000.0);
+#else    /* !WIN32 */
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000llu + (uint64_t)ts.tv_nsec / 1000llu;
+#endif    /* !WIN32 */
+}
@@ -0,0 +1,648 @@
+//===--------------------------------------------------------------------------------------------===
+// vector.c - GL renderer for vector displays: stencil-then-cover paths and glyph atlases
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2021 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "display.h"
+#include "vector.h"
+#include "timing.h"
+#include <ccore/memory.h>
+#include <ccore/log.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include <pthread.h>
+#include <string.h>
+
+#define FONT_ATLAS_SIZE (512)
+#define MAX_SAMPLES (4)
+
+static const char *vert_shader =
+    "#version 120\n"
+    "uniform mat4   pvm;\n"
+    "attribute vec2 vtx_pos;\n"
+    "attribute vec2 vtx_tex0;\n"
+    "varying vec2   tex_coord;\n"
+    "void main() {\n"
+    "    tex_coord = vtx_tex0;\n"
+    "    gl_Position = pvm * vec4(vtx_pos, 0.0, 1.0);\n"
+    "}\n";
+
+// Paths are flat colour; glyphs are coverage from the font's atlas.
+static const char *frag_shader =
+    "#version 120\n"
+    "uniform sampler2D	tex;\n"
+    "uniform vec4	color;\n"
+    "uniform int	is_text;\n"
+    "varying vec2	tex_coord;\n"
+    "void main() {\n"
+    "    gl_FragColor = is_text != 0 ? color * texture2D(tex, tex_coord).r : color;\n"
+    "}\n";
+
+typedef struct {
+    bool is_loaded;
+    // Quad relative to the pen position on the baseline, in pixels, y down.
+    float x0, y0, x1, y1;
+    float u0, v0, u1, v1;
+    float advance;
+} glyph_t;
+
+typedef struct {
+    uint32_t codepoint;
+    glyph_t glyph;
+} extra_glyph_t;
+
+struct av_font_s {
+    FT_Library library;
+    FT_Face face;
+
+    // Glyphs are rasterised the first time they are drawn, on the GL thread.
+    unsigned texture;
+    unsigned shelf_x;
+    unsigned shelf_y;
+    unsigned shelf_height;
+    bool is_full;
+
+    glyph_t ascii[128];
+    extra_glyph_t *extra;
+    unsigned extra_count;
+    unsigned extra_capacity;
+};
+
+struct av_vector_s {
+    unsigned width, height;
+
+    // The drawing thread records into [recording], and hands it over as [pending]. The GL thread
+    // renders from [rendering]. A pending list that wasn't rendered yet is replaced.
+    av_canvas_t canvas;
+    av_vector_list_t lists[3];
+    av_vector_list_t *recording;
+    av_vector_list_t *pending;
+    av_vector_list_t *rendering;
+    bool has_pending;
+    bool is_recording;
+    pthread_mutex_t mt;
+
+    // Multisampled displays are drawn into [msaa_fbo], and resolved into [fbo].
+    unsigned texture;
+    unsigned fbo;
+    unsigned msaa_fbo;
+    unsigned color_rb;
+    unsigned stencil_rb;
+    unsigned samples;
+    unsigned vbo;
+    float proj[16];
+};
+
+static unsigned program = 0;
+static unsigned program_users = 0;
+static struct {
+    int pvm;
+    int tex;
+    int color;
+    int is_text;
+    int vtx_pos;
+    int vtx_tex0;
+} loc;
+
+// MARK: - Fonts
+
+av_font_t *av_font_new(const char *path, double size) {
+    CCASSERT(path);
+    CCASSERT(size > 0);
+
+    av_font_t *font = cc_alloc(sizeof(av_font_t));
+    // Each font has its own library, so that fonts can be used from different threads.
+    if(FT_Init_FreeType(&font->library)) {
+        CCERROR("unable to initialise FreeType");
+        cc_free(font);
+        return NULL;
+    }
+    if(FT_New_Face(font->library, path, 0, &font->face)) {
+        CCERROR("unable to load font `%s`", path);
+        FT_Done_FreeType(font->library);
+        cc_free(font);
+        return NULL;
+    }
+    FT_Set_Pixel_Sizes(font->face, 0, (FT_UInt)size);
+
+    font->texture = 0;
+    font->shelf_x = 0;
+    font->shelf_y = 0;
+    font->shelf_height = 0;
+    font->is_full = false;
+    memset(font->ascii, 0, sizeof(font->ascii));
+    font->extra = NULL;
+    font->extra_count = 0;
+    font->extra_capacity = 0;
+    return font;
+}
+
+void av_font_delete(av_font_t *font) {
+    CCASSERT(font);
+    if(font->texture) av_gl_delete_textures(1, &font->texture);
+    FT_Done_Face(font->face);
+    FT_Done_FreeType(font->library);
+    cc_free(font->extra);
+    cc_free(font);
+}
+
+static void init_font_texture(av_font_t *font) {
+    glGenTextures(1, &font->texture);
+    av_gl_bind_texture(0, font->texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, FONT_ATLAS_SIZE, FONT_ATLAS_SIZE, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    // Start blank, or the filtering at glyph edges picks up garbage.
+    uint8_t *zero = cc_alloc(FONT_ATLAS_SIZE * FONT_ATLAS_SIZE);
+    memset(zero, 0, FONT_ATLAS_SIZE * FONT_ATLAS_SIZE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, FONT_ATLAS_SIZE, FONT_ATLAS_SIZE, GL_RED, GL_UNSIGNED_BYTE, zero);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    cc_free(zero);
+    CHECK_GL();
+}
+
+// Glyphs are packed in shelves, with a pixel of padding so that linear filtering doesn't bleed.
+static void load_glyph(av_font_t *font, uint32_t codepoint, glyph_t *glyph) {
+    glyph->is_loaded = true;
+    if(FT_Load_Char(font->face, codepoint, FT_LOAD_RENDER)) return;
+
+    FT_GlyphSlot slot = font->face->glyph;
+    const FT_Bitmap *bitmap = &slot->bitmap;
+    glyph->advance = slot->advance.x / 64.f;
+    if(!bitmap->width || !bitmap->rows) return;
+
+    unsigned width = bitmap->width + 1, height = bitmap->rows + 1;
+    if(font->shelf_x + width > FONT_ATLAS_SIZE) {
+        font->shelf_y += font->shelf_height;
+        font->shelf_x = 0;
+        font->shelf_height = 0;
+    }
+    if(font->shelf_y + height > FONT_ATLAS_SIZE) {
+        if(!font->is_full) CCERROR("font atlas is full, some glyphs won't be drawn");
+        font->is_full = true;
+        return;
+    }
+
+    if(!font->texture) init_font_texture(font);
+    av_gl_bind_texture(0, font->texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, bitmap->pitch);
+    glTexSubImage2D(
+        GL_TEXTURE_2D, 0, font->shelf_x, font->shelf_y, bitmap->width, bitmap->rows,
+        GL_RED, GL_UNSIGNED_BYTE, bitmap->buffer
+    );
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    CHECK_GL();
+
+    glyph->x0 = slot->bitmap_left;
+    glyph->y0 = -slot->bitmap_top;
+    glyph->x1 = glyph->x0 + bitmap->width;
+    glyph->y1 = glyph->y0 + bitmap->rows;
+    glyph->u0 = (float)font->shelf_x / FONT_ATLAS_SIZE;
+    glyph->v0 = (float)font->shelf_y / FONT_ATLAS_SIZE;
+    glyph->u1 = (float)(font->shelf_x + bitmap->width) / FONT_ATLAS_SIZE;
+    glyph->v1 = (float)(font->shelf_y + bitmap->rows) / FONT_ATLAS_SIZE;
+
+    font->shelf_x += width;
+    font->shelf_height = cc_max(font->shelf_height, height);
+}
+
+static const glyph_t *get_glyph(av_font_t *font, uint32_t codepoint) {
+    glyph_t *glyph = NULL;
+    if(codepoint < 128) {
+        glyph = &font->ascii[codepoint];
+    } else {
+        for(unsigned i = 0; i < font->extra_count; ++i) {
+            if(font->extra[i].codepoint == codepoint) return &font->extra[i].glyph;
+        }
+        if(font->extra_count == font->extra_capacity) {
+            font->extra_capacity = font->extra_capacity ? font->extra_capacity * 2 : 32;
+            font->extra = cc_realloc(font->extra, font->extra_capacity * sizeof(extra_glyph_t));
+        }
+        extra_glyph_t *extra = &font->extra[font->extra_count++];
+        memset(extra, 0, sizeof(*extra));
+        extra->codepoint = codepoint;
+        glyph = &extra->glyph;
+    }
+    if(!glyph->is_loaded) load_glyph(font, codepoint, glyph);
+    return glyph;
+}
+
+// Malformed sequences come out as one replacement character per byte.
+static uint32_t next_codepoint(const char **text) {
+    const uint8_t *s = (const uint8_t *)*text;
+    uint32_t c = s[0];
+    unsigned length = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xe ? 3 : (c >> 3) == 0x1e ? 4 : 0;
+    if(!length) {
+        *text += 1;
+        return 0xfffd;
+    }
+    if(length > 1) c &= 0x3f >> (length - 1);
+    for(unsigned i = 1; i < length; ++i) {
+        if((s[i] & 0xc0) != 0x80) {
+            *text += 1;
+            return 0xfffd;
+        }
+        c = (c << 6) | (s[i] & 0x3f);
+    }
+    *text += length;
+    return c;
+}
+
+static av_vector_vertex_t glyph_vertex(const av_vector_cmd_t *cmd, float x, float y, float u, float v) {
+    const float *m = cmd->matrix;
+    return (av_vector_vertex_t){
+        cmd->origin_x + m[0] * x + m[2] * y,
+        cmd->origin_y + m[1] * x + m[3] * y,
+        u, v
+    };
+}
+
+// Turns text commands into textured quads, rasterising the glyphs they need on the way.
+static void layout_text(av_vector_list_t *list) {
+    for(unsigned i = 0; i < list->cmd_count; ++i) {
+        av_vector_cmd_t *cmd = &list->cmds[i];
+        if(cmd->op != AV_VECTOR_TEXT) continue;
+        cmd->first = list->vertex_count;
+
+        const char *text = list->text + cmd->text;
+        float pen = 0;
+        while(*text) {
+            const glyph_t *glyph = get_glyph(cmd->font, next_codepoint(&text));
+            if(glyph->x1 > glyph->x0) {
+                float x0 = pen + glyph->x0, x1 = pen + glyph->x1;
+                av_vector_vertex_t a = glyph_vertex(cmd, x0, glyph->y0, glyph->u0, glyph->v0);
+                av_vector_vertex_t b = glyph_vertex(cmd, x1, glyph->y0, glyph->u1, glyph->v0);
+                av_vector_vertex_t c = glyph_vertex(cmd, x1, glyph->y1, glyph->u1, glyph->v1);
+                av_vector_vertex_t d = glyph_vertex(cmd, x0, glyph->y1, glyph->u0, glyph->v1);
+                av_vector_vertex_t *v = av_vector_list_alloc(list, 6);
+                v[0] = a; v[1] = b; v[2] = c;
+                v[3] = a; v[4] = c; v[5] = d;
+            }
+            pen += glyph->advance;
+        }
+        cmd->count = list->vertex_count - cmd->first;
+    }
+}
+
+// MARK: - Framebuffers
+
+static bool init_program(void) {
+    if(program_users++) return true;
+    program = gl_create_program(vert_shader, frag_shader);
+    if(!program) {
+        program_users = 0;
+        return false;
+    }
+    loc.pvm = glGetUniformLocation(program, "pvm");
+    loc.tex = glGetUniformLocation(program, "tex");
+    loc.color = glGetUniformLocation(program, "color");
+    loc.is_text = glGetUniformLocation(program, "is_text");
+    loc.vtx_pos = glGetAttribLocation(program, "vtx_pos");
+    loc.vtx_tex0 = glGetAttribLocation(program, "vtx_tex0");
+    return true;
+}
+
+static void release_program(void) {
+    if(--program_users) return;
+    av_gl_delete_program(program);
+    program = 0;
+}
+
+static bool init_framebuffers(av_vector_t *vector) {
+    unsigned width = vector->width, height = vector->height;
+    glGenTextures(1, &vector->texture);
+    av_gl_bind_texture(0, vector->texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    av_gl_bind_texture(0, 0);
+
+    GLint max_samples = 0;
+    glGetIntegerv(GL_MAX_SAMPLES, &max_samples);
+    vector->samples = cc_min(MAX_SAMPLES, max_samples > 1 ? max_samples : 0);
+
+    glGenFramebuffers(1, &vector->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, vector->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, vector->texture, 0);
+    bool is_complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+    // Without multisampling, the stencil goes straight onto the texture's framebuffer.
+    glGenRenderbuffers(1, &vector->stencil_rb);
+    glBindRenderbuffer(GL_RENDERBUFFER, vector->stencil_rb);
+    if(vector->samples) {
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, vector->samples, GL_DEPTH24_STENCIL8, width, height);
+        glGenRenderbuffers(1, &vector->color_rb);
+        glBindRenderbuffer(GL_RENDERBUFFER, vector->color_rb);
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, vector->samples, GL_RGBA8, width, height);
+
+        glGenFramebuffers(1, &vector->msaa_fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, vector->msaa_fbo);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, vector->color_rb);
+    } else {
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+        vector->color_rb = 0;
+        vector->msaa_fbo = 0;
+    }
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, vector->stencil_rb);
+    is_complete = is_complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    CHECK_GL();
+    return is_complete;
+}
+
+static void deinit_framebuffers(av_vector_t *vector) {
+    if(vector->msaa_fbo) glDeleteFramebuffers(1, &vector->msaa_fbo);
+    if(vector->color_rb) glDeleteRenderbuffers(1, &vector->color_rb);
+    glDeleteRenderbuffers(1, &vector->stencil_rb);
+    glDeleteFramebuffers(1, &vector->fbo);
+    av_gl_delete_textures(1, &vector->texture);
+}
+
+av_vector_t *av_vector_new(unsigned width, unsigned height) {
+    if(!GLAD_GL_VERSION_3_0) {
+        CCERROR("vector displays need OpenGL 3.0");
+        return NULL;
+    }
+    if(!init_program()) return NULL;
+
+    av_vector_t *vector = cc_alloc(sizeof(av_vector_t));
+    vector->width = width;
+    vector->height = height;
+    if(!init_framebuffers(vector)) {
+        CCERROR("unable to create a %ux%u vector framebuffer", width, height);
+        deinit_framebuffers(vector);
+        release_program();
+        cc_free(vector);
+        return NULL;
+    }
+    glGenBuffers(1, &vector->vbo);
+    // Framebuffer row 0 is the bottom of the viewport, and has to end up as the texture's top row.
+    gl_ortho(vector->proj, 0, height, width, -(float)height);
+
+    av_canvas_init(&vector->canvas);
+    memset(vector->lists, 0, sizeof(vector->lists));
+    vector->recording = &vector->lists[0];
+    vector->pending = &vector->lists[1];
+    vector->rendering = &vector->lists[2];
+    vector->has_pending = false;
+    vector->is_recording = false;
+    pthread_mutex_init(&vector->mt, NULL);
+    return vector;
+}
+
+void av_vector_delete(av_vector_t *vector) {
+    CCASSERT(vector);
+    av_gl_delete_buffers(1, &vector->vbo);
+    deinit_framebuffers(vector);
+    release_program();
+    av_canvas_deinit(&vector->canvas);
+    for(unsigned i = 0; i < 3; ++i) {
+        av_vector_list_deinit(&vector->lists[i]);
+    }
+    pthread_mutex_destroy(&vector->mt);
+    cc_free(vector);
+}
+
+unsigned av_vector_get_texture(const av_vector_t *vector) {
+    CCASSERT(vector);
+    return vector->texture;
+}
+
+// MARK: - Frames
+
+av_canvas_t *av_vector_get_canvas(av_vector_t *vector) {
+    CCASSERT(vector);
+    if(!vector->is_recording) {
+        av_canvas_begin(&vector->canvas, vector->recording);
+        vector->is_recording = true;
+    }
+    return &vector->canvas;
+}
+
+bool av_vector_finish(av_vector_t *vector) {
+    CCASSERT(vector);
+    // Frames that weren't drawn into are blank.
+    av_vector_get_canvas(vector);
+    vector->is_recording = false;
+    vector->recording->published_us = av_time_us();
+
+    pthread_mutex_lock(&vector->mt);
+    av_vector_list_t *list = vector->pending;
+    vector->pending = vector->recording;
+    vector->recording = list;
+    bool dropped = vector->has_pending;
+    vector->has_pending = true;
+    pthread_mutex_unlock(&vector->mt);
+    return dropped;
+}
+
+typedef struct {
+    GLint func, ref, value_mask, write_mask;
+    GLint fail, depth_fail, depth_pass;
+} stencil_face_t;
+
+// X-Plane renders into its own framebuffers: whatever we touch has to be put back as it was.
+typedef struct {
+    GLint draw_fbo, read_fbo;
+    GLint viewport[4];
+    GLint program;
+    GLint array_buffer;
+    GLint active_texture;
+    GLint texture;              // Bound to unit 0, the one we draw with.
+    GLint blend_src_rgb, blend_dst_rgb, blend_src_alpha, blend_dst_alpha;
+    GLboolean blend, stencil, depth, scissor, cull;
+    GLfloat clear_color[4];
+    GLint clear_stencil;
+    GLboolean color_mask[4];
+    stencil_face_t front, back;
+} saved_state_t;
+
+static void save_state(saved_state_t *s) {
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &s->draw_fbo);
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &s->read_fbo);
+    glGetIntegerv(GL_VIEWPORT, s->viewport);
+    glGetIntegerv(GL_CURRENT_PROGRAM, &s->program);
+    glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &s->array_buffer);
+    glGetIntegerv(GL_ACTIVE_TEXTURE, &s->active_texture);
+    av_gl_active_texture(0);
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &s->texture);
+    glGetIntegerv(GL_BLEND_SRC_RGB, &s->blend_src_rgb);
+    glGetIntegerv(GL_BLEND_DST_RGB, &s->blend_dst_rgb);
+    glGetIntegerv(GL_BLEND_SRC_ALPHA, &s->blend_src_alpha);
+    glGetIntegerv(GL_BLEND_DST_ALPHA, &s->blend_dst_alpha);
+    s->blend = glIsEnabled(GL_BLEND);
+    s->stencil = glIsEnabled(GL_STENCIL_TEST);
+    s->depth = glIsEnabled(GL_DEPTH_TEST);
+    s->scissor = glIsEnabled(GL_SCISSOR_TEST);
+    s->cull = glIsEnabled(GL_CULL_FACE);
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, s->clear_color);
+    glGetIntegerv(GL_STENCIL_CLEAR_VALUE, &s->clear_stencil);
+    glGetBooleanv(GL_COLOR_WRITEMASK, s->color_mask);
+
+    glGetIntegerv(GL_STENCIL_FUNC, &s->front.func);
+    glGetIntegerv(GL_STENCIL_REF, &s->front.ref);
+    glGetIntegerv(GL_STENCIL_VALUE_MASK, &s->front.value_mask);
+    glGetIntegerv(GL_STENCIL_WRITEMASK, &s->front.write_mask);
+    glGetIntegerv(GL_STENCIL_FAIL, &s->front.fail);
+    glGetIntegerv(GL_STENCIL_PASS_DEPTH_FAIL, &s->front.depth_fail);
+    glGetIntegerv(GL_STENCIL_PASS_DEPTH_PASS, &s->front.depth_pass);
+    glGetIntegerv(GL_STENCIL_BACK_FUNC, &s->back.func);
+    glGetIntegerv(GL_STENCIL_BACK_REF, &s->back.ref);
+    glGetIntegerv(GL_STENCIL_BACK_VALUE_MASK, &s->back.value_mask);
+    glGetIntegerv(GL_STENCIL_BACK_WRITEMASK, &s->back.write_mask);
+    glGetIntegerv(GL_STENCIL_BACK_FAIL, &s->back.fail);
+    glGetIntegerv(GL_STENCIL_BACK_PASS_DEPTH_FAIL, &s->back.depth_fail);
+    glGetIntegerv(GL_STENCIL_BACK_PASS_DEPTH_PASS, &s->back.depth_pass);
+}
+
+static void restore_stencil_face(GLenum face, const stencil_face_t *s) {
+    glStencilFuncSeparate(face, s->func, s->ref, s->value_mask);
+    glStencilMaskSeparate(face, s->write_mask);
+    glStencilOpSeparate(face, s->fail, s->depth_fail, s->depth_pass);
+}
+
+static void set_enabled(GLenum cap, GLboolean enabled) {
+    if(enabled) glEnable(cap);
+    else glDisable(cap);
+}
+
+static void restore_state(const saved_state_t *s) {
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, s->draw_fbo);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, s->read_fbo);
+    glViewport(s->viewport[0], s->viewport[1], s->viewport[2], s->viewport[3]);
+    av_gl_use_program(s->program);
+    av_gl_bind_buffer(GL_ARRAY_BUFFER, s->array_buffer);
+    av_gl_bind_texture(0, s->texture);
+    av_gl_active_texture(s->active_texture - GL_TEXTURE0);
+    glBlendFuncSeparate(s->blend_src_rgb, s->blend_dst_rgb, s->blend_src_alpha, s->blend_dst_alpha);
+    set_enabled(GL_BLEND, s->blend);
+    set_enabled(GL_STENCIL_TEST, s->stencil);
+    set_enabled(GL_DEPTH_TEST, s->depth);
+    set_enabled(GL_SCISSOR_TEST, s->scissor);
+    set_enabled(GL_CULL_FACE, s->cull);
+    glClearColor(s->clear_color[0], s->clear_color[1], s->clear_color[2], s->clear_color[3]);
+    glClearStencil(s->clear_stencil);
+    glColorMask(s->color_mask[0], s->color_mask[1], s->color_mask[2], s->color_mask[3]);
+    restore_stencil_face(GL_FRONT, &s->front);
+    restore_stencil_face(GL_BACK, &s->back);
+}
+
+// Stencil, then cover: the triangles mark the covered pixels in the stencil, and the bounding quad
+// paints them, resetting the stencil as it goes. Fills count windings, strokes just mark.
+static void draw_path(const av_vector_cmd_t *cmd) {
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glStencilFunc(GL_ALWAYS, 1, 0xff);
+    if(cmd->op == AV_VECTOR_FILL) {
+        glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_KEEP, GL_INCR_WRAP);
+        glStencilOpSeparate(GL_BACK, GL_KEEP, GL_KEEP, GL_DECR_WRAP);
+    } else {
+        glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+    }
+    glDrawArrays(GL_TRIANGLES, cmd->first, cmd->count);
+
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glStencilFunc(GL_NOTEQUAL, 0, 0xff);
+    glStencilOp(GL_ZERO, GL_ZERO, GL_ZERO);
+    glUniform4fv(loc.color, 1, cmd->color);
+    glDrawArrays(GL_TRIANGLES, cmd->first + cmd->count, 6);
+}
+
+static void draw_text(const av_vector_cmd_t *cmd) {
+    if(!cmd->count || !cmd->font->texture) return;
+    glDisable(GL_STENCIL_TEST);
+    av_gl_bind_texture(0, cmd->font->texture);
+    glUniform1i(loc.is_text, 1);
+    glUniform4fv(loc.color, 1, cmd->color);
+    glDrawArrays(GL_TRIANGLES, cmd->first, cmd->count);
+    glUniform1i(loc.is_text, 0);
+    glEnable(GL_STENCIL_TEST);
+}
+
+static void draw_list(av_vector_t *vector, const av_vector_list_t *list) {
+    glBindFramebuffer(GL_FRAMEBUFFER, vector->samples ? vector->msaa_fbo : vector->fbo);
+    glViewport(0, 0, vector->width, vector->height);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_SCISSOR_TEST);
+    glDisable(GL_CULL_FACE);
+    glEnable(GL_STENCIL_TEST);
+    glStencilMask(0xff);
+    glClearColor(0, 0, 0, 0);
+    glClearStencil(0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+    av_gl_use_program(program);
+    glUniformMatrix4fv(loc.pvm, 1, GL_TRUE, vector->proj);
+    glUniform1i(loc.tex, 0);
+    glUniform1i(loc.is_text, 0);
+    av_gl_active_texture(0);
+
+    av_gl_bind_buffer(GL_ARRAY_BUFFER, vector->vbo);
+    glBufferData(GL_ARRAY_BUFFER, list->vertex_count * sizeof(av_vector_vertex_t), list->vertices, GL_STREAM_DRAW);
+    av_gl_enable_attrib(loc.vtx_pos);
+    glVertexAttribPointer(loc.vtx_pos, 2, GL_FLOAT, GL_FALSE, sizeof(av_vector_vertex_t), (void *)offsetof(av_vector_vertex_t, x));
+    if(loc.vtx_tex0 != -1) {
+        av_gl_enable_attrib(loc.vtx_tex0);
+        glVertexAttribPointer(loc.vtx_tex0, 2, GL_FLOAT, GL_FALSE, sizeof(av_vector_vertex_t), (void *)offsetof(av_vector_vertex_t, u));
+    }
+
+    for(unsigned i = 0; i < list->cmd_count; ++i) {
+        const av_vector_cmd_t *cmd = &list->cmds[i];
+        if(cmd->op == AV_VECTOR_TEXT) draw_text(cmd);
+        else draw_path(cmd);
+    }
+
+    av_gl_disable_attrib(loc.vtx_pos);
+    if(loc.vtx_tex0 != -1) av_gl_disable_attrib(loc.vtx_tex0);
+
+    if(vector->samples) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, vector->msaa_fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, vector->fbo);
+        glBlitFramebuffer(
+            0, 0, vector->width, vector->height,
+            0, 0, vector->width, vector->height,
+            GL_COLOR_BUFFER_BIT, GL_NEAREST
+        );
+    }
+    CHECK_GL();
+}
+
+bool av_vector_render(av_vector_t *vector, av_gpu_timer_t *timer, uint64_t *published_us) {
+    CCASSERT(vector);
+    CCASSERT(timer);
+    pthread_mutex_lock(&vector->mt);
+    if(!vector->has_pending) {
+        pthread_mutex_unlock(&vector->mt);
+        return false;
+    }
+    av_vector_list_t *list = vector->pending;
+    vector->pending = vector->rendering;
+    vector->rendering = list;
+    vector->has_pending = false;
+    pthread_mutex_unlock(&vector->mt);
+
+    av_gpu_timer_begin(timer);
+    saved_state_t state;
+    save_state(&state);
+    layout_text(list);
+    draw_list(vector, list);
+    restore_state(&state);
+    av_gpu_timer_end(timer);
+    CHECK_GL();
+
+    *published_us = list->published_us;
+    return true;
+}
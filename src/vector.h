@@ -0,0 +1,94 @@
+//===--------------------------------------------------------------------------------------------===
+// vector.h - Command lists shared by the canvas recorder and the GL vector renderer
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2021 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#pragma once
+#include <libavionics/canvas.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define AV_CANVAS_MAX_DEPTH (16)
+
+typedef struct {
+    float x, y;
+    float u, v;
+} av_vector_vertex_t;
+
+typedef enum {
+    AV_VECTOR_FILL,
+    AV_VECTOR_STROKE,
+    AV_VECTOR_TEXT,
+} av_vector_op_t;
+
+// Fills and strokes are triangles in device pixels, drawn into the stencil buffer, then covered
+// by the six vertices that follow them. Text is laid out by the renderer, which owns the fonts.
+typedef struct {
+    av_vector_op_t op;
+    float color[4];             // Premultiplied.
+    unsigned first;
+    unsigned count;             // Not counting the cover quad.
+
+    av_font_t *font;
+    float origin_x, origin_y;
+    float matrix[4];            // Linear part of the transform: xx, yx, xy, yy.
+    unsigned text;              // Offset of the string in the list's text.
+} av_vector_cmd_t;
+
+typedef struct {
+    av_vector_cmd_t *cmds;
+    unsigned cmd_count;
+    unsigned cmd_capacity;
+
+    av_vector_vertex_t *vertices;
+    unsigned vertex_count;
+    unsigned vertex_capacity;
+
+    char *text;
+    unsigned text_size;
+    unsigned text_capacity;
+
+    uint64_t published_us;
+} av_vector_list_t;
+
+typedef struct {
+    double matrix[6];           // xx, yx, xy, yy, x0, y0, as in cairo_matrix_t.
+    float color[4];
+    double line_width;
+    av_font_t *font;
+} av_canvas_state_t;
+
+typedef struct {
+    unsigned first;
+    unsigned count;
+    bool closed;
+} av_subpath_t;
+
+struct av_canvas_s {
+    av_vector_list_t *list;
+
+    // The current path is flattened into device space as it is built.
+    av_vector_vertex_t *points;
+    unsigned point_count;
+    unsigned point_capacity;
+    av_subpath_t *subpaths;
+    unsigned subpath_count;
+    unsigned subpath_capacity;
+
+    av_canvas_state_t state;
+    av_canvas_state_t stack[AV_CANVAS_MAX_DEPTH];
+    unsigned depth;
+};
+
+void av_vector_list_reset(av_vector_list_t *list);
+void av_vector_list_deinit(av_vector_list_t *list);
+av_vector_vertex_t *av_vector_list_alloc(av_vector_list_t *list, unsigned count);
+
+void av_canvas_init(av_canvas_t *canvas);
+void av_canvas_deinit(av_canvas_t *canvas);
+
+// Starts recording a frame into [list], from a blank state.
+void av_canvas_begin(av_canvas_t *canvas, av_vector_list_t *list);
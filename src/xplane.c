@@ -7,6 +7,7 @@
 // =^•.•^=
 //===--------------------------------------------------------------------------------------------===
 #include <libavionics/xplane.h>
+#include <libavionics/gl.h>
 #include <ccore/log.h>
 #include <ccore/filesystem.h>
 #include <XPLMUtilities.h>
@@ -73,6 +74,12 @@ bool xp_path_file_exists(const char *file) {
     return access(file, F_OK) == 0;
 }
 
+void xp_use_program_cache(const char *directory) {
+    char path[1024];
+    xp_path_plugin_prefix(directory, path, sizeof(path));
+    gl_set_program_cache(path);
+}
+
 XPLMDataRef xp_find_dr(const char *path, bool *success) {
     CCDEBUG("resolving dataref `%s`", path);
     XPLMDataRef ref = XPLMFindDataRef(path);
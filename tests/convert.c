@@ -0,0 +1,113 @@
+//===--------------------------------------------------------------------------------------------===
+// convert.c - Checks every SIMD pixel conversion kernel against the scalar ones, byte for byte
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2021 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "convert.h"
+#include "test.h"
+#include <stdint.h>
+#include <string.h>
+
+// Every channel value over every alpha, in each colour channel.
+#define PAIRS (256 * 256)
+// Longer than two AVX2 loops, so every kernel runs its vector loop and every length of tail.
+#define MAX_LENGTH (67)
+// Kernels must not care about alignment, up to that of the widest vectors.
+#define MAX_OFFSET (32)
+// Bytes around the destination that nothing may write to.
+#define GUARD (32)
+#define GUARD_BYTE (0xa5)
+
+#define MAX_BYTES (MAX_OFFSET + PAIRS * 4 + GUARD)
+
+static uint8_t src[MAX_BYTES];
+static uint8_t expected[GUARD + MAX_BYTES];
+static uint8_t actual[GUARD + MAX_BYTES];
+
+static const char *op_names[AV_CONVERT_COUNT] = {
+    [AV_CONVERT_COPY] = "copy",
+    [AV_CONVERT_UNPREMULTIPLY] = "unpremultiply",
+    [AV_CONVERT_SWIZZLE] = "swizzle",
+    [AV_CONVERT_UNPREMULTIPLY_SWIZZLE] = "unpremultiply+swizzle",
+    [AV_CONVERT_RGB565] = "rgb565",
+    [AV_CONVERT_A8] = "a8",
+};
+
+static uint32_t random_state = 0x2545f491;
+
+static uint32_t next_random() {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static void store_pixel(uint8_t *dst, uint32_t pixel) {
+    memcpy(dst, &pixel, sizeof(pixel));
+}
+
+// Runs both kernels over the same pixels, into guarded buffers, and compares everything.
+static void compare(unsigned isa, av_convert_op_t op, size_t src_offset, size_t dst_offset, size_t count) {
+    size_t size = count * (op == AV_CONVERT_COPY ? 4 : av_convert_dst_bpp(op));
+    size_t total = GUARD + dst_offset + size + GUARD;
+    memset(expected, GUARD_BYTE, total);
+    memset(actual, GUARD_BYTE, total);
+
+    av_convert_get_reference_row(op)(expected + GUARD + dst_offset, src + src_offset, count);
+    av_convert_get_isa_row(isa, op)(actual + GUARD + dst_offset, src + src_offset, count);
+    if(!memcmp(expected, actual, total)) return;
+
+    size_t i = 0;
+    while(expected[i] == actual[i]) i += 1;
+    fprintf(stderr, "%s %s, %zu pixels from offset %zu to offset %zu: byte %td is %02x, not %02x\n",
+        av_convert_get_isa_name(isa), op_names[op], count, src_offset, dst_offset,
+        (ptrdiff_t)i - (ptrdiff_t)(GUARD + dst_offset), actual[i], expected[i]);
+    exit(EXIT_FAILURE);
+}
+
+// Each pixel pairs one alpha with one value of the channel at [shift]. The other two channels get
+// values that change from one pixel to the next, without going over the alpha much.
+static void check_pairs(unsigned isa, av_convert_op_t op, unsigned shift) {
+    for(uint32_t i = 0; i < PAIRS; ++i) {
+        uint32_t a = i >> 8, c = i & 0xff;
+        uint32_t pixel = a << 24;
+        for(unsigned channel = 0; channel < 24; channel += 8) {
+            uint32_t value = channel == shift ? c : next_random() % (a + 2);
+            pixel |= (value > 0xff ? 0xff : value) << channel;
+        }
+        store_pixel(src + 4 * i, pixel);
+    }
+    compare(isa, op, 0, 0, PAIRS);
+}
+
+static void check_lengths(unsigned isa, av_convert_op_t op) {
+    for(size_t i = 0; i < MAX_OFFSET + MAX_LENGTH * 4; ++i) src[i] = next_random();
+
+    for(size_t count = 0; count <= MAX_LENGTH; ++count) {
+        for(size_t src_offset = 0; src_offset < MAX_OFFSET; ++src_offset) {
+            for(size_t dst_offset = 0; dst_offset < MAX_OFFSET; ++dst_offset) {
+                compare(isa, op, src_offset, dst_offset, count);
+            }
+        }
+    }
+}
+
+int main(void) {
+    unsigned isa_count = av_convert_get_isa_count();
+    CHECK(isa_count >= 1);
+    CHECK(!strcmp(av_convert_get_isa_name(isa_count - 1), av_convert_get_isa()));
+
+    // The scalar kernels are the reference: only the others have anything to be checked against.
+    for(unsigned isa = 1; isa < isa_count; ++isa) {
+        for(unsigned op = 0; op < AV_CONVERT_COUNT; ++op) {
+            CHECK(av_convert_get_isa_row(isa, op));
+            for(unsigned shift = 0; shift < 24; shift += 8) check_pairs(isa, op, shift);
+            check_lengths(isa, op);
+        }
+        printf("%s: all kernels match\n", av_convert_get_isa_name(isa));
+    }
+    return EXIT_SUCCESS;
+}
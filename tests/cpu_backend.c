@@ -0,0 +1,324 @@
+//===--------------------------------------------------------------------------------------------===
+// cpu_backend.c - Checks the pixels CPU backend displays hand to their consumer
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2021 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include <libavionics/display.h>
+#include <libavionics/xplane.h>
+#include "test.h"
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define WIDTH (45)
+#define HEIGHT (29)
+#define MAX_BPP (4)
+
+// The second frame only redraws this rectangle, over the first frame's background.
+#define RECT_X (7)
+#define RECT_Y (5)
+#define RECT_WIDTH (19)
+#define RECT_HEIGHT (11)
+
+typedef struct {
+    double r, g, b, a;
+} colour_t;
+
+// Like a texture would, the consumer keeps a whole frame, and only updates what was damaged.
+typedef struct {
+    av_display_format_t format;
+    unsigned bpp;
+    uint8_t pixels[WIDTH * HEIGHT * MAX_BPP];
+    unsigned frames;
+    uint64_t last_seq;
+    unsigned damage[4];
+} consumer_t;
+
+static unsigned bytes_per_pixel(av_display_format_t format) {
+    switch(format) {
+    case AV_DISPLAY_FORMAT_A8:
+    case AV_DISPLAY_FORMAT_INDEX8:
+        return 1;
+    case AV_DISPLAY_FORMAT_RGB565:
+        return 2;
+    default:
+        return 4;
+    }
+}
+
+// What [colour] should end up as in memory. Only used with channels at 0 or 1, which no format
+// has to round.
+static void pack(av_display_format_t format, colour_t colour, uint8_t *out) {
+    uint8_t r = colour.r * 255, g = colour.g * 255, b = colour.b * 255, a = colour.a * 255;
+    switch(format) {
+    case AV_DISPLAY_FORMAT_ARGB32: {
+        uint32_t argb = (uint32_t)a << 24 | (uint32_t)r << 16 | (uint32_t)g << 8 | b;
+        memcpy(out, &argb, sizeof(argb));
+        break;
+    }
+    case AV_DISPLAY_FORMAT_RGBA32:
+        out[0] = r;
+        out[1] = g;
+        out[2] = b;
+        out[3] = a;
+        break;
+    case AV_DISPLAY_FORMAT_RGB565: {
+        uint16_t rgb = (uint16_t)(r >> 3) << 11 | (uint16_t)(g >> 2) << 5 | b >> 3;
+        memcpy(out, &rgb, sizeof(rgb));
+        break;
+    }
+    default:
+        out[0] = a;
+        break;
+    }
+}
+
+static void consume(const av_display_frame_t *frame, void *data) {
+    consumer_t *consumer = data;
+    CHECK(frame->format == consumer->format);
+    CHECK(frame->width == WIDTH && frame->height == HEIGHT);
+    CHECK(frame->stride >= WIDTH * consumer->bpp);
+    CHECK(frame->seq > consumer->last_seq);
+    CHECK(frame->damage_x + frame->damage_width <= WIDTH);
+    CHECK(frame->damage_y + frame->damage_height <= HEIGHT);
+
+    for(unsigned y = frame->damage_y; y < frame->damage_y + frame->damage_height; ++y) {
+        size_t size = frame->damage_width * consumer->bpp;
+        const uint8_t *src = frame->pixels + y * frame->stride + frame->damage_x * consumer->bpp;
+        memcpy(consumer->pixels + (y * WIDTH + frame->damage_x) * consumer->bpp, src, size);
+    }
+    consumer->frames += 1;
+    consumer->last_seq = frame->seq;
+    consumer->damage[0] = frame->damage_x;
+    consumer->damage[1] = frame->damage_y;
+    consumer->damage[2] = frame->damage_width;
+    consumer->damage[3] = frame->damage_height;
+}
+
+static void fill(av_display_t *display, colour_t colour, int x, int y, int width, int height) {
+    cairo_t *cr = av_display_get_cairo(display);
+    CHECK(cr);
+    av_display_damage(display, x, y, width, height);
+    cairo_save(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+    cairo_set_source_rgba(cr, colour.r, colour.g, colour.b, colour.a);
+    cairo_rectangle(cr, x, y, width, height);
+    cairo_fill(cr);
+    cairo_restore(cr);
+}
+
+static bool is_inside_rect(unsigned x, unsigned y) {
+    return x >= RECT_X && x < RECT_X + RECT_WIDTH && y >= RECT_Y && y < RECT_Y + RECT_HEIGHT;
+}
+
+static void check_pixels(const consumer_t *consumer, colour_t background, colour_t rect, bool has_rect) {
+    uint8_t expected[2][MAX_BPP];
+    pack(consumer->format, background, expected[0]);
+    pack(consumer->format, rect, expected[1]);
+
+    for(unsigned y = 0; y < HEIGHT; ++y) {
+        for(unsigned x = 0; x < WIDTH; ++x) {
+            const uint8_t *pixel = consumer->pixels + (y * WIDTH + x) * consumer->bpp;
+            const uint8_t *want = expected[has_rect && is_inside_rect(x, y)];
+            if(memcmp(pixel, want, consumer->bpp)) {
+                fprintf(stderr, "format %d: wrong pixel at %u, %u\n", consumer->format, x, y);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+}
+
+static void run(av_display_format_t format, unsigned flags) {
+    consumer_t consumer = {.format = format, .bpp = bytes_per_pixel(format)};
+    // A8 displays only keep coverage, so that's what tells the two frames apart.
+    bool is_coverage = format == AV_DISPLAY_FORMAT_A8;
+    colour_t background = {1, 0, 0, 1};
+    colour_t rect = is_coverage ? (colour_t){0, 0, 0, 0} : (colour_t){0, 0, 1, 1};
+
+    av_display_t *display = av_display_new_desc(&(av_display_desc_t){
+        .width = WIDTH,
+        .height = HEIGHT,
+        .flags = flags,
+        .format = format,
+        .backend = AV_DISPLAY_BACKEND_CPU,
+        .consumer = consume,
+        .consumer_data = &consumer,
+    });
+    CHECK(display);
+
+    // Nothing drawn yet: nothing to consume.
+    av_display_upload(display);
+    CHECK(consumer.frames == 0);
+
+    fill(display, background, 0, 0, WIDTH, HEIGHT);
+    av_display_finish_back_buffer(display);
+    av_display_upload(display);
+    CHECK(consumer.frames == 1);
+    check_pixels(&consumer, background, rect, false);
+
+    fill(display, rect, RECT_X, RECT_Y, RECT_WIDTH, RECT_HEIGHT);
+    av_display_finish_back_buffer(display);
+    av_display_upload(display);
+    CHECK(consumer.frames == 2);
+    check_pixels(&consumer, background, rect, true);
+    if(flags & AV_DISPLAY_DAMAGE) {
+        CHECK(consumer.damage[0] == RECT_X && consumer.damage[1] == RECT_Y);
+        CHECK(consumer.damage[2] == RECT_WIDTH && consumer.damage[3] == RECT_HEIGHT);
+    }
+
+    // The frame was consumed, and isn't handed over twice.
+    av_display_upload(display);
+    CHECK(consumer.frames == 2);
+
+    av_display_delete(display);
+}
+
+static void consume_damage(const av_display_frame_t *frame, void *data) {
+    unsigned *damage = data;
+    damage[0] = frame->damage_x;
+    damage[1] = frame->damage_y;
+    damage[2] = frame->damage_width;
+    damage[3] = frame->damage_height;
+}
+
+// At a reduced tier, damage reported in user space must land on the render pixels it covers.
+static void run_scaled() {
+    unsigned damage[4] = {0};
+    av_display_t *display = av_display_new_desc(&(av_display_desc_t){
+        .width = WIDTH,
+        .height = HEIGHT,
+        .flags = AV_DISPLAY_DAMAGE,
+        .format = AV_DISPLAY_FORMAT_ARGB32,
+        .backend = AV_DISPLAY_BACKEND_CPU,
+        .consumer = consume_damage,
+        .consumer_data = damage,
+    });
+    CHECK(display);
+
+    // A budget no frame keeps to drives the display down to half its resolution.
+    av_display_set_budget(display, 1e-5, 0.5);
+    for(unsigned i = 0; i < 100 && av_display_get_scale(display) > 0.5; ++i) {
+        CHECK(av_display_get_cairo(display));
+        usleep(100);
+        av_display_damage_all(display);
+        av_display_finish_back_buffer(display);
+        av_display_upload(display);
+    }
+    CHECK(av_display_get_scale(display) == 0.5);
+
+    // The first frame at the new resolution is damaged whole.
+    CHECK(av_display_get_cairo(display));
+    av_display_finish_back_buffer(display);
+    av_display_upload(display);
+
+    cairo_t *cr = av_display_get_cairo(display);
+    CHECK(cr);
+    cairo_set_source_rgba(cr, 0, 0, 1, 1);
+    cairo_rectangle(cr, RECT_X, RECT_Y, RECT_WIDTH, RECT_HEIGHT);
+    av_display_damage_fill(display);
+    cairo_fill(cr);
+    av_display_finish_back_buffer(display);
+    av_display_upload(display);
+
+    // Half the rectangle, rounded out, with the pixel of padding left for antialiasing.
+    unsigned x0 = RECT_X / 2 - 1, y0 = RECT_Y / 2 - 1;
+    unsigned x1 = (RECT_X + RECT_WIDTH + 1) / 2 + 1, y1 = (RECT_Y + RECT_HEIGHT + 1) / 2 + 1;
+    CHECK(damage[0] == x0 && damage[1] == y0);
+    CHECK(damage[2] == x1 - x0 && damage[3] == y1 - y0);
+
+    av_display_delete(display);
+}
+
+// Display inputs sample datarefs through this, and there is no simulator to read them from. Only
+// version counters are watched here.
+double dref_get_f64(const dref_t *dref) {
+    (void)dref;
+    abort();
+}
+
+// Draws a frame from inside the consumer, which holds the slot of the frame it is given like a GL
+// thread uploading it would. With two slots, a zero-copy display then has none left for the next
+// frame, and the input change that asked for it must not be lost.
+typedef struct {
+    av_display_t *display;
+    uint64_t version;
+    unsigned frames;
+} starved_t;
+
+static void consume_starved(const av_display_frame_t *frame, void *data) {
+    (void)frame;
+    starved_t *starved = data;
+    starved->frames += 1;
+    if(starved->frames != 1) return;
+
+    starved->version += 1;
+    av_display_poll_inputs(starved->display);
+    CHECK(av_display_needs_redraw(starved->display));
+    CHECK(av_display_clear(starved->display));
+    av_display_finish_back_buffer(starved->display);
+
+    starved->version += 1;
+    av_display_poll_inputs(starved->display);
+    CHECK(av_display_needs_redraw(starved->display));
+    CHECK(!av_display_get_cairo(starved->display));
+}
+
+static void run_starved() {
+    starved_t starved = {0};
+    av_display_t *display = av_display_new_desc(&(av_display_desc_t){
+        .width = WIDTH,
+        .height = HEIGHT,
+        .flags = AV_DISPLAY_ZERO_COPY,
+        .slots = 2,
+        .format = AV_DISPLAY_FORMAT_ARGB32,
+        .backend = AV_DISPLAY_BACKEND_CPU,
+        .consumer = consume_starved,
+        .consumer_data = &starved,
+    });
+    CHECK(display);
+    starved.display = display;
+    av_display_watch_version(display, &starved.version);
+
+    // Watching an input asks for a first frame.
+    CHECK(av_display_needs_redraw(display));
+    CHECK(av_display_clear(display));
+    av_display_finish_back_buffer(display);
+    CHECK(!av_display_needs_redraw(display));
+
+    av_display_upload(display);
+    CHECK(starved.frames == 1);
+
+    // The frame that found no slot is still owed, and can be drawn now that one is free.
+    av_display_upload(display);
+    CHECK(starved.frames == 2);
+    CHECK(av_display_needs_redraw(display));
+    CHECK(av_display_get_cairo(display));
+    av_display_finish_back_buffer(display);
+    CHECK(!av_display_needs_redraw(display));
+
+    av_display_delete(display);
+}
+
+int main(void) {
+    static const av_display_format_t formats[] = {
+        AV_DISPLAY_FORMAT_ARGB32,
+        AV_DISPLAY_FORMAT_A8,
+        AV_DISPLAY_FORMAT_RGB565,
+        AV_DISPLAY_FORMAT_RGBA32,
+    };
+
+    for(unsigned i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i) {
+        av_display_format_t format = formats[i];
+        run(format, 0);
+        run(format, AV_DISPLAY_DAMAGE);
+        if(format == AV_DISPLAY_FORMAT_A8 || format == AV_DISPLAY_FORMAT_RGB565) {
+            run(format, AV_DISPLAY_DAMAGE | AV_DISPLAY_DRAW_ARGB32);
+        }
+    }
+    run_scaled();
+    run_starved();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,439 @@
+//===--------------------------------------------------------------------------------------------===
+// ring.c - Stress test of the frame ring between a drawing thread and a stubbed-out GL thread
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2021 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include <libavionics/display.h>
+#include <libavionics/glad.h>
+#include "test.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define WIDTH (61)
+#define HEIGHT (37)
+#define FRAMES (3000)
+#define MAX_BUFFERS (16)
+// Fences a non-blocking wait reports unsignalled at most, standing in for a GPU running behind.
+#define MAX_FENCE_POLLS (3)
+
+// Each frame fills the display with its number, so that a mix of two frames shows up as a torn
+// upload, and an old frame as a number going backwards.
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    bool is_mapped;
+    bool is_persistent;
+} buffer_t;
+
+// A transfer the GPU may still be reading from.
+typedef struct {
+    unsigned buffer;
+    size_t offset;
+    int width;
+    int height;
+    int row_length;
+    uint32_t frame;
+} transfer_t;
+
+typedef struct fence_s fence_t;
+struct fence_s {
+    transfer_t transfer;
+    unsigned polls;
+    bool is_signaled;
+    fence_t *next;
+};
+
+static pthread_t gl_thread;
+static buffer_t buffers[MAX_BUFFERS];
+static unsigned next_name = 1;
+static unsigned unpack_buffer = 0;
+static int unpack_row_length = 0;
+static transfer_t last_transfer;
+static fence_t *in_flight = NULL;
+static unsigned seed = 1;
+
+static av_display_t *display;
+static unsigned draw_us;
+static unsigned upload_us;
+static atomic_uint drawn;
+static atomic_uint last_published;
+static unsigned long published = 0;
+static uint32_t last_uploaded = 0;
+static unsigned long uploads = 0;
+
+static void on_gl_thread() {
+    CHECK(pthread_equal(pthread_self(), gl_thread));
+}
+
+// Returns the frame [transfer] reads, failing if it doesn't read a single, whole one.
+static uint32_t read_transfer(const transfer_t *transfer) {
+    const buffer_t *buffer = &buffers[transfer->buffer];
+    size_t stride = transfer->row_length * 4;
+    CHECK(transfer->offset + (transfer->height - 1) * stride + transfer->width * 4 <= buffer->size);
+
+    uint32_t frame;
+    memcpy(&frame, buffer->data + transfer->offset, sizeof(frame));
+    for(int y = 0; y < transfer->height; ++y) {
+        const uint8_t *row = buffer->data + transfer->offset + y * stride;
+        for(int x = 0; x < transfer->width; ++x) {
+            uint32_t pixel;
+            memcpy(&pixel, row + x * 4, sizeof(pixel));
+            CHECK(pixel == frame);
+        }
+    }
+    return frame;
+}
+
+// Until its fence is seen to signal, the GPU may still be reading a transfer, whose slot must be
+// left alone. Checked on every GL call that has to do with slots.
+static void check_in_flight() {
+    for(const fence_t *fence = in_flight; fence; fence = fence->next) {
+        if(fence->is_signaled) continue;
+        CHECK(read_transfer(&fence->transfer) == fence->transfer.frame);
+    }
+}
+
+static GLsync APIENTRY fence_sync(GLenum condition, GLbitfield flags) {
+    (void)condition;
+    (void)flags;
+    on_gl_thread();
+    fence_t *fence = malloc(sizeof(fence_t));
+    CHECK(fence);
+    fence->transfer = last_transfer;
+    fence->polls = rand_r(&seed) % (MAX_FENCE_POLLS + 1);
+    fence->is_signaled = false;
+    fence->next = in_flight;
+    in_flight = fence;
+    return (GLsync)fence;
+}
+
+static GLenum APIENTRY client_wait_sync(GLsync sync, GLbitfield flags, GLuint64 timeout) {
+    (void)flags;
+    on_gl_thread();
+    check_in_flight();
+    fence_t *fence = (fence_t *)sync;
+    if(!timeout && fence->polls) {
+        fence->polls -= 1;
+        return GL_TIMEOUT_EXPIRED;
+    }
+    fence->is_signaled = true;
+    return timeout ? GL_CONDITION_SATISFIED : GL_ALREADY_SIGNALED;
+}
+
+static void APIENTRY delete_sync(GLsync sync) {
+    on_gl_thread();
+    fence_t **link = &in_flight;
+    while(*link != (fence_t *)sync) link = &(*link)->next;
+    *link = (*link)->next;
+    free(sync);
+}
+
+static void APIENTRY gen_buffers(GLsizei count, GLuint *names) {
+    on_gl_thread();
+    for(GLsizei i = 0; i < count; ++i) {
+        CHECK(next_name < MAX_BUFFERS);
+        names[i] = next_name++;
+    }
+}
+
+static void APIENTRY delete_buffers(GLsizei count, const GLuint *names) {
+    on_gl_thread();
+    for(GLsizei i = 0; i < count; ++i) {
+        free(buffers[names[i]].data);
+        buffers[names[i]] = (buffer_t){NULL, 0, false, false};
+    }
+}
+
+static void APIENTRY bind_buffer(GLenum target, GLuint name) {
+    on_gl_thread();
+    if(target == GL_PIXEL_UNPACK_BUFFER) unpack_buffer = name;
+}
+
+// New storage starts out as garbage, so that a slot read before it is written to shows.
+static void allocate(buffer_t *buffer, size_t size) {
+    CHECK(!buffer->is_mapped);
+    free(buffer->data);
+    buffer->data = malloc(size);
+    CHECK(buffer->data);
+    memset(buffer->data, 0xcd, size);
+    buffer->size = size;
+}
+
+static void APIENTRY buffer_data(GLenum target, GLsizeiptr size, const void *data, GLenum usage) {
+    (void)data;
+    (void)usage;
+    on_gl_thread();
+    if(target != GL_PIXEL_UNPACK_BUFFER) return;
+    CHECK(unpack_buffer);
+    CHECK(!buffers[unpack_buffer].is_persistent);
+    allocate(&buffers[unpack_buffer], size);
+}
+
+static void APIENTRY buffer_storage(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags) {
+    (void)data;
+    (void)flags;
+    on_gl_thread();
+    CHECK(target == GL_PIXEL_UNPACK_BUFFER && unpack_buffer);
+    allocate(&buffers[unpack_buffer], size);
+    buffers[unpack_buffer].is_persistent = true;
+}
+
+static void *APIENTRY map_buffer(GLenum target, GLenum access) {
+    (void)access;
+    on_gl_thread();
+    CHECK(target == GL_PIXEL_UNPACK_BUFFER && unpack_buffer);
+    CHECK(!buffers[unpack_buffer].is_mapped);
+    buffers[unpack_buffer].is_mapped = true;
+    return buffers[unpack_buffer].data;
+}
+
+static void *APIENTRY map_buffer_range(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access) {
+    (void)length;
+    on_gl_thread();
+    CHECK(target == GL_PIXEL_UNPACK_BUFFER && unpack_buffer);
+    CHECK(!buffers[unpack_buffer].is_mapped);
+    buffers[unpack_buffer].is_mapped = !(access & GL_MAP_PERSISTENT_BIT);
+    return buffers[unpack_buffer].data + offset;
+}
+
+static GLboolean APIENTRY unmap_buffer(GLenum target) {
+    on_gl_thread();
+    CHECK(target == GL_PIXEL_UNPACK_BUFFER && unpack_buffer);
+    buffers[unpack_buffer].is_mapped = false;
+    return GL_TRUE;
+}
+
+static void APIENTRY pixel_store(GLenum name, GLint value) {
+    on_gl_thread();
+    if(name == GL_UNPACK_ROW_LENGTH) unpack_row_length = value;
+}
+
+static void APIENTRY tex_sub_image(
+    GLenum target, GLint level, GLint x, GLint y, GLsizei width, GLsizei height,
+    GLenum format, GLenum type, const void *pixels
+) {
+    (void)target;
+    (void)level;
+    (void)format;
+    (void)type;
+    on_gl_thread();
+    check_in_flight();
+    CHECK(unpack_buffer);
+    CHECK(x == 0 && y == 0 && width == WIDTH && height == HEIGHT);
+    const buffer_t *buffer = &buffers[unpack_buffer];
+    CHECK(!buffer->is_mapped || buffer->is_persistent);
+
+    last_transfer = (transfer_t){
+        .buffer = unpack_buffer,
+        .offset = (size_t)pixels,
+        .width = width,
+        .height = height,
+        .row_length = unpack_row_length ? unpack_row_length : width,
+    };
+    uint32_t frame = read_transfer(&last_transfer);
+    CHECK(frame > last_uploaded);
+    CHECK(frame <= atomic_load(&drawn));
+    last_transfer.frame = frame;
+    last_uploaded = frame;
+    uploads += 1;
+}
+
+static void APIENTRY gen_textures(GLsizei count, GLuint *names) {
+    on_gl_thread();
+    for(GLsizei i = 0; i < count; ++i) {
+        names[i] = 1;
+    }
+}
+
+static void APIENTRY delete_textures(GLsizei count, const GLuint *names) {
+    (void)count;
+    (void)names;
+    on_gl_thread();
+}
+
+static void APIENTRY bind_texture(GLenum target, GLuint name) {
+    (void)target;
+    (void)name;
+    on_gl_thread();
+}
+
+static void APIENTRY active_texture(GLenum unit) {
+    (void)unit;
+    on_gl_thread();
+}
+
+static void APIENTRY tex_image(
+    GLenum target, GLint level, GLint internal, GLsizei width, GLsizei height, GLint border,
+    GLenum format, GLenum type, const void *pixels
+) {
+    (void)target;
+    (void)level;
+    (void)internal;
+    (void)width;
+    (void)height;
+    (void)border;
+    (void)format;
+    (void)type;
+    (void)pixels;
+    on_gl_thread();
+}
+
+static void APIENTRY tex_parameter(GLenum target, GLenum name, GLint value) {
+    (void)target;
+    (void)name;
+    (void)value;
+    on_gl_thread();
+}
+
+static GLint APIENTRY get_location(GLuint program, const GLchar *name) {
+    (void)program;
+    (void)name;
+    on_gl_thread();
+    return -1;
+}
+
+static void APIENTRY use_program(GLuint program) {
+    (void)program;
+    on_gl_thread();
+}
+
+static void APIENTRY uniform_int(GLint location, GLint value) {
+    (void)location;
+    (void)value;
+    on_gl_thread();
+}
+
+static GLenum APIENTRY get_error() {
+    on_gl_thread();
+    return GL_NO_ERROR;
+}
+
+static void stub_gl(bool is_persistent) {
+    gl_thread = pthread_self();
+    glad_glGenBuffers = gen_buffers;
+    glad_glDeleteBuffers = delete_buffers;
+    glad_glBindBuffer = bind_buffer;
+    glad_glBufferData = buffer_data;
+    glad_glMapBuffer = map_buffer;
+    glad_glMapBufferRange = map_buffer_range;
+    glad_glUnmapBuffer = unmap_buffer;
+    glad_glPixelStorei = pixel_store;
+    glad_glGenTextures = gen_textures;
+    glad_glDeleteTextures = delete_textures;
+    glad_glBindTexture = bind_texture;
+    glad_glActiveTexture = active_texture;
+    glad_glTexImage2D = tex_image;
+    glad_glTexSubImage2D = tex_sub_image;
+    glad_glTexParameteri = tex_parameter;
+    glad_glGetUniformLocation = get_location;
+    glad_glGetAttribLocation = get_location;
+    glad_glUseProgram = use_program;
+    glad_glUniform1i = uniform_int;
+    glad_glGetError = get_error;
+    glad_glFenceSync = fence_sync;
+    glad_glClientWaitSync = client_wait_sync;
+    glad_glDeleteSync = delete_sync;
+
+    GLAD_GL_ARB_buffer_storage = is_persistent;
+    glad_glBufferStorage = is_persistent ? buffer_storage : NULL;
+}
+
+static void pause_up_to(unsigned max_us, unsigned *state) {
+    if(max_us) usleep(rand_r(state) % max_us);
+}
+
+static void *draw_frames(void *data) {
+    (void)data;
+    unsigned state = 2;
+    for(uint32_t frame = 1; frame <= FRAMES; ++frame) {
+        cairo_t *cr;
+        while(!(cr = av_display_get_cairo(display))) {
+            usleep(10);
+        }
+        cairo_surface_t *surface = cairo_get_target(cr);
+        cairo_surface_flush(surface);
+        uint8_t *pixels = cairo_image_surface_get_data(surface);
+        int stride = cairo_image_surface_get_stride(surface);
+        for(int y = 0; y < HEIGHT; ++y) {
+            for(int x = 0; x < WIDTH; ++x) {
+                memcpy(pixels + y * stride + x * 4, &frame, sizeof(frame));
+            }
+        }
+        cairo_surface_mark_dirty(surface);
+
+        // Counted first, so that the GL thread never sees a frame it doesn't know was drawn. Frames
+        // that find no slot to go into are held back, and their damage goes with the next one.
+        atomic_store(&drawn, frame);
+        av_display_stats_t stats;
+        av_display_get_stats(display, &stats);
+        av_display_finish_back_buffer(display);
+        unsigned long produced = stats.produced;
+        av_display_get_stats(display, &stats);
+        if(stats.produced != produced) {
+            published += 1;
+            atomic_store(&last_published, frame);
+        }
+        pause_up_to(draw_us, &state);
+    }
+    return NULL;
+}
+
+int main(int argc, const char **argv) {
+    if(argc != 6) {
+        fprintf(stderr, "usage: %s slots persistent zero_copy draw_us upload_us\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    unsigned slots = atoi(argv[1]);
+    bool is_persistent = atoi(argv[2]);
+    bool is_zero_copy = atoi(argv[3]);
+    draw_us = atoi(argv[4]);
+    upload_us = atoi(argv[5]);
+
+    stub_gl(is_persistent);
+    display = av_display_new_desc(&(av_display_desc_t){
+        .width = WIDTH,
+        .height = HEIGHT,
+        .flags = is_zero_copy ? AV_DISPLAY_ZERO_COPY : 0,
+        .slots = slots,
+        .format = AV_DISPLAY_FORMAT_ARGB32,
+    });
+    CHECK(display);
+    av_display_fence_stats_t fences;
+    av_display_get_fence_stats(display, &fences);
+    CHECK(fences.is_persistent == is_persistent);
+
+    pthread_t drawing_thread;
+    CHECK(!pthread_create(&drawing_thread, NULL, draw_frames, NULL));
+    unsigned state = 3;
+    while(atomic_load(&drawn) < FRAMES) {
+        av_display_upload(display);
+        pause_up_to(upload_us, &state);
+    }
+    CHECK(!pthread_join(drawing_thread, NULL));
+    check_in_flight();
+
+    // Once drawing stops, the newest frame must make it to the texture, and every frame that didn't
+    // must have been replaced by a newer one.
+    av_display_upload(display);
+    CHECK(last_uploaded == atomic_load(&last_published));
+
+    av_display_stats_t stats;
+    av_display_get_stats(display, &stats);
+    CHECK(stats.produced == published);
+    CHECK(stats.uploaded == uploads);
+    CHECK(stats.produced == stats.uploaded + stats.dropped);
+
+    av_display_get_fence_stats(display, &fences);
+    printf("%lu frames uploaded, %lu dropped, %lu held back, %lu fence waits, %lu blocked\n",
+        stats.uploaded, stats.dropped, FRAMES - published, fences.waits, fences.blocked);
+    av_display_delete(display);
+    CHECK(!in_flight);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,19 @@
+//===--------------------------------------------------------------------------------------------===
+// test.h - Checks shared by the test programs
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2021 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+
+// Unlike assert(), checks are never compiled out.
+#define CHECK(cond) do { \
+        if(!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while(0)
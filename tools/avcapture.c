@@ -0,0 +1,246 @@
+//===--------------------------------------------------------------------------------------------===
+// avcapture.c - Turns display capture streams back into PNG images
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2021 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "capture.h"
+#include <cairo/cairo.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    FILE *file;
+    long file_size;
+    long records_end;
+    av_capture_header_t header;
+    size_t frame_size;
+
+    uint64_t *index;
+    uint64_t count;
+
+    uint8_t *frame;
+    uint8_t *delta;
+    uint8_t *data;
+    uint32_t *argb;
+} reader_t;
+
+static void usage(void) {
+    fprintf(stderr, "usage: avcapture <capture> <output prefix> [first frame] [frame count]\n");
+    fprintf(stderr, "       avcapture -l <capture>\n");
+}
+
+// The trailer comes last, after the index entries it counts. Records end where the index starts,
+// or at the end of the file if there is no index.
+static bool read_index(reader_t *reader) {
+    av_capture_trailer_t trailer;
+    long size = reader->file_size;
+    long start = sizeof(av_capture_header_t);
+    reader->records_end = size;
+    if(size - start < (long)sizeof(trailer)) return false;
+    if(fseek(reader->file, size - (long)sizeof(trailer), SEEK_SET)) return false;
+    if(fread(&trailer, sizeof(trailer), 1, reader->file) != 1) return false;
+    if(memcmp(trailer.magic, AV_CAPTURE_INDEX_MAGIC, sizeof(trailer.magic))) return false;
+
+    reader->records_end = size - (long)sizeof(trailer);
+    if(trailer.count > (uint64_t)(reader->records_end - start) / sizeof(uint64_t)) return false;
+    long end = reader->records_end - (long)(trailer.count * sizeof(uint64_t));
+    reader->records_end = end;
+    if(fseek(reader->file, end, SEEK_SET)) return false;
+    reader->index = realloc(reader->index, (trailer.count ? trailer.count : 1) * sizeof(uint64_t));
+    if(fread(reader->index, sizeof(uint64_t), trailer.count, reader->file) != trailer.count) return false;
+    for(uint64_t i = 0; i < trailer.count; ++i) {
+        uint64_t offset = reader->index[i];
+        if(offset < (uint64_t)start || offset + sizeof(av_capture_record_t) > (uint64_t)end) return false;
+    }
+    reader->count = trailer.count;
+    return true;
+}
+
+// Captures that weren't stopped cleanly have no index: rebuild it by walking the records, up to the
+// last one that was written in full.
+static void scan_index(reader_t *reader) {
+    long end = reader->records_end;
+    uint64_t capacity = 256;
+    reader->index = realloc(reader->index, capacity * sizeof(uint64_t));
+    reader->count = 0;
+
+    long offset = sizeof(av_capture_header_t);
+    av_capture_record_t record;
+    while(end - offset >= (long)sizeof(record)
+          && !fseek(reader->file, offset, SEEK_SET)
+          && fread(&record, sizeof(record), 1, reader->file) == 1) {
+        if(record.size > (uint64_t)(end - offset - (long)sizeof(record))) break;
+        if(record.width > reader->header.width || record.height > reader->header.height) break;
+        if(reader->count == capacity) {
+            capacity *= 2;
+            reader->index = realloc(reader->index, capacity * sizeof(uint64_t));
+        }
+        reader->index[reader->count++] = offset;
+        offset += sizeof(record) + record.size;
+    }
+}
+
+static bool open_capture(reader_t *reader, const char *path) {
+    reader->file = fopen(path, "rb");
+    if(!reader->file) {
+        fprintf(stderr, "avcapture: unable to open `%s`\n", path);
+        return false;
+    }
+    av_capture_header_t *header = &reader->header;
+    if(fread(header, sizeof(*header), 1, reader->file) != 1
+       || memcmp(header->magic, AV_CAPTURE_MAGIC, sizeof(header->magic))
+       || header->version != AV_CAPTURE_VERSION) {
+        fprintf(stderr, "avcapture: `%s` is not a capture stream\n", path);
+        return false;
+    }
+    if(header->encoding == AV_CAPTURE_PNG) {
+        fprintf(stderr, "avcapture: `%s` has an invalid encoding\n", path);
+        return false;
+    }
+
+    if(fseek(reader->file, 0, SEEK_END) || (reader->file_size = ftell(reader->file)) < 0) {
+        fprintf(stderr, "avcapture: unable to read `%s`\n", path);
+        return false;
+    }
+    if(!read_index(reader)) scan_index(reader);
+
+    reader->frame_size = (size_t)header->width * header->height * header->bpp;
+    reader->frame = calloc(1, reader->frame_size);
+    reader->delta = malloc(reader->frame_size);
+    reader->data = NULL;
+    reader->argb = malloc((size_t)header->width * header->height * sizeof(uint32_t));
+    return true;
+}
+
+static void close_capture(reader_t *reader) {
+    if(reader->file) fclose(reader->file);
+    free(reader->index);
+    free(reader->frame);
+    free(reader->delta);
+    free(reader->data);
+    free(reader->argb);
+}
+
+static bool read_record(reader_t *reader, uint64_t i, av_capture_record_t *record) {
+    long offset = reader->index[i];
+    if(fseek(reader->file, offset, SEEK_SET)) return false;
+    if(fread(record, sizeof(*record), 1, reader->file) != 1) return false;
+    return record->size <= (uint64_t)(reader->records_end - offset - (long)sizeof(*record));
+}
+
+// Decodes frame [i] over the previous one, which must be frame i - 1 unless [i] is a key frame.
+static bool decode_frame(reader_t *reader, uint64_t i, av_capture_record_t *record) {
+    if(!read_record(reader, i, record)) return false;
+    reader->data = realloc(reader->data, record->size ? record->size : 1);
+    if(fread(reader->data, 1, record->size, reader->file) != record->size) return false;
+
+    const av_capture_header_t *header = &reader->header;
+    switch(header->encoding) {
+    case AV_CAPTURE_RAW:
+        if(record->size != reader->frame_size) return false;
+        memcpy(reader->frame, reader->data, reader->frame_size);
+        return true;
+
+    case AV_CAPTURE_RLE:
+        return av_rle_decode(reader->frame, reader->frame_size, reader->data, record->size, header->bpp);
+
+    case AV_CAPTURE_DELTA:
+        if(record->flags & AV_CAPTURE_KEY_FRAME) {
+            return av_rle_decode(reader->frame, reader->frame_size, reader->data, record->size, header->bpp);
+        }
+        if(!av_rle_decode(reader->delta, reader->frame_size, reader->data, record->size, header->bpp)) return false;
+        for(size_t j = 0; j < reader->frame_size; ++j) reader->frame[j] ^= reader->delta[j];
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+static bool write_png(reader_t *reader, const av_capture_record_t *record, const char *prefix, uint64_t i) {
+    const av_capture_header_t *header = &reader->header;
+    if(record->width > header->width || record->height > header->height) return false;
+    av_capture_to_argb32(reader->argb, reader->frame, record->width, record->height, header->width * header->bpp, header->format);
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s-%06llu.png", prefix, (unsigned long long)i);
+    cairo_surface_t *surface = cairo_image_surface_create_for_data(
+        (uint8_t *)reader->argb, CAIRO_FORMAT_ARGB32, record->width, record->height, record->width * 4
+    );
+    cairo_status_t status = cairo_surface_write_to_png(surface, path);
+    cairo_surface_destroy(surface);
+    if(status != CAIRO_STATUS_SUCCESS) {
+        fprintf(stderr, "avcapture: unable to write `%s`\n", path);
+        return false;
+    }
+    return true;
+}
+
+static int list(reader_t *reader) {
+    const av_capture_header_t *header = &reader->header;
+    printf("%ux%u, format %u, encoding %u, %llu frames\n",
+        header->width, header->height, header->format, header->encoding, (unsigned long long)reader->count);
+
+    av_capture_record_t record;
+    for(uint64_t i = 0; i < reader->count; ++i) {
+        if(!read_record(reader, i, &record)) return 1;
+        printf("%6llu  seq %8llu  %12.3f ms  %ux%u  %s%u bytes\n",
+            (unsigned long long)i, (unsigned long long)record.seq, record.time_us / 1000.0,
+            record.width, record.height,
+            record.flags & AV_CAPTURE_KEY_FRAME ? "key, " : "", record.size);
+    }
+    return 0;
+}
+
+static int extract(reader_t *reader, const char *prefix, uint64_t first, uint64_t count) {
+    if(first >= reader->count) return 0;
+    if(count > reader->count - first) count = reader->count - first;
+
+    // Delta frames need everything since the last key frame before [first].
+    uint64_t start = first;
+    av_capture_record_t record;
+    while(start > 0) {
+        if(!read_record(reader, start, &record)) break;
+        if(record.flags & AV_CAPTURE_KEY_FRAME) break;
+        start -= 1;
+    }
+
+    for(uint64_t i = start; i < first + count; ++i) {
+        if(!decode_frame(reader, i, &record)) {
+            fprintf(stderr, "avcapture: frame %llu is corrupted\n", (unsigned long long)i);
+            return 1;
+        }
+        if(i < first) continue;
+        if(!write_png(reader, &record, prefix, i)) return 1;
+    }
+    return 0;
+}
+
+int main(int argc, const char **argv) {
+    if(argc < 3) {
+        usage();
+        return 1;
+    }
+
+    reader_t reader = {0};
+    bool is_list = !strcmp(argv[1], "-l");
+    if(!open_capture(&reader, is_list ? argv[2] : argv[1])) {
+        close_capture(&reader);
+        return 1;
+    }
+
+    int result = 0;
+    if(is_list) {
+        result = list(&reader);
+    } else {
+        uint64_t first = argc > 3 ? strtoull(argv[3], NULL, 10) : 0;
+        uint64_t count = argc > 4 ? strtoull(argv[4], NULL, 10) : reader.count;
+        result = extract(&reader, argv[2], first, count);
+    }
+    close_capture(&reader);
+    return result;
+}